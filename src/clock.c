@@ -0,0 +1,187 @@
+/*
+ * File: clock.c
+ *
+ * Clock service. Log records and Received: lines need the time
+ * rendered as text, in several forms; working these out with
+ * localtime(), strftime() and so on for every record costs far more
+ * than the rest of the job. The time only changes once a second, so
+ * each second is rendered in every form just once, the first time it
+ * is asked for, and kept. The zone offset is worked out afresh at the
+ * same time, so a change of zone is seen within a second.
+ *
+ * The renderings of the last few seconds are kept in a ring of slots,
+ * each with a sequence number which is odd while the slot is being
+ * filled. A caller copies what it wants without taking any lock, then
+ * checks that the sequence number has not changed meanwhile; if it
+ * has, or the second is not there, the caller renders it instead.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include <builtin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define	INCL_DOSMISC
+#include <os2.h>
+
+#include "clock.h"
+
+#define	CLOCKSLOTS	8		/* Seconds kept (a power of 2) */
+
+/* Type definitions */
+
+typedef	struct	_CLOCKSLOT {		/* Renderings of one second */
+volatile INT	seq;			/* Odd while being filled */
+time_t		tod;			/* The second rendered */
+UCHAR		str[CLOCK_FORMATS][CLOCK_MAXSTR];
+					/* Its renderings */
+} CLOCKSLOT, *PCLOCKSLOT;
+
+/* Forward references */
+
+static	BOOL	lookup(INT, INT, time_t, PUCHAR);
+static	VOID	render(PCLOCKSLOT, time_t);
+
+/* Local storage */
+
+static	volatile INT busy;		/* A slot is being filled */
+static	volatile INT current;		/* Slot holding the latest second */
+static	CLOCKSLOT slots[CLOCKSLOTS];	/* The seconds kept */
+
+
+/*
+ * Put the time 'tod' into 'buf', rendered in the form given by 'which'
+ * (one of the CLOCK_ values). The buffer must hold CLOCK_MAXSTR bytes.
+ *
+ * Returns:
+ *	length of rendering
+ *
+ */
+
+INT clock_format(INT which, time_t tod, PUCHAR buf)
+{	INT cur;
+	PCLOCKSLOT sp;
+	CLOCKSLOT mine;
+
+	/* Look in the latest second, then the one before; records may
+	   be written a little after they were made. */
+
+	cur = current;
+	if(lookup(which, cur, tod, buf) == TRUE ||
+	   lookup(which, cur - 1, tod, buf) == TRUE)
+		return(strlen(buf));
+
+	/* Not there. If it is a new second, and no other thread is busy
+	   filling a slot, render it into the next slot for others to
+	   use; otherwise, just render it for this caller. */
+
+	if(tod > slots[cur & (CLOCKSLOTS-1)].tod &&
+	   __cxchg(&busy, 0, 1) == 0) {
+		cur = current + 1;
+		sp = &slots[cur & (CLOCKSLOTS-1)];
+		(VOID) __lxchg(&sp->seq, sp->seq + 1);
+		render(sp, tod);
+		(VOID) __lxchg(&sp->seq, sp->seq + 1);
+		(VOID) __lxchg(&current, cur);
+		(VOID) __lxchg(&busy, 0);
+	} else {
+		sp = &mine;
+		render(sp, tod);
+	}
+
+	strcpy(buf, sp->str[which]);
+
+	return(strlen(buf));
+}
+
+
+/*
+ * Read the millisecond counter, for measuring intervals.
+ *
+ * Returns:
+ *	milliseconds since boot (wraps after about 49 days)
+ *
+ */
+
+ULONG clock_msecs(VOID)
+{	ULONG ms;
+
+	(VOID) DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof(ms));
+
+	return(ms);
+}
+
+
+/*
+ * Look for the time 'tod' in slot 'n' of the ring; if it is there,
+ * copy the rendering given by 'which' into 'buf'.
+ *
+ * Returns:
+ *	TRUE		rendering copied
+ *	FALSE		time not in slot, or slot changed while copying
+ *
+ */
+
+static BOOL lookup(INT which, INT n, time_t tod, PUCHAR buf)
+{	INT seq;
+	PCLOCKSLOT sp = &slots[n & (CLOCKSLOTS-1)];
+
+	seq = sp->seq;
+	if((seq & 1) != 0 || sp->tod != tod) return(FALSE);
+	memcpy(buf, sp->str[which], CLOCK_MAXSTR);
+
+	return(sp->seq == seq ? TRUE : FALSE);
+}
+
+
+/*
+ * Render the time 'tod' in every form, into the slot pointed to by
+ * 'sp'.
+ *
+ */
+
+static VOID render(PCLOCKSLOT sp, time_t tod)
+{	INT len, days, utcdiff;
+	struct tm ltm, gtm;
+
+	ltm = *(localtime(&tod));
+	gtm = *(gmtime(&tod));
+
+	(VOID) strftime(sp->str[CLOCK_LOGFILE], CLOCK_MAXSTR,
+			"%d/%m/%y %X> ", &ltm);
+	(VOID) strftime(sp->str[CLOCK_SYSLOG], CLOCK_MAXSTR,
+			"%b %Oe %T ", &ltm);
+	(VOID) strftime(sp->str[CLOCK_RFC5424], CLOCK_MAXSTR,
+			"%Y-%m-%dT%H:%M:%SZ", &gtm);
+
+	/* To be RFC 5322 compliant, the timezone must be displayed as
+	   an offset. This is the difference between local time and UTC,
+	   which are never more than a day apart. Converting UTC back to
+	   a 'time_t' with mktime() would get it wrong by an hour when
+	   summer time is in force. */
+
+	if(ltm.tm_year != gtm.tm_year)
+		days = ltm.tm_year < gtm.tm_year ? -1 : 1;
+	else
+		days = ltm.tm_yday - gtm.tm_yday;
+	utcdiff = (days*24 + ltm.tm_hour - gtm.tm_hour)*60 +
+		  ltm.tm_min - gtm.tm_min;	/* Offset in minutes */
+	len = strftime(sp->str[CLOCK_RFC5322], CLOCK_MAXSTR,
+			"%a, %Od %b %Y %X", &ltm);
+	sprintf(&sp->str[CLOCK_RFC5322][len], " %c%02d%02d",
+		utcdiff >= 0 ? '+': '-', abs(utcdiff)/60, abs(utcdiff)%60);
+
+	sp->tod = tod;
+}
+
+/*
+ * End of file: clock.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,37 @@
+/*
+ * File: clock.h
+ *
+ * Clock service; the current time, already rendered in the forms used
+ * for logging and for the Received: line, and the millisecond counter;
+ * header file.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Miscellaneous constants */
+
+#define	CLOCK_MAXSTR		40	/* Space needed for any rendering */
+
+#define	FALSE			0
+#define	TRUE			1
+
+/* Renderings of the time */
+
+#define	CLOCK_LOGFILE		0	/* Logfile "dd/mm/yy hh:mm:ss> " */
+#define	CLOCK_SYSLOG		1	/* BSD syslog "Mmm dd hh:mm:ss " */
+#define	CLOCK_RFC5424		2	/* RFC 5424 "yyyy-mm-ddThh:mm:ssZ" */
+#define	CLOCK_RFC5322		3	/* RFC 5322 date, with zone offset */
+#define	CLOCK_FORMATS		4	/* Number of renderings */
+
+/* External references */
+
+extern	INT	clock_format(INT, time_t, PUCHAR);
+extern	ULONG	clock_msecs(VOID);
+
+/*
+ * End of file: clock.h
+ *
+ */
+
+
\ No newline at end of file
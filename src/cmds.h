@@ -28,6 +28,7 @@
 #define	NOOP	13
 #define	QUIT	14
 #define	TURN	15
+#define	BDAT	16
 
 #define	CMDSIZE	4			/* Size of an SMTP command */
 
@@ -36,6 +37,7 @@ static	struct	cmdtab {
 	INT	cmdcode;		/* Command code */
 	BOOL	supported;		/* True if command actually supported */
 } cmdtab[] = {
+	{ "BDAT", BDAT, TRUE  },
 	{ "DATA", DATA, TRUE  },
 	{ "EHLO", EHLO, TRUE  },
 	{ "EXPN", EXPN, FALSE },
@@ -14,7 +14,22 @@
 
 #define	CMD_TRUSTED_HOST	1
 #define	CMD_LOGGING		2
-#define	CMD_BAD			3
+#define	CMD_REACTORS		3
+#define	CMD_AFFINITY		4
+#define	CMD_DNS_CACHE		5
+#define	CMD_RECV_BUFFER		6
+#define	CMD_MESSAGE_SIZE	7
+#define	CMD_COMMIT		8
+#define	CMD_SYNC		9
+#define	CMD_SECURITY_LOG	10
+#define	CMD_SPOOL_SHARDS	11
+#define	CMD_SPOOL_INDEX		12
+#define	CMD_SPOOL_SEGMENTS	13
+#define	CMD_SYSLOG_FORMAT	14
+#define	CMD_SYSLOG_SOCKET	15
+#define	CMD_EVENT_LOG		16
+#define	CMD_LOG_LIMIT		17
+#define	CMD_BAD			18
 
 static	struct {
 	UCHAR	*cmdname;		/* Command name */
@@ -22,6 +37,21 @@ static	struct {
 } cmdtab[] = {
 	{ "TRUSTED_HOST",	CMD_TRUSTED_HOST },
 	{ "LOGGING",		CMD_LOGGING },
+	{ "REACTORS",		CMD_REACTORS },
+	{ "AFFINITY",		CMD_AFFINITY },
+	{ "DNS_CACHE",		CMD_DNS_CACHE },
+	{ "RECV_BUFFER",	CMD_RECV_BUFFER },
+	{ "MESSAGE_SIZE",	CMD_MESSAGE_SIZE },
+	{ "COMMIT",		CMD_COMMIT },
+	{ "SYNC",		CMD_SYNC },
+	{ "SECURITY_LOG",	CMD_SECURITY_LOG },
+	{ "SPOOL_SHARDS",	CMD_SPOOL_SHARDS },
+	{ "SPOOL_INDEX",	CMD_SPOOL_INDEX },
+	{ "SPOOL_SEGMENTS",	CMD_SPOOL_SEGMENTS },
+	{ "SYSLOG_FORMAT",	CMD_SYSLOG_FORMAT },
+	{ "SYSLOG_SOCKET",	CMD_SYSLOG_SOCKET },
+	{ "EVENT_LOG",		CMD_EVENT_LOG },
+	{ "LOG_LIMIT",		CMD_LOG_LIMIT },
 	{ "",			CMD_BAD }	/* End of table marker */
 };
 
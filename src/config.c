@@ -15,16 +15,25 @@
 #pragma	alloc_text(a_init_seg, read_config)
 #pragma	alloc_text(a_init_seg, config_error)
 #pragma	alloc_text(a_init_seg, getcmd)
+#pragma	alloc_text(a_init_seg, mask_length)
 
 #include "smtpd.h"
 #include "confcmds.h"
+#include "mailstor.h"
+#include "netio.h"
+#include "resolve.h"
+#include "limit.h"
+#include "segment.h"
+#include "sync.h"
 
 #define	MAXLINE		200		/* Maximum length of a config line */
+#define	MAXMSGSIZE	2097151		/* Largest message size limit (KB) */
 
 /* Forward references */
 
 static	VOID	config_error(INT, PUCHAR, ...);
 static	INT	getcmd(PUCHAR);
+static	BOOL	mask_length(PUCHAR, PINT);
 
 
 /*
@@ -41,12 +50,13 @@ static	INT	getcmd(PUCHAR);
 INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 {	INT line = 0;
 	INT errors = 0;
-	ULONG addr, mask;
+	INT bits, n;
 	PUCHAR p, q, r, s, temp;
+	FILESTATUS3 fs;
 	UCHAR filename[CCHMAXPATH];
 	FILE *fp;
 	UCHAR buf[MAXLINE];
-	PINADDRENT phost;
+	UCHAR key[TRUST_KEYSIZE];
 
 	p = getenv(direnv);
 	if(p == (PUCHAR) NULL) {
@@ -61,9 +71,30 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 	/* Set defaults */
 
 	memset(config, 0, sizeof(CONFIG));
-	config->nthosts = 0;
-	config->thost_list = (PINADDRENT) NULL;
+	config->thosts.root = (PTNODE) NULL;
+	config->thosts.nentries = 0;
 	config->log_type = LOGGING_FILE;
+	config->reactors = 1;
+	config->affinity = FALSE;
+	config->dns_entries = RESOLVE_ENTRIES;
+	config->dns_ttl = RESOLVE_TTL;
+	config->dns_negttl = RESOLVE_NEGTTL;
+	config->recvbuf_min = NETBUFMIN;
+	config->recvbuf_max = NETBUFMAX;
+	config->max_size = 0;
+	config->commit_rename = FALSE;
+	config->sync_mode = SYNC_NONE;
+	config->sync_window = SYNC_WINDOW;
+	strcpy(config->security_log, SECURITY_LOG);
+	config->spool_shards = 0;
+	config->spool_index = FALSE;
+	config->spool_segments = 0;
+	config->syslog_format = LOGFMT_BSD;
+	config->syslog_socket[0] = '\0';
+	config->event_log = FALSE;
+	config->limit_rate = LIMIT_RATE;
+	config->limit_burst = LIMIT_BURST;
+	config->limit_interval = LIMIT_INTERVAL;
 
 	fp = fopen(filename, "r");
 	if(fp == (FILE *) NULL) {
@@ -109,16 +140,7 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 					errors++;
 					break;
 				}
-				if(r == (PUCHAR) NULL) {
-					config_error(
-						line,
-						"no mask after "
-						"TRUSTED_HOST command");
-					errors++;
-					break;
-				}
-				addr = inet_addr(q);
-				if(addr == INADDR_NONE) {
+				if(trust_parse(q, key, &bits) == FALSE) {
 					config_error(
 						line,
 						"malformed address "
@@ -127,37 +149,28 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 					errors++;
 					break;
 				}
-				mask = inet_addr(r);
-				if(mask == INADDR_NONE) {
-					config_error(
-						line,
-						"malformed mask "
-						"'%s'",
-						r);
-					errors++;
-					break;
+				if(r != (PUCHAR) NULL) {/* Address and mask */
+					if(strchr(q, '/') != (PUCHAR) NULL ||
+					   strchr(q, ':') != (PUCHAR) NULL ||
+					   mask_length(r, &n) == FALSE) {
+						config_error(
+							line,
+							"malformed mask "
+							"'%s'",
+							r);
+						errors++;
+						break;
+					}
+					bits = TRUST_V4PREFIX + n;
 				}
-				phost = (PINADDRENT) malloc(sizeof(INADDRENT));
-				if(phost == (PUCHAR) NULL) {
+				if(trust_add(&config->thosts, key, bits) ==
+									FALSE) {
 					config_error(
 						0,
 						"cannot allocate memory");
 					errors++;
 					break;
 				}
-				phost->interface_address.s_addr = addr;
-				phost->interface_mask.s_addr = mask;
-				phost->next = (PINADDRENT) NULL;
-				if(config->thost_list == (PINADDRENT) NULL) {
-					config->thost_list = phost;
-				} else {
-					PINADDRENT temp = config->thost_list;
-
-					while(temp->next != (PINADDRENT) NULL)
-						temp = temp->next;
-					temp->next = phost;
-				}
-				config->nthosts++;
 				break;
 
 			case CMD_LOGGING:
@@ -184,6 +197,479 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 				continue;
 				break;
 
+			case CMD_REACTORS:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"no count after "
+						"REACTORS command");
+					errors++;
+					continue;
+				}
+				if(stricmp(q, "auto") == 0) {
+					config->reactors = 0;
+					continue;
+				}
+				config->reactors = atoi(q);
+				if(config->reactors <= 0 ||
+				   config->reactors > MAXREACTORS) {
+					config_error(
+						line,
+						"reactor count must be between "
+						"1 and %d, or AUTO",
+						MAXREACTORS);
+					errors++;
+				}
+				continue;
+				break;
+
+			case CMD_AFFINITY:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "on") == 0) {
+					config->affinity = TRUE;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "off") == 0) {
+					config->affinity = FALSE;
+					continue;
+				}
+				config_error(
+					line,
+					"AFFINITY must be ON or OFF");
+				errors++;
+				continue;
+				break;
+
+			case CMD_DNS_CACHE:
+				if(q == (PUCHAR) NULL || r == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"DNS_CACHE needs entries "
+						"and TTL");
+					errors++;
+					continue;
+				}
+				if(strtok(NULL, " \t") != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				config->dns_entries = atoi(q);
+				config->dns_ttl = atoi(r);
+				if(s != (PUCHAR) NULL)
+					config->dns_negttl = atoi(s);
+				if(config->dns_entries <= 0 ||
+				   config->dns_entries > RESOLVE_MAXENTRIES) {
+					config_error(
+						line,
+						"DNS cache entries must be "
+						"between 1 and %d",
+						RESOLVE_MAXENTRIES);
+					errors++;
+				}
+				if(config->dns_ttl < 0 ||
+				   config->dns_negttl < 0) {
+					config_error(
+						line,
+						"DNS cache TTL must not "
+						"be negative");
+					errors++;
+				}
+				continue;
+				break;
+
+			case CMD_RECV_BUFFER:
+				if(s != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q == (PUCHAR) NULL || r == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"RECV_BUFFER needs smallest "
+						"and largest sizes");
+					errors++;
+					continue;
+				}
+				config->recvbuf_min = atoi(q)*1024;
+				config->recvbuf_max = atoi(r)*1024;
+				if(config->recvbuf_min <= 0 ||
+				   config->recvbuf_max > NETBUFLIMIT ||
+				   config->recvbuf_min > config->recvbuf_max) {
+					config_error(
+						line,
+						"receive buffer sizes must be "
+						"between 1 and %d (KB), "
+						"smallest first",
+						NETBUFLIMIT/1024);
+					errors++;
+				}
+				continue;
+				break;
+
+			case CMD_MESSAGE_SIZE:
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"MESSAGE_SIZE needs a size");
+					errors++;
+					continue;
+				}
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				n = atoi(q);
+				if(n < 0 || n > MAXMSGSIZE) {
+					config_error(
+						line,
+						"message size must be "
+						"between 0 and %d (KB)",
+						MAXMSGSIZE);
+					errors++;
+					continue;
+				}
+				config->max_size = (ULONG) n*1024;
+				continue;
+				break;
+
+			case CMD_COMMIT:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "patch") == 0) {
+					config->commit_rename = FALSE;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "rename") == 0) {
+					config->commit_rename = TRUE;
+					continue;
+				}
+				config_error(
+					line,
+					"COMMIT must be PATCH or RENAME");
+				errors++;
+				continue;
+				break;
+
+			case CMD_SYNC:
+				if(s != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "none") == 0) {
+					config->sync_mode = SYNC_NONE;
+				} else if(q != (PUCHAR) NULL &&
+					  stricmp(q, "message") == 0) {
+					config->sync_mode = SYNC_MESSAGE;
+				} else if(q != (PUCHAR) NULL &&
+					  stricmp(q, "group") == 0) {
+					config->sync_mode = SYNC_GROUP;
+				} else {
+					config_error(
+						line,
+						"SYNC must be NONE, MESSAGE "
+						"or GROUP");
+					errors++;
+					continue;
+				}
+				if(r == (PUCHAR) NULL) continue;
+				if(config->sync_mode != SYNC_GROUP) {
+					config_error(
+						line,
+						"window only allowed with "
+						"SYNC GROUP");
+					errors++;
+					continue;
+				}
+				config->sync_window = atoi(r);
+				if(config->sync_window < 0 ||
+				   config->sync_window > SYNC_MAXWINDOW) {
+					config_error(
+						line,
+						"sync window must be between "
+						"0 and %d (ms)",
+						SYNC_MAXWINDOW);
+					errors++;
+				}
+				continue;
+				break;
+
+			case CMD_SECURITY_LOG:
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"SECURITY_LOG needs a "
+						"directory, or NONE");
+					errors++;
+					continue;
+				}
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(stricmp(q, "none") == 0) {
+					config->security_log[0] = '\0';
+					continue;
+				}
+				n = strlen(q);
+				if(q[n-1] == '\\' || q[n-1] == '/') q[--n] = '\0';
+				if(n == 0 || n >= CCHMAXPATH - 1 ||
+				   DosQueryPathInfo(q, FIL_STANDARD, &fs,
+						sizeof(fs)) != 0 ||
+				   (fs.attrFile & FILE_DIRECTORY) == 0) {
+					config_error(
+						line,
+						"cannot access security log "
+						"directory '%s'",
+						q);
+					errors++;
+					continue;
+				}
+				strcpy(config->security_log, q);
+				strcat(config->security_log, "\\");
+				continue;
+				break;
+
+			case CMD_SPOOL_SHARDS:
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"SPOOL_SHARDS needs a number "
+						"of levels");
+					errors++;
+					continue;
+				}
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				n = atoi(q);
+				if(n < 0 || n > MAXSHARDS) {
+					config_error(
+						line,
+						"spool shard levels must be "
+						"between 0 and %d",
+						MAXSHARDS);
+					errors++;
+					continue;
+				}
+				config->spool_shards = n;
+				continue;
+				break;
+
+			case CMD_SPOOL_INDEX:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "on") == 0) {
+					config->spool_index = TRUE;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "off") == 0) {
+					config->spool_index = FALSE;
+					continue;
+				}
+				config_error(
+					line,
+					"SPOOL_INDEX must be ON or OFF");
+				errors++;
+				continue;
+				break;
+
+			case CMD_SPOOL_SEGMENTS:
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"SPOOL_SEGMENTS needs a size");
+					errors++;
+					continue;
+				}
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				n = atoi(q);
+				if(n != 0 && (n < SEG_MINSIZE || n > SEG_MAXSIZE)) {
+					config_error(
+						line,
+						"segment size must be 0, or "
+						"between %d and %d (KB)",
+						SEG_MINSIZE, SEG_MAXSIZE);
+					errors++;
+					continue;
+				}
+				config->spool_segments = n;
+				continue;
+				break;
+
+			case CMD_SYSLOG_FORMAT:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "bsd") == 0) {
+					config->syslog_format = LOGFMT_BSD;
+					continue;
+				}
+				if(q != (PUCHAR) NULL &&
+				   stricmp(q, "rfc5424") == 0) {
+					config->syslog_format = LOGFMT_RFC5424;
+					continue;
+				}
+				config_error(
+					line,
+					"SYSLOG_FORMAT must be BSD or RFC5424");
+				errors++;
+				continue;
+				break;
+
+			case CMD_SYSLOG_SOCKET:
+				if(q == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"SYSLOG_SOCKET needs a socket "
+						"name, or NONE");
+					errors++;
+					continue;
+				}
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(stricmp(q, "none") == 0) {
+					config->syslog_socket[0] = '\0';
+					continue;
+				}
+				if(strlen(q) > CCHMAXPATH) {
+					config_error(
+						line,
+						"syslog socket name too long");
+					errors++;
+					continue;
+				}
+				strcpy(config->syslog_socket, q);
+				continue;
+				break;
+
+			case CMD_EVENT_LOG:
+				if(r != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "on") == 0) {
+					config->event_log = TRUE;
+					continue;
+				}
+				if(q != (PUCHAR) NULL && stricmp(q, "off") == 0) {
+					config->event_log = FALSE;
+					continue;
+				}
+				config_error(
+					line,
+					"EVENT_LOG must be ON or OFF");
+				errors++;
+				continue;
+				break;
+
+			case CMD_LOG_LIMIT:
+				if(q != (PUCHAR) NULL && r == (PUCHAR) NULL &&
+				   stricmp(q, "off") == 0) {
+					config->limit_rate = 0;
+					continue;
+				}
+				if(q == (PUCHAR) NULL || r == (PUCHAR) NULL) {
+					config_error(
+						line,
+						"LOG_LIMIT needs rate and "
+						"burst, or OFF");
+					errors++;
+					continue;
+				}
+				if(strtok(NULL, " \t") != (PUCHAR) NULL) {
+					config_error(
+						line,
+						"syntax error (extra on end)");
+					errors++;
+					continue;
+				}
+				config->limit_rate = atoi(q);
+				config->limit_burst = atoi(r);
+				if(s != (PUCHAR) NULL)
+					config->limit_interval = atoi(s);
+				if(config->limit_rate <= 0 ||
+				   config->limit_rate > LIMIT_MAX ||
+				   config->limit_burst <= 0 ||
+				   config->limit_burst > LIMIT_MAX) {
+					config_error(
+						line,
+						"log limit rate and burst "
+						"must be between 1 and %d",
+						LIMIT_MAX);
+					errors++;
+				}
+				if(config->limit_interval < 0 ||
+				   config->limit_interval > LIMIT_MAXINTERVAL) {
+					config_error(
+						line,
+						"log limit interval must be "
+						"between 0 and %d seconds",
+						LIMIT_MAXINTERVAL);
+					errors++;
+				}
+				continue;
+				break;
+
 			default:
 				config_error(
 					line,
@@ -195,7 +681,7 @@ INT read_config(PUCHAR direnv, PUCHAR configfile, PCONFIG config)
 
 	fclose (fp);
 
-	if(config->nthosts == 0) {
+	if(config->thosts.nentries == 0) {
 		config_error(0, "at least one trusted host must be"
 				" specified");
 		return(++errors);
@@ -225,6 +711,38 @@ static INT getcmd(PUCHAR s)
 }
 
 
+/*
+ * Convert the dotted IPv4 network mask in 's' to a prefix length, in
+ * 'bits'. The mask must be contiguous.
+ *
+ * Returns:
+ *	TRUE		mask OK
+ *	FALSE		malformed or non-contiguous mask
+ *
+ */
+
+static BOOL mask_length(PUCHAR s, PINT bits)
+{	INT i, n;
+	PUCHAR mask;
+	UCHAR key[TRUST_KEYSIZE];
+
+	if(strchr(s, '/') != (PUCHAR) NULL || strchr(s, ':') != (PUCHAR) NULL)
+		return(FALSE);
+	if(trust_parse(s, key, &n) == FALSE) return(FALSE);
+
+	mask = &key[TRUST_V4PREFIX/8];
+	for(n = 0; n < 32 && (mask[n >> 3] & (0x80 >> (n & 7))) != 0; n++)
+		;
+	for(i = n; i < 32; i++) {
+		if((mask[i >> 3] & (0x80 >> (i & 7))) != 0) return(FALSE);
+	}
+
+	*bits = n;
+
+	return(TRUE);
+}
+
+
 /*
  * Output configuration error message to standard error in printf style.
  *
@@ -0,0 +1,283 @@
+/*
+ * File: evdump.c
+ *
+ * Decoder for the SMTPD session event log; writes out each event as a
+ * line of JSON, or (with -c) as a line of CSV, for loading into other
+ * tools. Usage is:
+ *
+ *	evdump [-c] file
+ *
+ * This uses nothing from SMTPD apart from evlog.h.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <os2.h>
+
+#include "evlog.h"
+
+#define	MAXFLAGS	4		/* Most flag values named per event */
+#define	MAXTIME		30		/* Longest rendered time */
+
+/* Type definitions */
+
+typedef	struct	_EVTYPE {		/* How to show one type of event */
+PUCHAR		name;			/* Name of event */
+PUCHAR		flags;			/* Name of flags, or NULL if none */
+PUCHAR		flagname[MAXFLAGS];	/* Names of flag values */
+PUCHAR		value1;			/* Name of value1, or NULL if none */
+PUCHAR		value2;			/* Name of value2, or NULL if none */
+PUCHAR		text;			/* Name of text, or NULL if none */
+} EVTYPE, *PEVTYPE;
+
+/* Forward references */
+
+static	VOID	put_csv(PEVREC, PEVTYPE, PUCHAR);
+static	VOID	put_json(PEVREC, PEVTYPE, PUCHAR);
+static	VOID	put_string(PUCHAR, BOOL);
+static	VOID	show_flags(PUCHAR, PEVREC, PEVTYPE);
+static	VOID	show_time(PUCHAR, PEVREC);
+static	VOID	show_value1(PUCHAR, PEVREC);
+
+/* Local storage */
+
+static	EVTYPE	types[] = {		/* Indexed by event type */
+	{ "",		NULL,	  { NULL },
+	  NULL,		NULL,	NULL },
+	{ "connect",	NULL,	  { NULL },
+	  "client",	"port",	NULL },
+	{ "helo",	"mode",	  { "smtp", "esmtp" },
+	  NULL,		NULL,	"domain" },
+	{ "mail",	NULL,	  { NULL },
+	  "size",	NULL,	"from" },
+	{ "rcpt",	NULL,	  { NULL },
+	  "number",	NULL,	"to" },
+	{ "data",	"mode",	  { "data", "bdat" },
+	  NULL,		NULL,	NULL },
+	{ "data_end",	NULL,	  { NULL },
+	  "octets",	"ms",	NULL },
+	{ "commit",	"result", { "ok", "failed" },
+	  "size",	"ms",	"mail_id" },
+	{ "disconnect",	"reason", { "other", "quit", "timeout", "error" },
+	  "messages",	"ms",	NULL }
+};
+#define	NTYPES	(sizeof(types)/sizeof(EVTYPE))
+
+static	PUCHAR	progname;
+
+
+/*
+ * Parse arguments, and decode the event log.
+ *
+ */
+
+INT main(INT argc, PUCHAR argv[])
+{	BOOL csv = FALSE;
+	INT len;
+	LONG offset;
+	FILE *fp;
+	EVHDR hdr;
+	EVREC rec;
+	UCHAR text[EV_MAXTEXT+1];
+
+	progname = strrchr(argv[0], '\\');
+	if(progname != (PUCHAR) NULL)
+		progname++;
+	else
+		progname = argv[0];
+
+	if(argc == 3 && stricmp(argv[1], "-c") == 0) {
+		csv = TRUE;
+		argc--;
+		argv++;
+	}
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s [-c] file\n", progname);
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(argv[1], "rb");
+	if(fp == (FILE *) NULL) {
+		fprintf(stderr, "%s: cannot open %s\n", progname, argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	if(fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	   hdr.magic != EV_MAGIC ||
+	   hdr.version != EV_VERSION) {
+		fprintf(stderr, "%s: %s is not an event log\n",
+			progname, argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	if(csv == TRUE)
+		printf(
+		"time,process,session,event,flags,value1,value2,text\n");
+
+	for(;;) {
+		offset = ftell(fp);
+		if(fread(&rec, EV_RECSIZE, 1, fp) != 1) break;
+		len = rec.length - EV_RECSIZE;
+		if(len < 0 || len > EV_MAXTEXT ||
+		   (len != 0 && fread(text, len, 1, fp) != 1)) {
+			fprintf(stderr, "%s: bad record at offset %ld\n",
+				progname, offset);
+			exit(EXIT_FAILURE);
+		}
+		text[len] = '\0';
+		if(rec.type >= NTYPES) continue;	/* Unknown; skip */
+
+		if(csv == TRUE)
+			put_csv(&rec, &types[rec.type], text);
+		else
+			put_json(&rec, &types[rec.type], text);
+	}
+
+	(VOID) fclose(fp);
+
+	return(EXIT_SUCCESS);
+}
+
+
+/*
+ * Write out the event record 'rec', of the type described by 'tp' and
+ * with text 'text', as a JSON object on a line of its own.
+ *
+ */
+
+static VOID put_json(PEVREC rec, PEVTYPE tp, PUCHAR text)
+{	UCHAR buf[MAXTIME+1];
+
+	show_time(buf, rec);
+	printf("{\"time\":\"%s\",\"process\":%lu,\"session\":%lu,"
+		"\"event\":\"%s\"",
+		buf, rec->process, rec->session, tp->name);
+	if(tp->flags != (PUCHAR) NULL) {
+		show_flags(buf, rec, tp);
+		printf(",\"%s\":\"%s\"", tp->flags, buf);
+	}
+	if(tp->value1 != (PUCHAR) NULL) {
+		show_value1(buf, rec);
+		if(rec->type == EV_CONNECT)
+			printf(",\"%s\":\"%s\"", tp->value1, buf);
+		else
+			printf(",\"%s\":%s", tp->value1, buf);
+	}
+	if(tp->value2 != (PUCHAR) NULL)
+		printf(",\"%s\":%lu", tp->value2, rec->value2);
+	if(tp->text != (PUCHAR) NULL) {
+		printf(",\"%s\":", tp->text);
+		put_string(text, FALSE);
+	}
+	printf("}\n");
+}
+
+
+/*
+ * Write out the event record 'rec', of the type described by 'tp' and
+ * with text 'text', as a line of CSV. Fields that do not apply to this
+ * type of event are left empty.
+ *
+ */
+
+static VOID put_csv(PEVREC rec, PEVTYPE tp, PUCHAR text)
+{	UCHAR buf[MAXTIME+1];
+
+	show_time(buf, rec);
+	printf("%s,%lu,%lu,%s,", buf, rec->process, rec->session, tp->name);
+	if(tp->flags != (PUCHAR) NULL) {
+		show_flags(buf, rec, tp);
+		printf("%s", buf);
+	}
+	putchar(',');
+	if(tp->value1 != (PUCHAR) NULL) {
+		show_value1(buf, rec);
+		printf("%s", buf);
+	}
+	putchar(',');
+	if(tp->value2 != (PUCHAR) NULL) printf("%lu", rec->value2);
+	putchar(',');
+	if(tp->text != (PUCHAR) NULL) put_string(text, TRUE);
+	putchar('\n');
+}
+
+
+/*
+ * Write out the string 's' in quotes, quoted for CSV if 'csv' is TRUE,
+ * and for JSON otherwise.
+ *
+ */
+
+static VOID put_string(PUCHAR s, BOOL csv)
+{	putchar('"');
+	for(; *s != '\0'; s++) {
+		if(csv == TRUE) {
+			if(*s == '"') putchar('"');
+			putchar(*s);
+		} else if(*s == '"' || *s == '\\') {
+			putchar('\\');
+			putchar(*s);
+		} else if(*s < ' ') {
+			printf("\\u%04x", *s);
+		} else {
+			putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+
+/*
+ * Render the time of the event record 'rec' into 'buf', in ISO 8601
+ * form (UTC).
+ *
+ */
+
+static VOID show_time(PUCHAR buf, PEVREC rec)
+{	time_t tod = (time_t) rec->time;
+
+	(VOID) strftime(buf, MAXTIME, "%Y-%m-%dT%H:%M:%SZ", gmtime(&tod));
+}
+
+
+/*
+ * Render the flags of the event record 'rec', of the type described by
+ * 'tp', into 'buf'; by name if there is one, otherwise as a number.
+ *
+ */
+
+static VOID show_flags(PUCHAR buf, PEVREC rec, PEVTYPE tp)
+{	if(rec->flags < MAXFLAGS && tp->flagname[rec->flags] != (PUCHAR) NULL)
+		strcpy(buf, tp->flagname[rec->flags]);
+	else
+		sprintf(buf, "%u", rec->flags);
+}
+
+
+/*
+ * Render the first value of the event record 'rec' into 'buf'; as a
+ * dotted address for EV_CONNECT, otherwise as a number.
+ *
+ */
+
+static VOID show_value1(PUCHAR buf, PEVREC rec)
+{	PUCHAR a = (PUCHAR) &rec->value1;	/* Network order */
+
+	if(rec->type == EV_CONNECT)
+		sprintf(buf, "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+	else
+		sprintf(buf, "%lu", rec->value1);
+}
+
+/*
+ * End of file: evdump.c
+ *
+ */
+
\ No newline at end of file
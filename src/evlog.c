@@ -0,0 +1,281 @@
+/*
+ * File: evlog.c
+ *
+ * Session event log; records each step of every SMTP session (connect,
+ * HELO, MAIL, each RCPT, start and end of message text, commit and
+ * disconnect) in a compact binary form, for analysis offline using the
+ * decoder (evdump.c).
+ *
+ * The log starts with a header, followed by length-prefixed records;
+ * each carries the process ID and session number, so that the events
+ * of any one session can be picked out, whichever process or reactor
+ * handled it. Events are buffered in the session, and written when the
+ * buffer fills and when the session closes, with one write each time;
+ * a named semaphore serialises these writes, which may come from more
+ * than one process when run by INETD. So a session's events appear in
+ * the log together, when the session has finished. A write that fails
+ * part way (e.g. because the disk is full) is cut back, so that the
+ * log never holds a partial record; the events are counted as lost,
+ * and reported when writing succeeds again.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, ev_init)
+
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys\stat.h>
+
+#define	INCL_DOSSEMAPHORES
+#define	INCL_DOSERRORS
+#include <os2.h>
+
+#include "clock.h"
+#include "evlog.h"
+#include "log.h"
+
+/* Forward references */
+
+static	VOID	flush(PEVLOG);
+static	VOID	put(PEVLOG, INT, INT, ULONG, ULONG, PUCHAR);
+
+/* Local storage */
+
+static	INT	evfd = -1;		/* Event log handle, or -1 if none */
+static	HMTX	evsem;			/* Serialises writes to event log */
+static	ULONG	lost;			/* Events lost since last reported */
+static	ULONG	pid;			/* Process ID, for every record */
+
+
+/*
+ * Open the event log, in the directory specified by the environment
+ * variable given by 'direnv'; its name is given by 'file'. The log is
+ * created, with its header, if it does not exist. Events are recorded
+ * only if this succeeds.
+ *
+ * Returns:
+ *	TRUE		event log open
+ *	FALSE		event log could not be opened
+ *
+ */
+
+BOOL ev_init(PUCHAR direnv, PUCHAR file)
+{	PUCHAR etc = getenv(direnv);
+	APIRET rc;
+	INT fd, i;
+	BOOL ok = TRUE;
+	EVHDR hdr;
+	UCHAR path[CCHMAXPATH+1];
+
+	if(etc == (PUCHAR) NULL) return(FALSE);
+
+	for(i = 0; i < 2; i++) {	/* Once more if creation raced */
+		rc = DosCreateMutexSem(EV_SEM, &evsem, 0, FALSE);
+		if(rc == ERROR_DUPLICATE_NAME)
+			rc = DosOpenMutexSem(EV_SEM, &evsem);
+		if(rc == 0) break;
+	}
+	if(rc != 0) return(FALSE);
+
+	sprintf(path, "%s\\%s", etc, file);
+	fd = open(path, O_CREAT | O_WRONLY | O_BINARY, S_IREAD | S_IWRITE);
+	if(fd == -1) return(FALSE);
+
+	/* Another process may be creating the log at the same time */
+
+	(VOID) DosRequestMutexSem(evsem, SEM_INDEFINITE_WAIT);
+	if(lseek(fd, 0L, SEEK_END) == 0L) {
+		hdr.magic = EV_MAGIC;
+		hdr.version = EV_VERSION;
+		if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ok = FALSE;
+	}
+	(VOID) DosReleaseMutexSem(evsem);
+	if(ok == FALSE) {
+		(VOID) close(fd);
+		return(FALSE);
+	}
+
+	pid = (ULONG) getpid();
+	evfd = fd;
+
+	return(TRUE);
+}
+
+
+/*
+ * Start recording the events of a new session, using the event state
+ * pointed to by 'ep'. The session has number 'session', and its client
+ * has address 'addr' (in network order); it arrived on local port
+ * 'port'. The EV_CONNECT event is recorded.
+ *
+ */
+
+VOID ev_start(PEVLOG ep, ULONG session, ULONG addr, USHORT port)
+{	if(evfd == -1) return;
+
+	ep->buf = (PUCHAR) NULL;	/* Allocated with first event */
+	ep->used = 0;
+	ep->events = 0;
+	ep->session = session;
+	ep->start = clock_msecs();
+	ep->mark = ep->start;
+	ep->messages = 0;
+	ep->reason = EVR_OTHER;
+
+	put(ep, EV_CONNECT, 0, addr, (ULONG) port, (PUCHAR) NULL);
+}
+
+
+/*
+ * Record an event of type 'type' for the session whose event state is
+ * pointed to by 'ep', with flags 'flags', first value 'value', and text
+ * 'text' (NULL if none), which ends at a newline or at its terminator.
+ * The second value, where there is one, is a time measured here (see
+ * evlog.h).
+ *
+ */
+
+VOID ev_put(PEVLOG ep, INT type, INT flags, ULONG value, PUCHAR text)
+{	ULONG now, value2 = 0;
+
+	if(evfd == -1) return;
+
+	switch(type) {
+		case EV_DATA:
+			ep->mark = clock_msecs();
+			break;
+
+		case EV_DATAEND:
+			now = clock_msecs();
+			value2 = now - ep->mark;
+			ep->mark = now;
+			break;
+
+		case EV_COMMIT:
+			value2 = clock_msecs() - ep->mark;
+			if((flags & EVF_FAILED) == 0) ep->messages++;
+			break;
+	}
+
+	put(ep, type, flags, value, value2, text);
+}
+
+
+/*
+ * Finish recording the events of the session whose event state is
+ * pointed to by 'ep'; the EV_DISCONNECT event is recorded, and all of
+ * the session's events are written to the log.
+ *
+ */
+
+VOID ev_close(PEVLOG ep)
+{	if(evfd == -1) return;
+
+	put(ep, EV_DISCONNECT, ep->reason, ep->messages,
+		clock_msecs() - ep->start, (PUCHAR) NULL);
+	flush(ep);
+
+	if(ep->buf != (PUCHAR) NULL) free(ep->buf);
+	ep->buf = (PUCHAR) NULL;
+}
+
+
+/*
+ * Add a record to the event buffer of the session whose event state
+ * is pointed to by 'ep', writing out the buffer first if there is no
+ * room. The record has type 'type', flags 'flags', values 'value1' and
+ * 'value2', and text 'text' (NULL if none). If no buffer can be had,
+ * the event is lost.
+ *
+ */
+
+static VOID put(PEVLOG ep, INT type, INT flags, ULONG value1, ULONG value2,
+		PUCHAR text)
+{	INT len = 0;
+	time_t tod;
+	EVREC rec;
+
+	if(ep->buf == (PUCHAR) NULL) {
+		ep->buf = (PUCHAR) malloc(EV_BUFSIZE);
+		if(ep->buf == (PUCHAR) NULL) return;
+		ep->used = 0;
+		ep->events = 0;
+	}
+
+	if(text != (PUCHAR) NULL) {
+		len = strcspn(text, "\n");
+		if(len > EV_MAXTEXT) len = EV_MAXTEXT;
+	}
+	if(ep->used + EV_RECSIZE + len > EV_BUFSIZE) flush(ep);
+
+	(VOID) time(&tod);
+	rec.length = (USHORT) (EV_RECSIZE + len);
+	rec.type = (UCHAR) type;
+	rec.flags = (UCHAR) flags;
+	rec.process = pid;
+	rec.session = ep->session;
+	rec.time = (ULONG) tod;
+	rec.value1 = value1;
+	rec.value2 = value2;
+
+	memcpy(&ep->buf[ep->used], &rec, EV_RECSIZE);
+	if(len != 0) memcpy(&ep->buf[ep->used + EV_RECSIZE], text, len);
+	ep->used += rec.length;
+	ep->events++;
+}
+
+
+/*
+ * Write out the event buffer of the session whose event state is
+ * pointed to by 'ep', appending it to the log. If the write fails, any
+ * part written is removed again, so that later records are not
+ * misframed, and the events are counted as lost. The first failure is
+ * logged, as is the number lost once writing works again.
+ *
+ */
+
+static VOID flush(PEVLOG ep)
+{	LONG end;
+	BOOL ok = FALSE;
+	UCHAR mes[MAXLOG+1];
+
+	if(ep->used == 0) return;
+
+	(VOID) DosRequestMutexSem(evsem, SEM_INDEFINITE_WAIT);
+	end = lseek(evfd, 0L, SEEK_END);
+	if(end != -1L) {
+		if(write(evfd, ep->buf, ep->used) == ep->used)
+			ok = TRUE;
+		else
+			(VOID) chsize(evfd, end);
+	}
+	if(ok == FALSE) {
+		if(lost == 0)
+			dolog(LOG_ERR, "event log: write failed, events lost");
+		lost += ep->events;
+	} else if(lost != 0) {
+		sprintf(mes, "event log: %lu event%s lost", lost,
+			lost == 1 ? "" : "s");
+		dolog(LOG_WARNING, mes);
+		lost = 0;
+	}
+	(VOID) DosReleaseMutexSem(evsem);
+
+	ep->used = 0;
+	ep->events = 0;
+}
+
+/*
+ * End of file: evlog.c
+ *
+ */
+
\ No newline at end of file
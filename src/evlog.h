@@ -0,0 +1,105 @@
+/*
+ * File: evlog.h
+ *
+ * Session event log, recording each step of every SMTP session in a
+ * compact binary form; header file. This is shared with the decoder
+ * (evdump.c), which turns the event log into JSON or CSV.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	EV_BUFSIZE		4096	/* Events buffered by each session */
+
+/* Miscellaneous constants */
+
+#define	EV_FILE			"SMTPD.Evt"
+					/* Event log, in ETC directory */
+#define	EV_SEM			"\\SEM32\\SMTPD\\EVENTS"
+					/* Serialises writes to event log */
+#define	EV_MAGIC		0x54564553L
+					/* Event log identifier ("SEVT") */
+#define	EV_VERSION		1	/* Event log format version */
+#define	EV_RECSIZE		sizeof(EVREC)
+					/* Size of record, without text */
+#define	EV_MAXTEXT		256	/* Longest text of a record */
+
+#define	FALSE			0
+#define	TRUE			1
+
+/* Event types, and the meaning of the record fields for each */
+
+#define	EV_CONNECT		1	/* value1: client address (network
+					   order), value2: local port */
+#define	EV_HELO			2	/* flags: EVF_ESMTP, text: domain */
+#define	EV_MAIL			3	/* value1: SIZE parameter, or 0,
+					   text: reverse path */
+#define	EV_RCPT			4	/* value1: recipient number,
+					   text: forward path */
+#define	EV_DATA			5	/* flags: EVF_BDAT */
+#define	EV_DATAEND		6	/* value1: octets, value2: time since
+					   EV_DATA (ms) */
+#define	EV_COMMIT		7	/* flags: EVF_FAILED, value1: size of
+					   mail file, value2: time since
+					   EV_DATAEND (ms), text: mail ID */
+#define	EV_DISCONNECT		8	/* flags: reason (EVR_xxx), value1:
+					   messages committed, value2:
+					   length of session (ms) */
+
+/* Flags */
+
+#define	EVF_ESMTP		0x01	/* EHLO, rather than HELO */
+#define	EVF_BDAT		0x01	/* Message sent by BDAT */
+#define	EVF_FAILED		0x01	/* Message not committed */
+
+/* Reasons for disconnection */
+
+#define	EVR_OTHER		0	/* Session ended by server */
+#define	EVR_QUIT		1	/* QUIT command */
+#define	EVR_TIMEOUT		2	/* Client timed out */
+#define	EVR_ERROR		3	/* Network error, or client closed */
+
+/* Structure definitions */
+
+typedef	struct	_EVHDR {		/* Event log header */
+ULONG		magic;			/* EV_MAGIC */
+ULONG		version;		/* EV_VERSION */
+} EVHDR, *PEVHDR;
+
+typedef	struct	_EVREC {		/* One event, followed by its text */
+USHORT		length;			/* Length, including text */
+UCHAR		type;			/* Event type (EV_xxx) */
+UCHAR		flags;			/* Flags, depending on type */
+ULONG		process;		/* Process ID */
+ULONG		session;		/* Session number, within process */
+ULONG		time;			/* Time of event (time_t) */
+ULONG		value1;			/* Values, depending on type */
+ULONG		value2;
+} EVREC, *PEVREC;			/* 24 bytes */
+
+typedef	struct	_EVLOG {		/* Event state of one session */
+PUCHAR		buf;			/* Buffered events, or NULL */
+INT		used;			/* Bytes used in buffer */
+INT		events;			/* Events in buffer */
+ULONG		session;		/* Session number */
+ULONG		start;			/* Time session started (ms) */
+ULONG		mark;			/* Time of last EV_DATA, EV_DATAEND */
+ULONG		messages;		/* Messages committed */
+INT		reason;			/* Reason for disconnection */
+} EVLOG, *PEVLOG;
+
+/* External references */
+
+extern	VOID	ev_close(PEVLOG);
+extern	BOOL	ev_init(PUCHAR, PUCHAR);
+extern	VOID	ev_put(PEVLOG, INT, INT, ULONG, PUCHAR);
+extern	VOID	ev_start(PEVLOG, ULONG, ULONG, USHORT);
+
+/*
+ * End of file: evlog.h
+ *
+ */
+
+
\ No newline at end of file
@@ -0,0 +1,289 @@
+/*
+ * File: jnlread.c
+ *
+ * Spool index journal; routines for reading it, and those shared with
+ * the code that writes it (in mailstor.c).
+ *
+ * This file uses nothing else from SMTPD, so that the mail sending
+ * software can be linked with it, and can find newly committed mail
+ * files by following the journal, instead of searching the spool
+ * directory. Typical use is:
+ *
+ *	if(jnl_open(&jr, spooldir) == JNL_OK) {
+ *		for(;;) {
+ *			rc = jnl_next(&jr, &rec);
+ *			if(rc == JNL_OK) ...send spooldir\rec.name...
+ *			else if(rc == JNL_END) rc = jnl_wait(&jr, 60000L);
+ *			if(rc == JNL_ERROR) break;
+ *		}
+ *		jnl_close(&jr);
+ *	}
+ *
+ * A file may be listed more than once (for example, after the journal
+ * has been compacted, when reading starts again from the beginning),
+ * and files that have already been sent will no longer exist; any
+ * record whose file cannot be found should simply be ignored.
+ *
+ * jnl_wait() returns as soon as SMTPD adds a record, so there is no need
+ * to poll. Its timeout only matters if more than one program follows
+ * journals on the same machine; a wakeup can then occasionally be taken
+ * by another program, leaving the record to be found when the wait
+ * times out.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+
+#define	INCL_DOSSEMAPHORES
+#define	INCL_DOSERRORS
+#include <os2.h>
+
+#include "journal.h"
+
+
+/*
+ * Start reading the journal in the spool directory 'maildir' (given
+ * without a trailing '\'), from its first record, using the reader
+ * state pointed to by 'rp'.
+ *
+ * Returns:
+ *	JNL_OK		journal open
+ *	JNL_NOFILE	spool directory has no journal
+ *	JNL_ERROR	journal cannot be read
+ *
+ */
+
+INT jnl_open(PJNLREADER rp, PUCHAR maildir)
+{	BOOL ok;
+	JNLHDR hdr;
+	UCHAR path[CCHMAXPATH+1];
+
+	sprintf(path, "%s\\%s", maildir, JNL_FILE);
+	rp->fd = open(path, O_RDONLY | O_BINARY);
+	if(rp->fd == -1) return(errno == ENOENT ? JNL_NOFILE : JNL_ERROR);
+
+	if(jnl_sem(&rp->sem) == FALSE) {
+		(VOID) close(rp->fd);
+		return(JNL_ERROR);
+	}
+	if(jnl_event(&rp->event) == FALSE) {
+		(VOID) close(rp->fd);
+		(VOID) DosCloseMutexSem(rp->sem);
+		return(JNL_ERROR);
+	}
+
+	(VOID) DosRequestMutexSem(rp->sem, SEM_INDEFINITE_WAIT);
+	ok = jnl_header(rp->fd, &hdr);
+	(VOID) DosReleaseMutexSem(rp->sem);
+	if(ok == FALSE) {
+		jnl_close(rp);
+		return(JNL_ERROR);
+	}
+
+	rp->generation = hdr.generation;
+	rp->next = 0;
+
+	return(JNL_OK);
+}
+
+
+/*
+ * Read the next record from the journal being read with the reader
+ * state pointed to by 'rp', into the record pointed to by 'rec'. If
+ * the journal has been compacted since the last call, no record is
+ * returned, and the next call starts again from the beginning.
+ *
+ * Returns:
+ *	JNL_OK		record returned
+ *	JNL_END		no more records at present
+ *	JNL_RESTART	journal compacted; reading starts again
+ *	JNL_ERROR	journal cannot be read
+ *
+ */
+
+INT jnl_next(PJNLREADER rp, PJNLREC rec)
+{	INT rc;
+	JNLHDR hdr;
+
+	(VOID) DosRequestMutexSem(rp->sem, SEM_INDEFINITE_WAIT);
+	if(jnl_header(rp->fd, &hdr) == FALSE) {
+		rc = JNL_ERROR;
+	} else if(hdr.generation != rp->generation) {
+		rp->generation = hdr.generation;
+		rp->next = 0;
+		rc = JNL_RESTART;
+	} else if(lseek(rp->fd, (rp->next+1)*JNL_RECSIZE, SEEK_SET) == -1 ||
+		  read(rp->fd, rec, JNL_RECSIZE) != JNL_RECSIZE ||
+		  jnl_check(rec) != rec->check) {
+		rc = JNL_END;		/* Incomplete records are not there */
+	} else {
+		rp->next++;
+		rc = JNL_OK;
+	}
+	(VOID) DosReleaseMutexSem(rp->sem);
+
+	return(rc);
+}
+
+
+/*
+ * Finish reading the journal being read with the reader state pointed
+ * to by 'rp'.
+ *
+ */
+
+VOID jnl_close(PJNLREADER rp)
+{	(VOID) close(rp->fd);
+	(VOID) DosCloseMutexSem(rp->sem);
+	(VOID) DosCloseEventSem(rp->event);
+}
+
+
+/*
+ * Wait for up to 'ms' milliseconds (or SEM_INDEFINITE_WAIT) for SMTPD
+ * to add a record to the journal being read with the reader state
+ * pointed to by 'rp'; used when jnl_next() has returned JNL_END.
+ *
+ * Returns:
+ *	JNL_OK		records may have been added; call jnl_next()
+ *	JNL_END		nothing added before the timeout
+ *	JNL_ERROR	journal cannot be read
+ *
+ */
+
+INT jnl_wait(PJNLREADER rp, ULONG ms)
+{	APIRET rc;
+	BOOL ok;
+	LONG end;
+	ULONG posts;
+	JNLHDR hdr;
+
+	(VOID) DosResetEventSem(rp->event, &posts);
+
+	/* A record added before the reset has lost its notification,
+	   so look for one now. */
+
+	(VOID) DosRequestMutexSem(rp->sem, SEM_INDEFINITE_WAIT);
+	ok = jnl_header(rp->fd, &hdr);
+	end = lseek(rp->fd, 0L, SEEK_END);
+	(VOID) DosReleaseMutexSem(rp->sem);
+	if(ok == FALSE || end == -1) return(JNL_ERROR);
+	if(hdr.generation != rp->generation ||
+	   end >= (rp->next+2)*JNL_RECSIZE)
+		return(JNL_OK);
+
+	rc = DosWaitEventSem(rp->event, ms);
+	if(rc == 0) return(JNL_OK);
+
+	return(rc == ERROR_TIMEOUT ? JNL_END : JNL_ERROR);
+}
+
+
+/*
+ * Create or open the named event semaphore that SMTPD posts whenever it
+ * adds records to a journal, setting '*semp' to its handle. It is
+ * shared by all spool directories.
+ *
+ * Returns:
+ *	TRUE		semaphore open
+ *	FALSE		semaphore could not be opened
+ *
+ */
+
+BOOL jnl_event(PHEV semp)
+{	APIRET rc;
+	INT i;
+
+	for(i = 0; i < 2; i++) {	/* Once more if creation raced */
+		rc = DosCreateEventSem(JNL_EVENT, semp, 0, FALSE);
+		if(rc == ERROR_DUPLICATE_NAME)
+			rc = DosOpenEventSem(JNL_EVENT, semp);
+		if(rc == 0) break;
+	}
+
+	return(rc == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Compute the checksum of the journal record pointed to by 'rec',
+ * covering everything except the checksum itself. A record written
+ * only in part (because the system failed while writing it) has the
+ * wrong checksum.
+ *
+ * Returns:
+ *	checksum
+ *
+ */
+
+ULONG jnl_check(PJNLREC rec)
+{	INT i;
+	ULONG sum = JNL_MAGIC;
+	PUCHAR p = (PUCHAR) rec + sizeof(rec->check);
+
+	for(i = sizeof(rec->check); i < JNL_RECSIZE; i++)
+		sum = ((sum << 1) | (sum >> 31)) + *p++;
+
+	return(sum);
+}
+
+
+/*
+ * Read the header of the journal open on handle 'fd', into the
+ * structure pointed to by 'hp', and check that it is valid. The
+ * journal semaphore must be held.
+ *
+ * Returns:
+ *	TRUE		header read OK
+ *	FALSE		header unreadable, or not a journal
+ *
+ */
+
+BOOL jnl_header(INT fd, PJNLHDR hp)
+{	if(lseek(fd, 0L, SEEK_SET) != 0 ||
+	   read(fd, hp, JNL_RECSIZE) != JNL_RECSIZE)
+		return(FALSE);
+
+	return(hp->magic == JNL_MAGIC && hp->version == JNL_VERSION ?
+		TRUE : FALSE);
+}
+
+
+/*
+ * Create or open the named semaphore that serialises access to the
+ * journals of all spool directories, by SMTPD and by readers, setting
+ * '*semp' to its handle.
+ *
+ * Returns:
+ *	TRUE		semaphore open
+ *	FALSE		semaphore could not be opened
+ *
+ */
+
+BOOL jnl_sem(PHMTX semp)
+{	APIRET rc;
+	INT i;
+
+	for(i = 0; i < 2; i++) {	/* Once more if creation raced */
+		rc = DosCreateMutexSem(JNL_SEM, semp, 0, FALSE);
+		if(rc == ERROR_DUPLICATE_NAME)
+			rc = DosOpenMutexSem(JNL_SEM, semp);
+		if(rc == 0) break;
+	}
+
+	return(rc == 0 ? TRUE : FALSE);
+}
+
+/*
+ * End of file: jnlread.c
+ *
+ */
+
\ No newline at end of file
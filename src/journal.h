@@ -0,0 +1,90 @@
+/*
+ * File: journal.h
+ *
+ * Spool index journal, listing committed mail files in the order in
+ * which they were committed; header file. This is shared with the mail
+ * sending software, which reads the journal using the routines in
+ * jnlread.c.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	JNL_COMPACTMIN		4096	/* Records before compaction tried */
+
+/* Miscellaneous constants */
+
+#define	JNL_FILE		"SPOOL.JNL"
+					/* Journal, in spool directory */
+#define	JNL_SEM			"\\SEM32\\SMTPD\\JOURNAL"
+					/* Serialises access to journals */
+#define	JNL_EVENT		"\\SEM32\\SMTPD\\COMMIT"
+					/* Posted when records are added */
+#define	JNL_MAGIC		0x4C4E4A53L
+					/* Journal file identifier ("SJNL") */
+#define	JNL_VERSION		1	/* Journal file format version */
+#define	JNL_RECSIZE		sizeof(JNLREC)
+					/* Size of header and of records */
+#define	JNL_IDLEN		12	/* Space for mail ID */
+#define	JNL_NAMELEN		36	/* Space for mail file name */
+#define	JNL_SENDERLEN		64	/* Space for sender (truncated) */
+
+#define	FALSE			0
+#define	TRUE			1
+
+/* Results from jnl_open(), jnl_next() and jnl_wait() */
+
+#define	JNL_OK			0	/* Success; record returned */
+#define	JNL_END			1	/* No more records at present */
+#define	JNL_RESTART		2	/* Journal compacted; start again */
+#define	JNL_NOFILE		3	/* No journal in spool directory */
+#define	JNL_ERROR		4	/* Journal unreadable */
+
+/* Structure definitions */
+
+typedef	struct	_JNLREC {		/* One committed mail file */
+ULONG		check;			/* Checksum of rest of record */
+ULONG		time;			/* Time committed (time_t) */
+ULONG		size;			/* Size of mail file (bytes) */
+USHORT		rcpts;			/* Number of recipients */
+USHORT		reserved;		/* Zero */
+UCHAR		mail_id[JNL_IDLEN];	/* Mail ID */
+UCHAR		name[JNL_NAMELEN];	/* Mail file, within spool directory */
+UCHAR		sender[JNL_SENDERLEN];	/* Reverse path, e.g. "<a@b.c>" */
+} JNLREC, *PJNLREC;			/* 128 bytes */
+
+typedef	struct	_JNLHDR {		/* Journal header (first record) */
+ULONG		magic;			/* JNL_MAGIC */
+ULONG		version;		/* JNL_VERSION */
+ULONG		generation;		/* Changed whenever compacted */
+ULONG		live;			/* Records kept by last compaction */
+UCHAR		reserved[JNL_RECSIZE-4*sizeof(ULONG)];
+} JNLHDR, *PJNLHDR;
+
+typedef	struct	_JNLREADER {		/* State of one journal reader */
+INT		fd;			/* Journal file handle */
+HMTX		sem;			/* Journal semaphore */
+HEV		event;			/* Commit event semaphore */
+ULONG		generation;		/* Generation being read */
+ULONG		next;			/* Number of next record to read */
+} JNLREADER, *PJNLREADER;
+
+/* External references */
+
+extern	ULONG	jnl_check(PJNLREC);
+extern	VOID	jnl_close(PJNLREADER);
+extern	BOOL	jnl_event(PHEV);
+extern	BOOL	jnl_header(INT, PJNLHDR);
+extern	INT	jnl_next(PJNLREADER, PJNLREC);
+extern	INT	jnl_open(PJNLREADER, PUCHAR);
+extern	BOOL	jnl_sem(PHMTX);
+extern	INT	jnl_wait(PJNLREADER, ULONG);
+
+/*
+ * End of file: journal.h
+ *
+ */
+
+
\ No newline at end of file
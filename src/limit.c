@@ -0,0 +1,284 @@
+/*
+ * File: limit.c
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Limiting the rate at which repetitive log records are written. A
+ * scanner calling from an untrusted host many times a second would
+ * otherwise produce a log record for every call, filling the log ring
+ * and holding up the records of genuine sessions.
+ *
+ * Each class of record has a token bucket, allowing a steady rate of
+ * records with short bursts; and each source (client address) may log
+ * a record of a class no more than once in a given interval. Records
+ * that are not allowed are counted against their source, and a
+ * summary ("suppressed N similar messages") is logged when the source
+ * next logs a record, or at the end of the interval if the source has
+ * gone quiet. Summaries of quiet sources take tokens from the bucket
+ * like any other record; when there are none, or when a source is
+ * pushed out of the small table that tracks them, its count is added
+ * to that of its class, which is summarised once an interval. So a
+ * flood from many sources still yields only a few records.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, limit_init)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smtpd.h"
+#include "clock.h"
+#include "limit.h"
+
+#define	UNIT		1000		/* Tokens for one record */
+
+/* Type definitions */
+
+typedef	struct	_SOURCE {		/* One source being tracked */
+BOOL		used;			/* Entry in use */
+INT		class;			/* Class of records */
+ULONG		addr;			/* Client address (network order) */
+ULONG		last;			/* Time last logged (ms) */
+ULONG		suppressed;		/* Records suppressed since then */
+} SOURCE, *PSOURCE;
+
+typedef	struct	_BUCKET {		/* Token bucket for one class */
+ULONG		tokens;			/* Tokens (UNIT per record) */
+ULONG		filled;			/* Time last filled (ms) */
+ULONG		lost;			/* Suppressed, not summarised */
+} BUCKET, *PBUCKET;
+
+/* Forward references */
+
+static	VOID	fill(PBUCKET, ULONG);
+static	VOID	summary(INT, PUCHAR, ULONG);
+
+/* Local storage */
+
+static	PUCHAR	classtext[LIMIT_CLASSES] = {
+	"attempted connection from non-trusted host"
+};
+
+static	BUCKET	buckets[LIMIT_CLASSES];
+static	INT	burst;			/* Largest burst of records */
+static	ULONG	interval;		/* Interval per source (ms) */
+static	HMTX	lock;			/* Serialises access to all of these */
+static	ULONG	next_report;		/* Time of next periodic report (ms) */
+static	INT	rate = 0;		/* Records per second, or 0 if none */
+static	SOURCE	sources[LIMIT_SOURCES];
+static	LIMITSTATS totals;		/* Statistics since last collected */
+
+
+/*
+ * Initialise limiting; each class of records may be logged at 'r'
+ * records a second, with bursts of up to 'b' records, and no more than
+ * once in 'secs' seconds from any one source. If 'r' is zero, records
+ * are not limited.
+ *
+ * Returns:
+ *	TRUE		ready
+ *	FALSE		initialisation failed; error already reported
+ *
+ */
+
+BOOL limit_init(INT r, INT b, INT secs)
+{	INT i, rc;
+
+	if(r == 0) return(TRUE);
+
+	rc = DosCreateMutexSem((PSZ) NULL, &lock, 0, FALSE);
+	if(rc != 0) {
+		error("cannot create limit semaphore, rc = %d", rc);
+		return(FALSE);
+	}
+
+	burst = b;
+	interval = (ULONG) secs*1000;
+	next_report = clock_msecs() + interval;
+	for(i = 0; i < LIMIT_CLASSES; i++) {
+		buckets[i].tokens = (ULONG) burst*UNIT;
+		buckets[i].filled = clock_msecs();
+		buckets[i].lost = 0;
+	}
+	rate = r;			/* Limiting now in effect */
+
+	return(TRUE);
+}
+
+
+/*
+ * Decide whether a log record of class 'class', about the client with
+ * address 'addr' (network order), should be written. If it should, and
+ * earlier records from the same source were suppressed, a summary of
+ * those is logged first.
+ *
+ * Returns:
+ *	TRUE		write the record
+ *	FALSE		record suppressed
+ *
+ */
+
+BOOL limit_check(INT class, ULONG addr)
+{	INT h;
+	ULONG now;
+	BOOL ok;
+	PBUCKET bp = &buckets[class];
+	PSOURCE sp;
+
+	if(rate == 0) return(TRUE);
+
+	h = (INT) ((addr ^ (addr >> 8) ^ (addr >> 16) ^ (addr >> 24) ^ class) &
+		(LIMIT_SOURCES - 1));
+	sp = &sources[h];
+
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	now = clock_msecs();
+	fill(bp, now);
+
+	if(sp->used == TRUE && (sp->addr != addr || sp->class != class)) {
+		buckets[sp->class].lost += sp->suppressed;
+		sp->used = FALSE;
+	}
+	if(sp->used == FALSE) {		/* New source */
+		sp->used = TRUE;
+		sp->class = class;
+		sp->addr = addr;
+		sp->last = now - interval;
+		sp->suppressed = 0;
+	}
+
+	ok = now - sp->last >= interval && bp->tokens >= UNIT ? TRUE : FALSE;
+	if(ok == TRUE) {
+		bp->tokens -= UNIT;
+		sp->last = now;
+		if(sp->suppressed != 0) {
+			summary(class, (PUCHAR) &sp->addr, sp->suppressed);
+			sp->suppressed = 0;
+		}
+		totals.logged++;
+	} else {
+		sp->suppressed++;
+		totals.suppressed++;
+	}
+	(VOID) DosReleaseMutexSem(lock);
+
+	return(ok);
+}
+
+
+/*
+ * Log summaries of records suppressed from sources that have not
+ * logged anything for a whole interval, as far as the rate allows,
+ * and of the rest together. This should be called from time to time
+ * (at least once a second); it does nothing until a report is due.
+ *
+ */
+
+VOID limit_report(VOID)
+{	INT i;
+	ULONG now = clock_msecs();
+	PSOURCE sp;
+	PBUCKET bp;
+
+	if(rate == 0 || (LONG) (now - next_report) < 0) return;
+
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	next_report = now + interval;
+
+	for(i = 0; i < LIMIT_CLASSES; i++) fill(&buckets[i], now);
+	for(i = 0; i < LIMIT_SOURCES; i++) {
+		sp = &sources[i];
+		if(sp->used == FALSE || sp->suppressed == 0 ||
+		   now - sp->last < interval)
+			continue;
+		bp = &buckets[sp->class];
+		if(bp->tokens >= UNIT) {
+			bp->tokens -= UNIT;
+			summary(sp->class, (PUCHAR) &sp->addr,
+				sp->suppressed);
+			sp->last = now;
+		} else {
+			bp->lost += sp->suppressed;
+		}
+		sp->suppressed = 0;
+	}
+	for(i = 0; i < LIMIT_CLASSES; i++) {
+		if(buckets[i].lost == 0) continue;
+		summary(i, (PUCHAR) NULL, buckets[i].lost);
+		buckets[i].lost = 0;
+	}
+	(VOID) DosReleaseMutexSem(lock);
+}
+
+
+/*
+ * Collect the limiting statistics into the structure pointed to by
+ * 'sp', and reset them.
+ *
+ */
+
+VOID limit_stats(PLIMITSTATS sp)
+{	if(rate == 0) {
+		memset(sp, 0, sizeof(LIMITSTATS));
+		return;
+	}
+
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	*sp = totals;
+	memset(&totals, 0, sizeof(LIMITSTATS));
+	(VOID) DosReleaseMutexSem(lock);
+}
+
+
+/*
+ * Add tokens to the bucket pointed to by 'bp', for the time since it
+ * was last filled, up to the time 'now' (ms). The lock must be held.
+ *
+ */
+
+static VOID fill(PBUCKET bp, ULONG now)
+{	ULONG ms = now - bp->filled;
+	ULONG full = (ULONG) burst*UNIT;
+
+	if(ms > full) ms = full;	/* Enough to fill it anyway */
+	bp->tokens += ms*rate;
+	if(bp->tokens > full) bp->tokens = full;
+	bp->filled = now;
+}
+
+
+/*
+ * Log a summary of 'n' suppressed records of class 'class', from the
+ * client whose address (network order) is at 'a', or from any number
+ * of sources if 'a' is NULL. The lock must be held.
+ *
+ */
+
+static VOID summary(INT class, PUCHAR a, ULONG n)
+{	UCHAR mes[MAXLOG+1];
+
+	if(a != (PUCHAR) NULL)
+		sprintf(mes,
+			"suppressed %lu similar message%s: %s: %u.%u.%u.%u",
+			n, n == 1 ? "" : "s", classtext[class],
+			a[0], a[1], a[2], a[3]);
+	else
+		sprintf(mes,
+			"suppressed %lu similar message%s: %s: other hosts",
+			n, n == 1 ? "" : "s", classtext[class]);
+	dolog(LOG_ERR, mes);
+	totals.summaries++;
+}
+
+/*
+ * End of file: limit.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,46 @@
+/*
+ * File: limit.h
+ *
+ * Limiting the rate at which repetitive log records are written, such
+ * as those caused by a flood of calls from untrusted hosts; header
+ * file.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	LIMIT_RATE		10	/* Default records per second */
+#define	LIMIT_BURST		20	/* Default burst of records */
+#define	LIMIT_INTERVAL		60	/* Default interval, per source (s) */
+#define	LIMIT_SOURCES		256	/* Sources tracked (power of 2) */
+#define	LIMIT_MAX		1000	/* Largest rate or burst */
+#define	LIMIT_MAXINTERVAL	3600	/* Largest interval (s) */
+
+/* Classes of limited log records */
+
+#define	LIMIT_UNTRUSTED		0	/* Call from untrusted host */
+#define	LIMIT_CLASSES		1	/* Number of classes */
+
+/* Structure definitions */
+
+typedef	struct	_LIMITSTATS {		/* Limiting statistics */
+ULONG		logged;			/* Records allowed */
+ULONG		suppressed;		/* Records suppressed */
+ULONG		summaries;		/* Summaries of suppressed records */
+} LIMITSTATS, *PLIMITSTATS;
+
+/* External references */
+
+extern	BOOL	limit_check(INT, ULONG);
+extern	BOOL	limit_init(INT, INT, INT);
+extern	VOID	limit_report(VOID);
+extern	VOID	limit_stats(PLIMITSTATS);
+
+/*
+ * End of file: limit.h
+ *
+ */
+
+
\ No newline at end of file
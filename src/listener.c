@@ -0,0 +1,485 @@
+/*
+ * File: listener.c
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Listener for standalone operation. Binds the service sockets,
+ * accepts calls directly without the help of INETD, and runs the
+ * resulting sessions from one or more reactor threads, each with its
+ * own event loop.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, listener)
+#pragma	alloc_text(a_init_seg, make_listener)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "smtpd.h"
+#include "evlog.h"
+#include "limit.h"
+#include "mailstor.h"
+#include "netio.h"
+#include "sync.h"
+#include "session.h"
+#include <nerrno.h>
+
+#define	MAXLISTEN	2		/* Maximum number of listening sockets */
+#define	BACKLOG		SOMAXCONN	/* Listen queue length */
+#define	TICK		1		/* Interval for timeout checks (secs) */
+#define	PARKTICK	100		/* Interval for parked sessions (ms) */
+#define	SYNCTICK	10		/* Interval for sessions awaiting sync (ms) */
+#define	STATSINTERVAL	3600		/* Interval for statistics (secs) */
+#define	SETCHUNK	64		/* Growth increment for socket set */
+#define	REACTORSTACK	65536		/* Stack size for reactor threads */
+
+/* Type definitions */
+
+typedef	struct	_REACTOR {		/* State of one reactor thread */
+INT		id;			/* Reactor number, from 0 */
+INT		cpu;			/* CPU to run on, or -1 if any */
+INT		nsessions;		/* Number of active sessions */
+PSESSION	sessions;		/* List of active sessions */
+} REACTOR, *PREACTOR;
+
+/* Forward references */
+
+static	VOID	accept_call(PREACTOR, INT);
+static	VOID	log_stats(VOID);
+static	INT	make_listener(USHORT);
+static	BOOL	reactor(PREACTOR);
+static	VOID	_Optlink run_reactor(PVOID);
+
+/* Local storage */
+
+static	INT	lsock[MAXLISTEN];	/* Listening sockets */
+static	INT	nlisten;		/* Number of listening sockets */
+
+
+/*
+ * Run as a standalone daemon. Listening sockets are created for the main
+ * service port, and for the alternate (hold) service port if one is
+ * defined. Incoming calls on either are accepted and set up by
+ * 'connection', which decides which spool directory to use from the
+ * port on which the call arrived.
+ *
+ * The work is shared between a number of reactor threads, as set by the
+ * REACTORS configuration option; by default there is just one. Every
+ * reactor waits on the same listening sockets, and whichever one
+ * accepts a call runs that session until it ends, so that sessions
+ * never move between threads. If AFFINITY is on, each reactor is also
+ * bound to a CPU of its own.
+ *
+ * Returns:
+ *	FALSE		listener failed to start, or failed while running;
+ *			otherwise, does not return
+ *
+ */
+
+BOOL listener(PCONFIG config, USHORT main_port, USHORT alt_port)
+{	INT i, nreactors;
+	ULONG ncpus = 1;
+	PREACTOR reactors;
+	UCHAR mes[MAXLOG+1];
+
+	nlisten = 0;
+	lsock[nlisten] = make_listener(main_port);
+	if(lsock[nlisten] < 0) return(FALSE);
+	nlisten++;
+
+	if(alt_port != (USHORT) -1) {
+		lsock[nlisten] = make_listener(alt_port);
+		if(lsock[nlisten] < 0) {
+			(VOID) soclose(lsock[0]);
+			return(FALSE);
+		}
+		nlisten++;
+	}
+
+	(VOID) DosQuerySysInfo(QSV_NUMPROCESSORS, QSV_NUMPROCESSORS,
+				&ncpus, sizeof(ncpus));
+	if(ncpus == 0) ncpus = 1;
+	nreactors = config->reactors == 0 ? ncpus : config->reactors;
+	if(nreactors > MAXREACTORS) nreactors = MAXREACTORS;
+
+	reactors = (PREACTOR) calloc(nreactors, sizeof(REACTOR));
+	if(reactors == (PREACTOR) NULL) {
+		error("cannot allocate memory for reactors");
+		for(i = 0; i < nlisten; i++) (VOID) soclose(lsock[i]);
+		return(FALSE);
+	}
+
+	for(i = 0; i < nreactors; i++) {
+		reactors[i].id = i;
+		reactors[i].cpu = config->affinity == TRUE ? i % ncpus : -1;
+		reactors[i].nsessions = 0;
+		reactors[i].sessions = (PSESSION) NULL;
+	}
+
+	sprintf(mes, "standalone listener started on %d listening socket%s, "
+		"%d reactor%s, %lu CPU%s",
+		nlisten, nlisten == 1 ? "" : "s",
+		nreactors, nreactors == 1 ? "" : "s",
+		ncpus, ncpus == 1 ? "" : "s");
+	dolog(LOG_INFO, mes);
+
+	/* Reactor 0 runs on this thread; the rest get threads of their
+	   own. */
+
+	for(i = 1; i < nreactors; i++) {
+		if(_beginthread(run_reactor, NULL, REACTORSTACK,
+				&reactors[i]) == -1) {
+			sprintf(mes, "cannot start reactor %d", i);
+			dolog(LOG_ERR, mes);
+		}
+	}
+
+	(VOID) reactor(&reactors[0]);
+
+	for(i = 0; i < nlisten; i++) (VOID) soclose(lsock[i]);
+
+	return(FALSE);
+}
+
+
+/*
+ * Thread entry point for all reactors except the first.
+ *
+ */
+
+static VOID _Optlink run_reactor(PVOID arg)
+{	(VOID) reactor((PREACTOR) arg);
+}
+
+
+/*
+ * Main loop of one reactor. All of the reactor's sessions are run from
+ * a single select() loop; each session is given whatever input has
+ * arrived for it, and is timed out if it sends nothing for too long.
+ * New calls are accepted from the shared listening sockets.
+ *
+ * A parked session (one waiting for its client's host name, or for its
+ * message to be flushed to disk) is not waited on, but is given another
+ * chance on every pass; while there are any, the loop runs more often.
+ * Sessions waiting for a flush are checked most often of all, as the
+ * flush takes only a short time and their clients are kept waiting.
+ * A session that stopped with input still in its buffer, to give the
+ * others a turn, is not waited on either; it is run again straight
+ * away. A session whose client is not reading its replies, so that
+ * output is held back, is waited on until its socket is writable
+ * instead of until input arrives.
+ *
+ * Returns:
+ *	FALSE		reactor failed; otherwise, does not return
+ *
+ */
+
+static BOOL reactor(PREACTOR rp)
+{	INT i, j, k, n, rc, nparked, nready;
+	BOOL ready;
+	LONG parktick;
+	INT setsize = 0;
+	PINT sockset = (PINT) NULL;
+	PSESSION sess, *psess;
+	MPAFFINITY aff;
+	time_t now, next_stats;
+	UCHAR mes[MAXLOG+1];
+
+	if(rp->cpu >= 0) {		/* Bind to our own CPU */
+		aff.mask[0] = rp->cpu < 32 ? 1UL << rp->cpu : 0;
+		aff.mask[1] = rp->cpu < 32 ? 0 : 1UL << (rp->cpu - 32);
+		rc = DosSetThreadAffinity(&aff);
+		if(rc != 0) {
+			sprintf(mes, "reactor %d: cannot set affinity to "
+				"CPU %d, rc = %d", rp->id, rp->cpu, rc);
+			dolog(LOG_WARNING, mes);
+		}
+	}
+
+	(VOID) time(&next_stats);
+	next_stats += STATSINTERVAL;
+
+	for(;;) {
+		/* Build the set of sockets to wait on: the listening
+		   sockets, followed by one for each session (other than
+		   parked ones, and those with input already buffered) in
+		   list order; those with output held back are waited on
+		   for writing, and come last. */
+
+		n = nlisten + rp->nsessions;
+		if(n > setsize) {
+			setsize = n + SETCHUNK;
+			sockset = (PINT) realloc(sockset, setsize*sizeof(INT));
+			if(sockset == (PINT) NULL) {
+				sprintf(mes, "reactor %d: cannot allocate "
+					"socket set", rp->id);
+				dolog(LOG_CRIT, mes);
+				break;
+			}
+		}
+		for(i = 0; i < nlisten; i++) sockset[i] = lsock[i];
+		nparked = 0;
+		nready = 0;
+		parktick = PARKTICK;
+		for(sess = rp->sessions; sess != (PSESSION) NULL;
+		    sess = sess->next) {
+			if(sess->parked == TRUE) {
+				nparked++;
+				if(sess->state == ST_SYNC) parktick = SYNCTICK;
+			} else if(sock_blocked(&sess->net) == FALSE) {
+				if(sock_pending(&sess->net) == TRUE)
+					nready++;
+				else
+					sockset[i++] = sess->sockno;
+			}
+		}
+		n = i;
+		for(sess = rp->sessions; sess != (PSESSION) NULL;
+		    sess = sess->next) {
+			if(sess->parked == FALSE &&
+			   sock_blocked(&sess->net) == TRUE)
+				sockset[i++] = sess->sockno;
+		}
+
+		rc = select(
+			sockset,	/* List of sockets */
+			n,		/* Sockets for read check */
+			i - n,		/* Sockets for write check */
+			0,		/* Sockets for exception check */
+			nready != 0 ? 0L :
+			nparked != 0 ? parktick : TICK*1000L);
+					/* Timeout period */
+
+		if(rc < 0) {
+			if(sock_errno() == SOCEINTR) continue;
+			sprintf(mes, "reactor %d: select failed, errno = %d",
+				rp->id, sock_errno());
+			dolog(LOG_CRIT, mes);
+			break;
+		}
+
+		/* Run each session that has input waiting, or can now
+		   send held-back output, and time out any that have been
+		   idle too long. */
+
+		(VOID) time(&now);
+		psess = &rp->sessions;
+		j = nlisten;
+		k = n;
+		while((sess = *psess) != (PSESSION) NULL) {
+			if(sess->parked == TRUE)
+				ready = TRUE;
+			else if(sock_blocked(&sess->net) == TRUE)
+				ready = sockset[k++] != -1 ? TRUE : FALSE;
+			else if(sock_pending(&sess->net) == TRUE)
+				ready = TRUE;
+			else
+				ready = sockset[j++] != -1 ? TRUE : FALSE;
+
+			rc = SERVER_MORE;
+			if(ready == TRUE) {
+				rc = server_input(sess);
+			} else if(now > sess->deadline) {
+				server_timeout(sess);
+				rc = SERVER_DONE;
+			}
+			if(rc == SERVER_DONE) {
+				*psess = sess->next;
+				connection_close(sess);
+				rp->nsessions--;
+			} else {
+				psess = &sess->next;
+			}
+		}
+
+		/* Accept any new calls */
+
+		for(i = 0; i < nlisten; i++) {
+			if(sockset[i] != -1) accept_call(rp, lsock[i]);
+		}
+
+		/* The first reactor logs statistics from time to time,
+		   and summaries of log records suppressed by limiting. */
+
+		if(rp->id == 0 && now >= next_stats) {
+			log_stats();
+			next_stats = now + STATSINTERVAL;
+		}
+		if(rp->id == 0) limit_report();
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Accept a call on the listening socket 'lsock', and start a new
+ * session for it on reactor 'rp'. The listening sockets are
+ * non-blocking, so if another reactor has already taken the call this
+ * simply returns.
+ *
+ */
+
+static VOID accept_call(PREACTOR rp, INT lsock)
+{	INT namelen, sockno;
+	SOCK client;
+	PSESSION sess;
+
+	namelen = sizeof(client);
+	sockno = accept(lsock, (PSOCKG) &client, &namelen);
+	if(sockno < 0) {
+#ifdef	DEBUG
+		if(sock_errno() != SOCEWOULDBLOCK)
+			trace("accept failed, errno = %d", sock_errno());
+#endif
+		return;
+	}
+
+	sess = connection(sockno);
+	if(sess == (PSESSION) NULL) return;
+
+	if(server_open(sess, TRUE) == FALSE) {
+		connection_close(sess);
+		return;
+	}
+
+	sess->next = rp->sessions;
+	rp->sessions = sess;
+	rp->nsessions++;
+}
+
+
+/*
+ * Log the network input statistics for sessions that have finished
+ * since the last time, if there were any. The number of system calls
+ * per megabyte received shows how well input is being batched.
+ *
+ * Also log the number of messages committed, and how long it took to
+ * get them safely onto disk; the number of messages per flush shows
+ * how well group commit is working, and how many log records were
+ * suppressed by limiting, if any.
+ *
+ * Lastly, log how many log records were written, in how many writes,
+ * and how many had to wait for room in the log ring, or were dropped.
+ *
+ */
+
+static VOID log_stats(VOID)
+{	NETSTATS stats;
+	SYNCSTATS sstats;
+	LOGSTATS lstats;
+	LIMITSTATS limstats;
+	UCHAR mes[MAXLOG+1];
+
+	netio_stats(&stats);
+	if(stats.bytes != 0) {
+		sprintf(mes, "network input: %lu KB, %lu recv, %lu select, "
+			"%.0f system calls per MB",
+			stats.bytes/1024, stats.recvs, stats.polls,
+			(stats.recvs + stats.polls)/(stats.bytes/1048576.0));
+		dolog(LOG_INFO, mes);
+	}
+
+	sync_stats(&sstats);
+	if(sstats.messages != 0) {
+		sprintf(mes, "mail commit: %lu messages (%.2f per sec), "
+			"%lu flush%s, %lu failed, latency %lu ms mean, "
+			"%lu ms max",
+			sstats.messages, sstats.messages/(double) STATSINTERVAL,
+			sstats.flushes, sstats.flushes == 1 ? "" : "es",
+			sstats.failures,
+			sstats.totalms/sstats.messages, sstats.maxms);
+		dolog(LOG_INFO, mes);
+	}
+
+	limit_stats(&limstats);
+	if(limstats.suppressed != 0) {
+		sprintf(mes, "log limiting: %lu records logged, "
+			"%lu suppressed, %lu summaries",
+			limstats.logged, limstats.suppressed,
+			limstats.summaries);
+		dolog(LOG_INFO, mes);
+	}
+
+	logging_stats(&lstats);
+	if(lstats.records == 0) return;
+
+	sprintf(mes, "logging: %lu records, %lu writes, %lu waited for room, "
+		"%lu dropped",
+		lstats.records, lstats.writes, lstats.waits, lstats.dropped);
+	dolog(LOG_INFO, mes);
+}
+
+
+/*
+ * Create a socket listening on all interfaces on the specified port.
+ *
+ * Returns:
+ *	>= 0		the listening socket
+ *	-1		failed; error already reported
+ *
+ */
+
+static INT make_listener(USHORT port)
+{	INT sockno;
+	INT on = 1;
+	SOCK serv;
+
+	sockno = socket(PF_INET, SOCK_STREAM, 0);
+	if(sockno < 0) {
+		error("cannot create listening socket, errno = %d",
+			sock_errno());
+		return(-1);
+	}
+
+	(VOID) setsockopt(sockno, SOL_SOCKET, SO_REUSEADDR,
+			(PUCHAR) &on, sizeof(on));
+
+	memset(&serv, 0, sizeof(serv));
+	serv.sin_family = AF_INET;
+	serv.sin_addr.s_addr = INADDR_ANY;
+	serv.sin_port = htons(port);
+	if(bind(sockno, (PSOCKG) &serv, sizeof(serv)) != 0) {
+		error("cannot bind to port %d, errno = %d", port,
+			sock_errno());
+		(VOID) soclose(sockno);
+		return(-1);
+	}
+
+	/* Several reactors may wait on this socket, so it must not block
+	   the ones that lose the race to accept a call. */
+
+	if(ioctl(sockno, FIONBIO, (PUCHAR) &on, sizeof(on)) != 0) {
+		error("cannot make listening socket non-blocking, errno = %d",
+			sock_errno());
+		(VOID) soclose(sockno);
+		return(-1);
+	}
+
+	if(listen(sockno, BACKLOG) != 0) {
+		error("cannot listen on port %d, errno = %d", port,
+			sock_errno());
+		(VOID) soclose(sockno);
+		return(-1);
+	}
+
+#ifdef	DEBUG
+	trace("listening on port %d", port);
+#endif
+
+	return(sockno);
+}
+
+/*
+ * End of file: listener.c
+ *
+ */
+
\ No newline at end of file
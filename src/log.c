@@ -3,12 +3,26 @@
  *
  * General logging and tracing routines
  *
+ * Log records are not written by the thread that makes them. Each one
+ * is put into the next free slot of a ring, without taking any lock,
+ * and a writer thread takes them out in order, writing as many as it
+ * can at a time; so a session never waits for the logfile, or for the
+ * syslog daemon. If the ring is full, a record waits briefly for room,
+ * and is dropped if none appears.
+ *
+ * Syslog records may be sent in the traditional (BSD) format, or in the
+ * format of RFC 5424, which carries structured data (session number,
+ * client address, mail ID and size) that log analysers can use without
+ * having to pick apart the text. They may go to the syslog daemon's UDP
+ * port, or to a local socket on which it listens.
+ *
  * Bob Eager   August 2003
  *
  */
 
 #pragma	strings(readonly)
 
+#include <builtin.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,14 +30,20 @@
 #include <time.h>
 #include <types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <process.h>
 
+#define	INCL_DOSPROCESS
+#define	INCL_DOSSEMAPHORES
 #include <os2.h>
 
+#include "clock.h"
 #include "log.h"
 
 #pragma	alloc_text(a_init_seg, open_logfile)
 #pragma	alloc_text(a_init_seg, close_logfile)
+#pragma	alloc_text(a_init_seg, start_writer)
 
 #ifdef	DEBUG
 #define	MAXTRACE	200		/* Maximum length of trace line */
@@ -31,19 +51,55 @@
 
 #define	SYSLOGSERVICE	"syslog"	/* Name of syslog service */
 #define	UDP		"udp"		/* UDP protocol */
+#define	LOGBUFSIZE	16384		/* Size of log writer's buffer */
+#define	LOGSTACK	16384		/* Stack size for log writer thread */
+#define	LOGIDLE		1000		/* Log writer idle wait (ms) */
+#define	LOGCLOSEWAIT	5000		/* Wait for log writer at close (ms) */
+#define	LOGIPLEN	16		/* Space for client IP address */
+#define	LOGIDLEN	16		/* Space for mail ID */
+#define	SDID		"smtpd@32473"	/* RFC 5424 structured data ID */
+#define	MAXHEADER	250		/* Longest RFC 5424 header fields */
+#define	MAXPRI		8		/* Longest priority (and version) */
+#define	MAXSD		110		/* Longest RFC 5424 structured data */
+#define	MAXLINE		(MAXPRI+CLOCK_MAXSTR+MAXHEADER+MAXSD+MAXLOG+2)
+					/* Longest record in any format */
+
+#define	FALSE		0
+#define	TRUE		1
 
 /* Type definitions */
 
 typedef	struct servent		SERV, *PSERV;		/* Service structure */
 typedef struct sockaddr         SOCKG, *PSOCKG;         /* Generic structure */
 typedef struct sockaddr_in      SOCK, *PSOCK;           /* Internet structure */
+typedef	struct sockaddr_un	SOCKL, *PSOCKL;		/* Local structure */
+
+typedef	struct	_LOGREC {		/* One queued log record */
+volatile INT	seq;			/* Position for which slot is ready */
+UINT		type;			/* Log entry type */
+time_t		tod;			/* Time logged */
+ULONG		session;		/* Session number, or 0 */
+ULONG		size;			/* Message size, or 0 */
+UCHAR		client[LOGIPLEN];	/* Client IP address, or empty */
+UCHAR		mail_id[LOGIDLEN];	/* Mail ID, or empty */
+UCHAR		text[MAXLOG+1];		/* The record itself */
+} LOGREC, *PLOGREC;
 
 /* Forward references */
 
-static	VOID	dolog_file(UINT, PUCHAR);
-static	VOID	dolog_syslog(UINT, PUCHAR);
+static	VOID	count(volatile INT *, INT);
+static	INT	emit(PUCHAR, INT, PLOGREC);
+static	VOID	fill(PLOGREC, UINT, PLOGINFO, PUCHAR);
+static	INT	flush(PUCHAR, INT);
+static	INT	format_file(PUCHAR, PLOGREC);
+static	INT	format_rfc5424(PUCHAR, PLOGREC);
+static	INT	format_syslog(PUCHAR, PLOGREC);
 static	INT	open_logfile(PUCHAR, PUCHAR);
-static	INT	open_syslog(PUCHAR, PUCHAR);
+static	INT	open_syslog(PUCHAR, PUCHAR, PUCHAR);
+static	VOID	queue(UINT, PLOGINFO, PUCHAR);
+static	VOID	start_writer(VOID);
+static	VOID	wake(VOID);
+static	VOID	_Optlink writer(PVOID);
 
 /* Local storage */
 
@@ -53,6 +109,21 @@ static	INT	logsock = -1;
 static	UCHAR	procname[100];
 static	UCHAR	hostname[100];
 static	SOCK	syslog;
+static	INT	syslog_format = LOGFMT_BSD;
+static	UCHAR	header[MAXHEADER+1];	/* RFC 5424 host, app, process, ID */
+
+static	PLOGREC	ring = (PLOGREC) NULL;	/* Queued records, or NULL if none */
+static	volatile INT tail;		/* Next position to be filled */
+static	INT	head;			/* Next position to be written out */
+static	volatile INT idle;		/* Writer is waiting for records */
+static	volatile INT stopping;		/* Writer is to finish */
+static	HEV	worksem;		/* Posted when writer is wanted */
+static	HEV	donesem;		/* Posted when writer has finished */
+static	volatile INT lost;		/* Records dropped, not yet reported */
+static	volatile INT nrecords;		/* Statistics since last collected */
+static	volatile INT nwrites;
+static	volatile INT nwaits;
+static	volatile INT ndropped;
 
 /*
  * Open the logging system. The 'type' parameter specified how the logging
@@ -63,6 +134,10 @@ static	SOCK	syslog;
  * environment variable is not found. The actual name of the logfile
  * is given by 'file'.
  *
+ * If logging to the syslog, records are sent to the local socket named
+ * by 'sockname', or to the syslog daemon's UDP port if this is empty;
+ * 'format' gives the record format (LOGFMT_BSD or LOGFMT_RFC5424).
+ *
  * Returns:
  *	LOGERR_OK		log successfully opened
  *	LOGERR_NOENV		environment variable not set for log directory
@@ -71,20 +146,59 @@ static	SOCK	syslog;
  */
 
 INT open_log(UINT log_type, PUCHAR direnv, PUCHAR file, PUCHAR myname,
-		PUCHAR myprocname)
-{	logging_type = log_type;
+		PUCHAR myprocname, PUCHAR sockname, INT format)
+{	INT rc;
+
+	logging_type = log_type;
+	syslog_format = format;
 
 	switch(log_type) {
 		case LOGGING_FILE:
-			return(open_logfile(direnv, file));
+			rc = open_logfile(direnv, file);
+			break;
 
 		case LOGGING_SYSLOG:
-			return(open_syslog(myname, myprocname));
+			rc = open_syslog(myname, myprocname, sockname);
+			break;
 
 		default:
 			logging_type = LOGGING_UNSET;
 			return(LOGERR_LOGTYPE);
 	}
+
+	if(rc == LOGERR_OK) {
+		start_writer();
+
+		/* Make sure that records queued just before an exit() are
+		   not lost */
+
+		(VOID) atexit(close_log);
+	}
+
+	return(rc);
+}
+
+
+/*
+ * Start the log writer thread, and set up the ring from which it takes
+ * log records. If this cannot be done, records are written directly by
+ * the threads that make them.
+ *
+ */
+
+static VOID start_writer(VOID)
+{	INT i;
+
+	ring = (PLOGREC) malloc(LOGRING*sizeof(LOGREC));
+	if(ring == (PLOGREC) NULL) return;
+	for(i = 0; i < LOGRING; i++) ring[i].seq = i;
+
+	if(DosCreateEventSem((PSZ) NULL, &worksem, 0, FALSE) != 0 ||
+	   DosCreateEventSem((PSZ) NULL, &donesem, 0, FALSE) != 0 ||
+	   _beginthread(writer, NULL, LOGSTACK, NULL) == -1) {
+		free(ring);
+		ring = (PLOGREC) NULL;
+	}
 }
 
 
@@ -123,7 +237,9 @@ static INT open_logfile(PUCHAR direnv, PUCHAR file)
 
 
 /*
- * Open the syslog.
+ * Open the syslog. If 'sockname' is not empty, it names a local socket
+ * on which the syslog daemon is listening; otherwise, the syslog
+ * daemon's UDP port is used.
  *
  * Returns:
  *	LOGERR_OK		log successfully opened
@@ -132,10 +248,11 @@ static INT open_logfile(PUCHAR direnv, PUCHAR file)
  *
  */
 
-static INT open_syslog(PUCHAR myname, PUCHAR myprocname)
+static INT open_syslog(PUCHAR myname, PUCHAR myprocname, PUCHAR sockname)
 {	INT rc;
 	PSERV logserv;
 	PUCHAR p, q;
+	SOCKL local;
 
 	if(logsock != -1) return(LOGERR_OK);
 
@@ -159,6 +276,37 @@ static INT open_syslog(PUCHAR myname, PUCHAR myprocname)
 	}
 	strcpy(procname, myprocname);
 
+	/* RFC 5424 wants the full host name, and the process ID; these
+	   never change, so they are formatted just once. */
+
+	sprintf(header, " %.100s %.48s %d - ",
+		myname[0] == '[' ? hostname : myname, procname, getpid());
+
+	if(sockname[0] != '\0') {
+		if(strlen(sockname) >= sizeof(local.sun_path)) {
+			fprintf(stderr, "syslog socket name too long");
+			return(LOGERR_OPENFAIL);
+		}
+		logsock = socket(PF_UNIX, SOCK_DGRAM, 0);
+		if(logsock == -1) {
+			fprintf(stderr, "cannot create socket for logging");
+			return(LOGERR_OPENFAIL);
+		}
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		strcpy(local.sun_path, sockname);
+		rc = connect(logsock, (PSOCKG) &local, sizeof(local));
+		if(rc == -1) {
+			fprintf(stderr, "cannot connect to syslog socket %s",
+				sockname);
+			(VOID) soclose(logsock);
+			logsock = -1;
+			return(LOGERR_OPENFAIL);
+		}
+
+		return(LOGERR_OK);
+	}
+
 	logserv = getservbyname(SYSLOGSERVICE, UDP);
 	endservent();
 	if(logserv == (PSERV) NULL) {
@@ -192,12 +340,21 @@ static INT open_syslog(PUCHAR myname, PUCHAR myprocname)
 
 
 /*
- * Close the log.
+ * Close the log, once the writer thread has written out any records
+ * still queued.
  *
  */
 
 VOID close_log(VOID)
-{	switch(logging_type) {
+{	if(logging_type == LOGGING_UNSET) return;
+
+	if(ring != (PLOGREC) NULL) {
+		stopping = TRUE;
+		(VOID) DosPostEventSem(worksem);
+		(VOID) DosWaitEventSem(donesem, LOGCLOSEWAIT);
+	}
+
+	switch(logging_type) {
 		case LOGGING_FILE:
 			if(logfp != (FILE *) NULL) fclose(logfp);
 			break;
@@ -220,80 +377,357 @@ VOID close_log(VOID)
  */
 
 VOID dolog(UINT type, PUCHAR s)
-{	switch(logging_type) {
+{	dolog_info(type, (PLOGINFO) NULL, s);
+}
+
+
+/*
+ * Write a string to the log, wherever it is, along with the details of
+ * the session and message it concerns (pointed to by 'ip'; NULL if
+ * none). Normally, it is just queued for the writer thread.
+ *
+ */
+
+VOID dolog_info(UINT type, PLOGINFO ip, PUCHAR s)
+{	LOGREC rec;
+	UCHAR buf[MAXLINE+1];
+
+	if(logging_type == LOGGING_UNSET) return;
+
+	if(ring != (PLOGREC) NULL) {
+		queue(type, ip, s);
+		return;
+	}
+
+	/* No writer thread; write the string straight away */
+
+	fill(&rec, type, ip, s);
+	(VOID) flush(buf, emit(buf, 0, &rec));
+}
+
+
+/*
+ * Put a string in the next free slot of the ring, for the writer
+ * thread. A slot is claimed by advancing the tail position with an
+ * atomic compare-and-exchange, so many threads may do this at once. A
+ * slot is free for position 'pos' when its sequence number is 'pos',
+ * and ready to be written out when it is 'pos+1'; the writer sets it to
+ * 'pos+LOGRING' when done with it, freeing it for the next time round.
+ *
+ * If the ring is full, this waits a little while for the writer to
+ * make room; if it does not, the string is dropped.
+ *
+ */
+
+static VOID queue(UINT type, PLOGINFO ip, PUCHAR s)
+{	INT pos, waits = 0;
+	PLOGREC rp;
+
+	for(;;) {
+		pos = tail;
+		rp = &ring[pos & (LOGRING-1)];
+		if(rp->seq == pos) {		/* Free; try to claim it */
+			if(__cxchg(&tail, pos, pos+1) == pos) break;
+		} else if(rp->seq - pos < 0) {	/* Ring is full */
+			if(waits == 0) count(&nwaits, 1);
+			if(waits++ == LOGWAITS) {
+				count(&ndropped, 1);
+				count(&lost, 1);
+				return;
+			}
+			wake();
+			(VOID) DosSleep(1);
+		}
+	}
+
+	fill(rp, type, ip, s);
+	(VOID) __lxchg(&rp->seq, pos+1);	/* Ready to be written */
+
+	if(idle != 0) wake();
+}
+
+
+/*
+ * Fill in the log record pointed to by 'rp', for the string 's' of log
+ * entry type 'type', with the details pointed to by 'ip' (if any).
+ *
+ */
+
+static VOID fill(PLOGREC rp, UINT type, PLOGINFO ip, PUCHAR s)
+{	rp->type = type;
+	(VOID) time(&rp->tod);
+	rp->session = 0;
+	rp->size = 0;
+	rp->client[0] = '\0';
+	rp->mail_id[0] = '\0';
+	if(ip != (PLOGINFO) NULL) {
+		rp->session = ip->session;
+		rp->size = ip->size;
+		if(ip->client != (PUCHAR) NULL) {
+			strncpy(rp->client, ip->client, LOGIPLEN-1);
+			rp->client[LOGIPLEN-1] = '\0';
+		}
+		if(ip->mail_id != (PUCHAR) NULL) {
+			strncpy(rp->mail_id, ip->mail_id, LOGIDLEN-1);
+			rp->mail_id[LOGIDLEN-1] = '\0';
+		}
+	}
+	strncpy(rp->text, s, MAXLOG);
+	rp->text[MAXLOG] = '\0';
+}
+
+
+/*
+ * Wake the writer thread, if it is waiting for records.
+ *
+ */
+
+static VOID wake(VOID)
+{	if(__lxchg(&idle, 0) != 0) (VOID) DosPostEventSem(worksem);
+}
+
+
+/*
+ * Main loop of the log writer thread. Every record that is ready is
+ * taken from the ring, and written out; to a logfile they are written
+ * in as few writes as possible. When there are none, the thread waits
+ * to be woken.
+ *
+ */
+
+static VOID _Optlink writer(PVOID arg)
+{	INT len, n;
+	ULONG posts;
+	PLOGREC rp;
+	UCHAR mes[MAXLOG+1];
+	static LOGREC rec;
+	static UCHAR buf[LOGBUFSIZE];
+
+	for(;;) {
+		len = 0;
+
+		for(;;) {
+			rp = &ring[head & (LOGRING-1)];
+			if(rp->seq != head+1) break;
+			len = emit(buf, len, rp);
+			(VOID) __lxchg(&rp->seq, head+LOGRING);
+			head++;
+		}
+
+		n = __lxchg(&lost, 0);
+		if(n != 0) {
+			sprintf(mes, "log: %d record%s dropped, log ring full",
+				n, n == 1 ? "" : "s");
+			fill(&rec, LOG_WARNING, (PLOGINFO) NULL, mes);
+			len = emit(buf, len, &rec);
+		}
+
+		if(len != 0) {
+			(VOID) flush(buf, len);
+			continue;		/* More may have arrived */
+		}
+		if(stopping != FALSE) break;
+
+		/* Nothing to do. Say so, then look once more, in case a
+		   record was added before it was seen. */
+
+		(VOID) DosResetEventSem(worksem, &posts);
+		(VOID) __lxchg(&idle, 1);
+		if(ring[head & (LOGRING-1)].seq != head+1)
+			(VOID) DosWaitEventSem(worksem, LOGIDLE);
+		(VOID) __lxchg(&idle, 0);
+	}
+
+	(VOID) DosPostEventSem(donesem);
+}
+
+
+/*
+ * Write out the log record pointed to by 'rp', using the buffer 'buf',
+ * which already holds 'len' bytes. For a logfile, the record is added
+ * to the buffer, which is written out first if there is no room; for
+ * the syslog, the record is sent straight away, as a datagram of its
+ * own.
+ *
+ * Returns:
+ *	number of bytes now held in 'buf'
+ *
+ */
+
+static INT emit(PUCHAR buf, INT len, PLOGREC rp)
+{	count(&nrecords, 1);
+
+	switch(logging_type) {
 		case LOGGING_FILE:
-			dolog_file(type, s);
-			break;
+			if(len + MAXLINE > LOGBUFSIZE) len = flush(buf, len);
+			return(len + format_file(&buf[len], rp));
 
 		case LOGGING_SYSLOG:
-			dolog_syslog(type, s);
+			len = syslog_format == LOGFMT_RFC5424 ?
+				format_rfc5424(buf, rp) :
+				format_syslog(buf, rp);
+			(VOID) send(logsock, buf, len, 0);
+			count(&nwrites, 1);
 			break;
 	}
+
+	return(0);
 }
 
 
 /*
- * Write a string to the logfile. The string is timestamped, and a newline
- * appended to the end unless there is one there already.
+ * Write out the 'len' bytes of log records held in 'buf' to the
+ * logfile, in one go.
  *
- * This routine is thread-safe; it writes only ONE string to the logfile,
- * ensuring that the file does not become garbled.
+ * Returns:
+ *	0 (number of bytes left in 'buf')
  *
  */
 
-static VOID dolog_file(UINT type, PUCHAR s)
-{	time_t tod;
-	UCHAR timeinfo[35];
-	UCHAR buf[MAXLOG+1];
+static INT flush(PUCHAR buf, INT len)
+{	if(len == 0 || logfp == (FILE *) NULL) return(0);
 
-	if(logfp == (FILE *) NULL) return;
+	(VOID) fwrite(buf, 1, len, logfp);
+	(VOID) fflush(logfp);
+	count(&nwrites, 1);
 
-	(VOID) time(&tod);
-	(VOID) strftime(
-			timeinfo,
-			sizeof(timeinfo),
-			"%d/%m/%y %X>",
-			localtime(&tod));
-	sprintf(buf, "%s %s", timeinfo, s);
-	if(s[strlen(s)-1] != '\n') strcat(buf, "\n");
+	return(0);
+}
 
-	fputs(buf, logfp);
-	fflush(logfp);
+
+/*
+ * Format the log record pointed to by 'rp' as a logfile record in
+ * 'buf'. The string is timestamped, and a newline appended to the end
+ * unless there is one there already. No terminating null is added.
+ *
+ * Returns:
+ *	length of record
+ *
+ */
+
+static INT format_file(PUCHAR buf, PLOGREC rp)
+{	INT len;
+
+	len = clock_format(CLOCK_LOGFILE, rp->tod, buf);
+	strcpy(&buf[len], rp->text);
+	len += strlen(rp->text);
+	if(len == 0 || buf[len-1] != '\n') buf[len++] = '\n';
+
+	return(len);
 }
 
 
-static VOID dolog_syslog(UINT severity, PUCHAR s)
-{	UCHAR buf[MAXLOG+1];
-	UCHAR temp[MAXLOG+1];
-	time_t tod;
+/*
+ * Format the log record pointed to by 'rp' as a traditional syslog
+ * datagram in 'buf', which must hold MAXLINE+1 bytes.
+ *
+ * Returns:
+ *	length of datagram
+ *
+ */
+
+static INT format_syslog(PUCHAR buf, PLOGREC rp)
+{	INT len;
 
 	/* Construct the Priority field */
 
-	sprintf(buf, "<%d>", (LOGF_MAIL*8) + severity);
+	len = sprintf(buf, "<%d>", (LOGF_MAIL*8) + rp->type);
 
 	/* Now add date and time */
 
-	(VOID) time(&tod);
-	(VOID) strftime(temp, MAXLOG, "%b %Oe %T ", localtime(&tod));
-	strcat(buf, temp);
+	len += clock_format(CLOCK_SYSLOG, rp->tod, &buf[len]);
 
-	/* Now the host name and process name */
+	/* Now the host name, process name and message */
 
-	sprintf(temp, "%s %s: ", hostname, procname);
-	strcat(buf, temp);
+	len += sprintf(&buf[len], "%s %s: %s", hostname, procname, rp->text);
 
-	/* Now the message */
+	/* Clean trailing newline */
 
-	strcat(buf, s);
+	if(buf[len-1] == '\n') buf[--len] = '\0';
 
-	/* Clean trailing newline */
+	return(len);
+}
+
+
+/*
+ * Format the log record pointed to by 'rp' as an RFC 5424 syslog
+ * datagram in 'buf', which must hold MAXLINE+1 bytes. The time is given
+ * in UTC. Any details of the session and message go into the structured
+ * data (at most MAXSD bytes, as the client address and mail ID are
+ * limited in length); the values never contain characters that need
+ * escaping.
+ *
+ * Returns:
+ *	length of datagram
+ *
+ */
+
+static INT format_rfc5424(PUCHAR buf, PLOGREC rp)
+{	INT len;
+
+	/* Priority, version and timestamp, then the fields that never
+	   change */
+
+	len = sprintf(buf, "<%d>1 ", (LOGF_MAIL*8) + rp->type);
+	len += clock_format(CLOCK_RFC5424, rp->tod, &buf[len]);
+	strcpy(&buf[len], header);
+	len += strlen(header);
+
+	/* Structured data */
+
+	if(rp->session == 0 && rp->client[0] == '\0' &&
+	   rp->mail_id[0] == '\0') {
+		buf[len++] = '-';
+	} else {
+		len += sprintf(&buf[len], "[%s", SDID);
+		if(rp->session != 0)
+			len += sprintf(&buf[len], " session=\"%lu\"",
+					rp->session);
+		if(rp->client[0] != '\0')
+			len += sprintf(&buf[len], " client=\"%s\"",
+					rp->client);
+		if(rp->mail_id[0] != '\0')
+			len += sprintf(&buf[len],
+					" mailid=\"%s\" size=\"%lu\"",
+					rp->mail_id, rp->size);
+		buf[len++] = ']';
+	}
+
+	/* Now the message, without any trailing newline */
+
+	len += sprintf(&buf[len], " %s", rp->text);
+	if(buf[len-1] == '\n') buf[--len] = '\0';
+
+	return(len);
+}
+
+
+/*
+ * Collect the logging statistics for the period since the last call,
+ * into the structure pointed to by 'sp'.
+ *
+ */
+
+VOID logging_stats(PLOGSTATS sp)
+{	sp->records = (ULONG) __lxchg(&nrecords, 0);
+	sp->writes = (ULONG) __lxchg(&nwrites, 0);
+	sp->waits = (ULONG) __lxchg(&nwaits, 0);
+	sp->dropped = (ULONG) __lxchg(&ndropped, 0);
+}
 
-	if(buf[strlen(buf)-1] == '\n')
-		buf[strlen(buf)-1] = '\0';
 
-	/* Send the message */
+/*
+ * Add 'n' to the counter pointed to by 'p', which may be updated by
+ * other threads at the same time.
+ *
+ */
+
+static VOID count(volatile INT *p, INT n)
+{	INT old;
 
-	(VOID) send(logsock, &buf[0], strlen(buf), 0);
+	do {
+		old = *p;
+	} while(__cxchg(p, old, old+n) != old);
 }
 
 
@@ -10,6 +10,9 @@
 /* Tunable constants */
 
 #define	MAXLOG			200	/* Maximum length of a logfile line */
+#define	LOGRING			1024	/* Records queued for log writer */
+					/* (must be a power of 2) */
+#define	LOGWAITS		4	/* Waits for room before dropping */
 
 /* Error codes */
 
@@ -18,6 +21,11 @@
 #define	LOGERR_OPENFAIL		2	/* Failed to open log */
 #define	LOGERR_LOGTYPE		3	/* Unrecognised logging type */
 
+/* Syslog record formats */
+
+#define	LOGFMT_BSD		0	/* Traditional */
+#define	LOGFMT_RFC5424		1	/* RFC 5424, with structured data */
+
 /* Log facility codes */
 
 #define	LOGF_MAIL		2	/* Mail system */
@@ -38,11 +46,27 @@
 typedef	enum	{ LOGGING_UNSET, LOGGING_FILE, LOGGING_SYSLOG }
 				LOGTYPE;
 
+typedef	struct	_LOGINFO {		/* Details for structured logging */
+ULONG		session;		/* Session number, or 0 */
+PUCHAR		client;			/* Client IP address, or NULL */
+PUCHAR		mail_id;		/* Mail ID, or NULL */
+ULONG		size;			/* Message size (with mail ID) */
+} LOGINFO, *PLOGINFO;
+
+typedef	struct	_LOGSTATS {		/* Logging statistics */
+ULONG		records;		/* Records written */
+ULONG		writes;			/* Writes (or datagrams) used */
+ULONG		waits;			/* Records that waited for room */
+ULONG		dropped;		/* Records dropped; no room */
+} LOGSTATS, *PLOGSTATS;
+
 /* External references */
 
 extern	VOID	close_log(VOID);
 extern	VOID	dolog(UINT, PUCHAR);
-extern	INT	open_log(UINT, PUCHAR, PUCHAR, PUCHAR, PUCHAR);
+extern	VOID	dolog_info(UINT, PLOGINFO, PUCHAR);
+extern	VOID	logging_stats(PLOGSTATS);
+extern	INT	open_log(UINT, PUCHAR, PUCHAR, PUCHAR, PUCHAR, PUCHAR, INT);
 #ifdef	DEBUG
 extern	VOID	trace(PUCHAR, ...);
 #endif
@@ -10,6 +10,16 @@
 #pragma	strings(readonly)
 
 #pragma	alloc_text(a_init_seg, mail_init)
+#pragma	alloc_text(a_init_seg, mail_migrate)
+#pragma	alloc_text(a_init_seg, committed)
+#pragma	alloc_text(a_init_seg, mail_index)
+#pragma	alloc_text(a_init_seg, index_tidy)
+#pragma	alloc_text(a_init_seg, index_recover)
+#pragma	alloc_text(a_init_seg, recover_dir)
+#pragma	alloc_text(a_init_seg, recover_file)
+#pragma	alloc_text(a_init_seg, id_compare)
+#pragma	alloc_text(a_init_seg, mail_segments)
+#pragma	alloc_text(a_init_seg, id_spool)
 #pragma	alloc_text(a_init_seg, fstype)
 
 #include <errno.h>
@@ -17,53 +27,84 @@
 #include <io.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <sys\stat.h>
 #include <ctype.h>
 
+#define	INCL_DOSMEMMGR
+#define	INCL_DOSSEMAPHORES
+#define	INCL_DOSERRORS
 #include <os2.h>
 
 #include "smtpd.h"
 #include "mailstor.h"
+#include "journal.h"
+#include "segment.h"
 
-#define	PATCHSIZE	4		/* Size of first line patch area */
+#define	ENVLINE		514		/* Longest envelope line in mail file */
 #define	FSQBUFSIZE	100		/* Size of FS query buffer */
-
-/* Type definitions */
-
-typedef	enum	{ FS_CDFS, FS_FAT, FS_HPFS, FS_NFS, FS_JFS }
-	FSTYPE;
+#define	JNLBLOCK	64		/* Journal records read at once */
 
 /* Forward references */
 
+static	VOID	audit_close(PMAILSTOR, BOOL);
+static	VOID	audit_open(PMAILSTOR);
+static	BOOL	committed(PUCHAR);
+static	INT	create_file(PMAILSTOR);
+static	BOOL	file_id(PSPOOL, PUCHAR, PUCHAR);
+static	BOOL	flush_file(PMAILSTOR);
 static	FSTYPE	fstype(PUCHAR);
+static	INT	_Optlink id_compare(const VOID *, const VOID *);
+static	BOOL	id_init(VOID);
+static	BOOL	id_spool(PSPOOL);
+static	VOID	index_add(PMAILSTOR, INT);
+static	VOID	index_compact(PSPOOL);
+static	INT	index_recover(PSPOOL);
+static	BOOL	index_tidy(INT);
+static	VOID	make_shard(PSPOOL, PUCHAR, PUCHAR);
+static	VOID	new_id(PSPOOL, PUCHAR);
+static	BOOL	put(PMAILSTOR, PUCHAR, INT);
+static	INT	recover_dir(PSPOOL, PUCHAR, INT, PUCHAR, INT);
+static	BOOL	recover_file(PSPOOL, PUCHAR, PUCHAR);
+static	INT	segment_add(PMAILSTOR);
+static	VOID	segment_cancel(PMAILSTOR);
+static	VOID	segment_reclaim(PSPOOL);
+static	BOOL	segment_roll(PSPOOL);
+static	ULONG	segment_scan(INT, PUCHAR, PBOOL);
+static	PUCHAR	shard_dir(PSPOOL, PUCHAR, PUCHAR);
+static	BOOL	spill(PMAILSTOR);
+static	BOOL	write_file(PMAILSTOR, PUCHAR, INT);
 
 /* Local storage */
 
-static	INT	first_line_seen;
-static	UCHAR	maildir[CCHMAXPATH+1];
-static	UCHAR	mailfile[CCHMAXPATH+1];
-static	FILE	*mailfp;
-static	FSTYPE	mailfstype;
-static	UCHAR	save_temp[PATCHSIZE];
 static	UCHAR	temp[] = "TEMP";
+static	PIDSTATE ids;			/* Mail ID state (shared memory) */
+static	HMTX	idsem;			/* Serialises access to 'ids' */
+static	HMTX	jnlsem;			/* Serialises access to journals */
+static	HEV	jnlevent;		/* Posted when records are added */
+static	JNLREC	jnlbuf[JNLBLOCK];	/* Journal records being compacted */
 
 /*
- * Initialise storage, etc.
+ * Initialise the spool directory named by the environment variable
+ * 'direnv', filling in the structure pointed to by 'sp'. This need only
+ * be done once for each directory; any number of sessions may then
+ * share it.
  *
  * Returns:
  *	MAILINIT_OK		Initialisation successful
  *	MAILINIT_NOENV		Mail spool directory env variable not set
  *	MAILINIT_BADDIR		Cannot access mail spool directory
+ *	MAILINIT_NOIDS		Cannot set up mail ID generator
  *
  */
 
-INT mail_init(PUCHAR direnv)
+INT mail_init(PUCHAR direnv, PSPOOL sp)
 {	APIRET rc;
 	INT last;
-	INT disk = 0;
 	PUCHAR dir;
+	FILESTATUS3 fs;
 
 #ifdef	DEBUG
 	if(strlen(temp) != PATCHSIZE) {
@@ -74,240 +115,1657 @@ INT mail_init(PUCHAR direnv)
 	dir = getenv(direnv);
 	if(dir == (PUCHAR) NULL) return(MAILINIT_NOENV);
 
-	if(isalpha(dir[0]) && dir[1] == ':') {
-		disk = toupper(dir[0]) - 'A' + 1;
+	strcpy(sp->maildir, dir);
+	last = strlen(sp->maildir) - 1;
+	if(sp->maildir[last] == '\\' || sp->maildir[last] == '/')
+		sp->maildir[last] = '\0';
 
-		rc = DosSetDefaultDisk(disk);
-		if(rc != 0) return(MAILINIT_BADDIR);
-	}
+	/* Mail files are always opened by full pathname, so that sessions
+	   for different spool directories can run in the same process. */
+
+	rc = DosQueryPathInfo(sp->maildir, FIL_STANDARD, &fs, sizeof(fs));
+	if(rc != 0 || (fs.attrFile & FILE_DIRECTORY) == 0)
+		return(MAILINIT_BADDIR);
 
-	strcpy(maildir, dir);
-	last = strlen(maildir) - 1;
-	if(maildir[last] == '\\' || maildir[last] == '/')
-		maildir[last] = '\0';
-	rc = DosSetCurrentDir(maildir);
-	if(rc != 0) return(MAILINIT_BADDIR);
+	sp->fstype = fstype(sp->maildir);
+	sp->maxsize = 0;		/* No limit unless set by caller */
+	sp->auditdir = "";		/* No security log unless set by caller */
+	sp->shards = 0;			/* Flat unless set by caller */
+	sp->journal = -1;		/* No index unless set by caller */
+	sp->segsize = 0;		/* No segments unless set by caller */
+	sp->segfd = -1;
+	sp->oldfd = -1;
 
-	mailfstype = fstype(maildir);
+	if(ids == (PIDSTATE) NULL && id_init() == FALSE)
+		return(MAILINIT_NOIDS);
+	if(id_spool(sp) == FALSE) return(MAILINIT_NOIDS);
 #ifdef	DEBUG
 	trace("mail directory = \"%s\", FS type = %s\n",
-		maildir, mailfstype == FS_FAT  ? "FAT"  :
-			 mailfstype == FS_HPFS ? "HPFS" :
-			 mailfstype == FS_CDFS ? "CDFS" :
-			 mailfstype == FS_NFS  ? "NFS"  :
-			 mailfstype == FS_JFS  ? "JFS"  :
-			 "????");
+		sp->maildir, sp->fstype == FS_FAT  ? "FAT"  :
+			     sp->fstype == FS_HPFS ? "HPFS" :
+			     sp->fstype == FS_CDFS ? "CDFS" :
+			     sp->fstype == FS_NFS  ? "NFS"  :
+			     sp->fstype == FS_JFS  ? "JFS"  :
+			     "????");
 #endif
-	mailfp = (FILE *) NULL;
 
 	return(MAILINIT_OK);
 }
 
 
 /*
- * Function to determine the type of file system on the drive specified
- * in 'path'.
+ * Move any mail files found at the top level of the spool directory
+ * described by 'sp' into the hashed subdirectories where they now
+ * belong; this is needed when a spool directory that has been used
+ * without subdirectories is switched over to them. Files still being
+ * written (with temporary names, or with their first line patched)
+ * are left alone, as are any files that cannot be moved because they
+ * are in use.
  *
  * Returns:
- *	 FS_CDFS, FS_NFS, FS_FAT, FS_HPFS or FS_JFS.
+ *	number of mail files moved
  *
- * Any error causes the result to default to FS_FAT.
+ */
+
+INT mail_migrate(PSPOOL sp)
+{	HDIR hdir = HDIR_CREATE;
+	ULONG count = 1;
+	INT moved = 0;
+	PUCHAR name;
+	FILEFINDBUF3 ff;
+	UCHAR id[MAXMAILID+1];
+	UCHAR from[CCHMAXPATH+1];
+	UCHAR to[CCHMAXPATH+1];
+
+	if(sp->shards == 0) return(0);
+
+	sprintf(from, "%s\\%s", sp->maildir,
+		(sp->fstype == FS_HPFS) || (sp->fstype == FS_JFS) ?
+			"*.mail" : "*.?ml");
+	if(DosFindFirst(
+			from,
+			&hdir,
+			FILE_NORMAL,
+			&ff,
+			sizeof(ff),
+			&count,
+			FIL_STANDARD) != 0)
+		return(0);		/* Nothing there */
+
+	do {
+		if(file_id(sp, ff.achName, id) == FALSE) continue;
+
+		sprintf(from, "%s\\%s", sp->maildir, ff.achName);
+		name = shard_dir(sp, id, to);
+		strcpy(name, ff.achName);
+		if(committed(from) == FALSE) continue;
+
+		make_shard(sp, to, name);
+		if(DosMove(from, to) == 0) moved++;
+#ifdef	DEBUG
+		else trace("cannot move \"%s\" to \"%s\"\n", from, to);
+#endif
+	} while(DosFindNext(hdir, &ff, sizeof(ff), &count) == 0);
+	(VOID) DosFindClose(hdir);
+
+	return(moved);
+}
+
+
+/*
+ * Recover the mail ID from the mail filename 'name' (see mail_open()),
+ * in a spool directory described by 'sp', into 'id'. FAT stores names
+ * in upper case, but IDs are lower case.
+ *
+ * Returns:
+ *	TRUE		ID recovered
+ *	FALSE		not the name of a mail file
  *
  */
 
-static FSTYPE fstype(PUCHAR path)
-{	ULONG drive, dummy;
-	ULONG fsqbuflen = FSQBUFSIZE;
-	UCHAR fsqbuf[FSQBUFSIZE];
-	PUCHAR p;
-	UCHAR drv[3];
+static BOOL file_id(PSPOOL sp, PUCHAR name, PUCHAR id)
+{	INT i;
+	BOOL lfn = (sp->fstype == FS_HPFS) || (sp->fstype == FS_JFS);
 
-	if(path[1] != ':') {		/* No drive in path - use default */
-		(VOID) DosQueryCurrentDisk(&drive, &dummy);
-		drv[0] = drive + 'a' - 1;
-	} else {
-		drv[0] = path[0];
+	if(strlen(name) != (lfn == TRUE ? MAXMAILID+5 : MAXMAILID+3))
+		return(FALSE);
+
+	for(i = 0; i < MAXMAILID - 1; i++)
+		id[i] = tolower(name[i]);
+	id[MAXMAILID-1] = tolower(name[lfn == TRUE ? 8 : 9]);
+	id[MAXMAILID] = '\0';
+
+	return(TRUE);
+}
+
+
+/*
+ * Check whether the mail file 'path' is complete, i.e. its first line
+ * is no longer patched (see mail_store()).
+ *
+ * Returns:
+ *	TRUE		file is complete
+ *	FALSE		file is still being written, or cannot be read
+ *
+ */
+
+static BOOL committed(PUCHAR path)
+{	INT fd, n;
+	UCHAR buf[PATCHSIZE];
+
+	fd = open(path, O_RDONLY | O_BINARY);
+	if(fd == -1) return(FALSE);
+	n = read(fd, buf, PATCHSIZE);
+	(VOID) close(fd);
+
+	return(n == PATCHSIZE && memcmp(buf, temp, PATCHSIZE) != 0 ?
+		TRUE : FALSE);
+}
+
+
+/*
+ * Open the index journal of the spool directory described by 'sp',
+ * creating it if need be; from now on, every message committed to the
+ * spool directory is listed in it (see index_add()). Any record left
+ * incomplete by a system failure is removed.
+ *
+ * If 'recover' is TRUE, the journal is also brought up to date with the
+ * spool directory itself: records of mail files that have gone are
+ * removed, and records are added for any complete mail files that are
+ * not listed (for example, because the system failed just after they
+ * were committed). This means searching the whole spool directory.
+ *
+ * Returns:
+ *	number of mail files added to the journal
+ *	-1 if the journal cannot be opened
+ *
+ */
+
+INT mail_index(PSPOOL sp, BOOL recover)
+{	INT added = 0;
+	UCHAR path[CCHMAXPATH+1];
+
+	if(jnlsem == (HMTX) 0 && jnl_sem(&jnlsem) == FALSE) return(-1);
+	if(jnlevent == (HEV) 0 && jnl_event(&jnlevent) == FALSE) return(-1);
+
+	sprintf(path, "%s\\%s", sp->maildir, JNL_FILE);
+	sp->journal = open(path,
+			   O_CREAT | O_RDWR | O_BINARY,
+			   S_IREAD | S_IWRITE);
+	if(sp->journal == -1) return(-1);
+
+	(VOID) DosRequestMutexSem(jnlsem, SEM_INDEFINITE_WAIT);
+	if(index_tidy(sp->journal) == FALSE) {
+		added = -1;
+	} else if(recover == TRUE) {
+		index_compact(sp);
+		added = index_recover(sp);
 	}
-	drv[1] = ':';
-	drv[2] = '\0';
+	(VOID) DosReleaseMutexSem(jnlsem);
 
-	if(DosQueryFSAttach(
-			drv,
-			0L,
-			FSAIL_QUERYNAME,
-			(PFSQBUFFER2) fsqbuf,
-			&fsqbuflen) != 0)
-		return(FS_FAT);
+	if(added == -1) {
+		(VOID) close(sp->journal);
+		sp->journal = -1;
+	} else if(added != 0) {
+		(VOID) DosPostEventSem(jnlevent);
+	}
 
-	/* Set 'p' to point to the file system name */
+	return(added);
+}
 
-	p = fsqbuf + sizeof(USHORT);	/* Point past device type */
-	p += (USHORT) *p + 3*sizeof(USHORT) + 1;
-					/* Point past drive name and FS name */
-					/* and FSDA length */
 
-	if(strcmp(p, "CDFS") == 0) return(FS_CDFS);
-	if(strcmp(p, "HPFS") == 0) return(FS_HPFS);
-	if(strcmp(p, "NFS") == 0) return(FS_NFS);
-	if(strcmp(p, "JFS") == 0) return(FS_JFS);
+/*
+ * Check the journal open on handle 'fd', giving it a header if it is
+ * new, and removing any incomplete records from its end. The journal
+ * semaphore must be held.
+ *
+ * Returns:
+ *	TRUE		journal ready for use
+ *	FALSE		journal unusable, or not a journal
+ *
+ */
 
-	return(FS_FAT);
+static BOOL index_tidy(INT fd)
+{	LONG end;
+	JNLHDR hdr;
+	JNLREC rec;
+
+	end = lseek(fd, 0L, SEEK_END);
+	if(end < JNL_RECSIZE) {		/* New journal */
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = JNL_MAGIC;
+		hdr.version = JNL_VERSION;
+		hdr.generation = 1;
+		hdr.live = 0;
+		return(lseek(fd, 0L, SEEK_SET) == 0 &&
+		       write(fd, &hdr, JNL_RECSIZE) == JNL_RECSIZE &&
+		       chsize(fd, JNL_RECSIZE) == 0 ? TRUE : FALSE);
+	}
+
+	if(jnl_header(fd, &hdr) == FALSE) return(FALSE);
+
+	end -= end % JNL_RECSIZE;	/* Lose any partial record */
+	while(end > JNL_RECSIZE) {
+		if(lseek(fd, end - JNL_RECSIZE, SEEK_SET) == -1 ||
+		   read(fd, &rec, JNL_RECSIZE) != JNL_RECSIZE)
+			return(FALSE);
+		if(jnl_check(&rec) == rec.check) break;
+		end -= JNL_RECSIZE;
+	}
+
+	return(chsize(fd, end) == 0 ? TRUE : FALSE);
 }
 
 
 /*
- * Set up for storage of a new mail message.
- * 'idptr' points to a pointer to be set to the message ID allocated.
+ * Add records to the journal of the spool directory described by 'sp'
+ * for any complete mail files in it that are not already listed. The
+ * journal semaphore must be held.
  *
  * Returns:
- *	TRUE		storage set up OK
- *	FALSE		storage set up failed
+ *	number of mail files added
  *
  */
 
-BOOL mail_open(PUCHAR *idptr)
-{	INT fd;
-	UCHAR c = 'a';
-	time_t tod;
+static INT index_recover(PSPOOL sp)
+{	INT i, n, nids, added;
+	LONG end;
+	PUCHAR ids;
 
-	static UCHAR mail_id[MAXMAILID+1];
+	/* Collect the mail IDs already listed, sorted for searching */
 
-	(VOID) time(&tod);
+	end = lseek(sp->journal, 0L, SEEK_END);
+	nids = end/JNL_RECSIZE - 1;
+	ids = malloc(nids*JNL_IDLEN + 1);
+	if(ids == (PUCHAR) NULL) return(0);
 
-	/* Generate a unique mail ID and thus mail filename. This
-	   is done simply by seeing if a file with that name already
-	   exists. The derivation of the filename depends on whether
-	   long filenames are permitted in the mail directory, but in any
-	   case it is ultimately the existence of the file that determines
-	   whether a mail ID is unique. */
+	(VOID) lseek(sp->journal, JNL_RECSIZE, SEEK_SET);
+	for(nids = 0; ; ) {
+		n = read(sp->journal, jnlbuf, sizeof(jnlbuf))/JNL_RECSIZE;
+		if(n <= 0) break;
+		for(i = 0; i < n; i++)
+			strcpy(&ids[JNL_IDLEN*nids++], jnlbuf[i].mail_id);
+	}
+	qsort(ids, nids, JNL_IDLEN, id_compare);
 
-	for(;;) {
-		sprintf(mail_id, "%8x%c", tod, c);
-		if((mailfstype == FS_HPFS) || (mailfstype == FS_JFS)) {
-						/* xxxxxxxxx.mail */
-			sprintf(mailfile, "%s.mail", mail_id);
-		} else {			/* xxxxxxxx.xml */
-			mailfile[0] = '\0';
-			strncat(mailfile, mail_id, 8);
-			strcat(mailfile, ".");
-			strcat(mailfile, &mail_id[8]);
-			strcat(mailfile, "ml");
-		}
-#ifdef	DEBUG
-		trace("creating mail file \"%s\"\n", mailfile);
-#endif
-		fd = open(mailfile,
-			  O_CREAT | O_EXCL | O_WRONLY,
-			  S_IREAD | S_IWRITE);
-		if(fd == -1) {
-			if(errno == EEXIST) {
-#ifdef	DEBUG
-				trace("mail file exists\n");
-#endif
-				if(c == 'z') return(FALSE);
-				c++;
+	added = recover_dir(sp, "", 0, ids, nids);
+	free(ids);
+
+	return(added);
+}
+
+
+/*
+ * Search the part of the spool directory described by 'sp' that is
+ * named by 'rel' (relative to the spool directory itself, and either
+ * empty or ending in '\'), which is at subdirectory level 'level',
+ * adding journal records for complete mail files whose IDs are not in
+ * the sorted table 'ids' of 'nids' entries.
+ *
+ * Returns:
+ *	number of mail files added
+ *
+ */
+
+static INT recover_dir(PSPOOL sp, PUCHAR rel, INT level, PUCHAR ids,
+			INT nids)
+{	HDIR hdir = HDIR_CREATE;
+	ULONG count = 1;
+	INT added = 0;
+	BOOL dirs = level < sp->shards ? TRUE : FALSE;
+	FILEFINDBUF3 ff;
+	UCHAR id[JNL_IDLEN];
+	UCHAR path[CCHMAXPATH+1];
+
+	sprintf(path, "%s\\%s%s", sp->maildir, rel,
+		dirs == TRUE ? "??" :
+		(sp->fstype == FS_HPFS) || (sp->fstype == FS_JFS) ?
+			"*.mail" : "*.?ml");
+	if(DosFindFirst(
+			path,
+			&hdir,
+			dirs == TRUE ? FILE_DIRECTORY : FILE_NORMAL,
+			&ff,
+			sizeof(ff),
+			&count,
+			FIL_STANDARD) != 0)
+		return(0);
+
+	do {
+		sprintf(path, "%s%s", rel, ff.achName);
+		if(dirs == TRUE) {
+			if((ff.attrFile & FILE_DIRECTORY) == 0 ||
+			   ff.achName[0] == '.')
 				continue;
-			}
-			return(FALSE);		/* Some other error */
+			strcat(path, "\\");
+			added += recover_dir(sp, path, level+1, ids, nids);
+			continue;
 		}
-		break;
+
+		if(file_id(sp, ff.achName, id) == FALSE) continue;
+		if(bsearch(id, ids, nids, JNL_IDLEN, id_compare) != NULL)
+			continue;
+		if(recover_file(sp, path, id) == TRUE) added++;
+	} while(DosFindNext(hdir, &ff, sizeof(ff), &count) == 0);
+	(VOID) DosFindClose(hdir);
+
+	return(added);
+}
+
+
+/*
+ * Add a journal record for the mail file 'rel' (relative to the spool
+ * directory described by 'sp'), with mail ID 'id'. The sender and
+ * number of recipients are taken from the envelope at the start of the
+ * file. The journal semaphore must be held.
+ *
+ * Returns:
+ *	TRUE		record added
+ *	FALSE		file incomplete or unreadable, or journal write failed
+ *
+ */
+
+static BOOL recover_file(PSPOOL sp, PUCHAR rel, PUCHAR id)
+{	INT n;
+	PUCHAR p;
+	FILE *fp;
+	struct stat st;
+	JNLREC rec;
+	UCHAR buf[ENVLINE+1];
+
+	sprintf(buf, "%s\\%s", sp->maildir, rel);
+	if(stat(buf, &st) != 0) return(FALSE);
+	fp = fopen(buf, "rb");
+	if(fp == (FILE *) NULL) return(FALSE);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.time = st.st_mtime;
+	rec.size = st.st_size;
+	strcpy(rec.mail_id, id);
+	strncpy(rec.name, rel, JNL_NAMELEN-1);
+
+	/* The first line is "MAIL FROM:<sender> ...", unless the file is
+	   still patched; then come the "RCPT TO:" lines. */
+
+	if(fgets(buf, sizeof(buf), fp) == (PUCHAR) NULL ||
+	   strncmp(buf, temp, PATCHSIZE) == 0) {
+		(VOID) fclose(fp);
+		return(FALSE);
 	}
-	*idptr = mail_id;
+	p = strchr(buf, ':');
+	if(p != (PUCHAR) NULL) {
+		p++;
+		while(*p == ' ') p++;
+		n = strcspn(p, " \r\n");
+		strncpy(rec.sender, p, n < JNL_SENDERLEN ? n : JNL_SENDERLEN-1);
+	}
+	while(fgets(buf, sizeof(buf), fp) != (PUCHAR) NULL &&
+	      strnicmp(buf, "RCPT", 4) == 0)
+		rec.rcpts++;
+	(VOID) fclose(fp);
 
-	mailfp = fdopen(fd, "w");
-	if(mailfp == (FILE *) NULL) return(FALSE);
+	rec.check = jnl_check(&rec);
+	(VOID) lseek(sp->journal, 0L, SEEK_END);
 
-	first_line_seen = FALSE;
-	return(TRUE);
+	return(write(sp->journal, &rec, JNL_RECSIZE) == JNL_RECSIZE ?
+		TRUE : FALSE);
 }
 
 
 /*
- * Close and store a completed mail message, and commit the file for
- * onward transmissiom.
+ * Compare the mail IDs at 'a' and 'b', for qsort() and bsearch().
  *
  * Returns:
- *	TRUE		message stored OK
- *	FALSE		message storage failed
+ *	<0, 0 or >0 as for strcmp()
+ *
+ */
+
+static INT _Optlink id_compare(const VOID *a, const VOID *b)
+{	return(strcmp((PUCHAR) a, (PUCHAR) b));
+}
+
+
+/*
+ * Open the segments of the spool directory described by 'sp'; from now
+ * on, messages small enough to fit in a session's output buffer are
+ * added to the current segment, instead of each having a mail file.
+ * If there are segments already, adding carries on after the last
+ * complete record in the newest one, unless that was made with a
+ * different size, when a new one is started. Segments whose messages
+ * have all been sent are deleted.
+ *
+ * Returns:
+ *	TRUE		segments ready
+ *	FALSE		segments could not be opened
  *
  */
 
-BOOL mail_close(VOID)
-{	INT p, rc;
-	UCHAR temp[CCHMAXPATH+1];
+BOOL mail_segments(PSPOOL sp)
+{	HDIR hdir = HDIR_CREATE;
+	ULONG count = 1;
+	ULONG n, first = 0xFFFFFFFFUL, last = 0;
+	INT fd;
+	PUCHAR buf, end;
+	SEGHDR hdr;
+	FILEFINDBUF3 ff;
+	UCHAR path[CCHMAXPATH+1];
 
-	if(mailfp != (FILE *) NULL) {
-		(VOID) fflush(mailfp);
+	if(DosCreateMutexSem((PSZ) NULL, &sp->seglock, 0, FALSE) != 0)
+		return(FALSE);
 
-		/* Restore the patched characters at the start of the file,
-		   thus indicating that the file is legal and complete. */
+	sprintf(path, "%s\\%s", sp->maildir, SEG_FILES);
+	if(DosFindFirst(
+			path,
+			&hdir,
+			FILE_NORMAL,
+			&ff,
+			sizeof(ff),
+			&count,
+			FIL_STANDARD) == 0) {
+		do {
+			n = strtoul(ff.achName, (char **) &end, 16);
+			if(end != (PUCHAR) &ff.achName[8]) continue;
+			if(n < first) first = n;
+			if(n > last) last = n;
+		} while(DosFindNext(hdir, &ff, sizeof(ff), &count) == 0);
+		(VOID) DosFindClose(hdir);
+	}
+	sp->segfirst = last == 0 ? 1 : first;
+	sp->segnum = last;
 
-		rc = fseek(mailfp, 0L, SEEK_SET);
-		if(rc == 0) {
-			rc = fwrite(save_temp, PATCHSIZE, 1, mailfp);
-			rc = (rc == 1) ? 0 : 1;
+	if(last != 0) {
+		seg_name(path, sp->maildir, last);
+		fd = open(path, O_RDWR | O_BINARY);
+		if(fd != -1 &&
+		   read(fd, &hdr, SEG_HDRSIZE) == SEG_HDRSIZE &&
+		   hdr.magic == SEG_MAGIC &&
+		   hdr.version == SEG_VERSION &&
+		   hdr.size == sp->segsize &&
+		   (buf = malloc(SEG_MAXDATA)) != (PUCHAR) NULL) {
+			sp->segtail = segment_scan(fd, buf, (PBOOL) NULL);
+			free(buf);
+			sp->segfd = fd;
+		} else if(fd != -1) {
+			(VOID) close(fd);
 		}
-		if(rc == 0) rc = fclose(mailfp);
-		mailfp = (FILE *) NULL;
-		if(rc != 0) return(FALSE);
 	}
+	if(sp->segfd == -1) return(segment_roll(sp));
 
-#ifdef	SECURITY_LOG
-	strcpy(temp, SECURITY_LOG);
-	strcat(temp, "S_");
-	strcat(temp, mailfile);
-	(void) DosCopy(mailfile, temp, 0L);
-#endif
+	segment_reclaim(sp);
 
 	return(TRUE);
 }
 
 
 /*
- * Reset state after an incomplete transaction.
- * Simply close and delete any partial mail file.
+ * Set up the mail ID generator. Its state is kept in named shared
+ * memory, so that every SMTPD process on the machine takes IDs from
+ * the same sequence while any of them is running. The shared memory
+ * goes away when the last process ends, which under INETD may be after
+ * every call; so when it is created afresh the sequence starts at the
+ * current time, and id_spool() then moves it past any IDs that earlier
+ * processes gave out.
+ *
+ * Returns:
+ *	TRUE		generator ready
+ *	FALSE		generator could not be set up
  *
  */
 
-VOID mail_reset(VOID)
-{	if(mailfp != (FILE *) NULL) {
-		(VOID) fclose(mailfp);
-		(VOID) remove(mailfile);	/* Ignore failure */
+static BOOL id_init(VOID)
+{	APIRET rc;
+	INT i;
+	time_t tod;
+
+	for(i = 0; i < 2; i++) {	/* Once more if creation raced */
+		rc = DosCreateMutexSem(IDSEM, &idsem, 0, FALSE);
+		if(rc == ERROR_DUPLICATE_NAME)
+			rc = DosOpenMutexSem(IDSEM, &idsem);
+		if(rc == 0) break;
+	}
+	if(rc != 0) return(FALSE);
+
+	(VOID) DosRequestMutexSem(idsem, SEM_INDEFINITE_WAIT);
+	rc = DosGetNamedSharedMem(
+		(PPVOID) &ids,
+		IDMEM,
+		PAG_READ | PAG_WRITE);
+	if(rc != 0) {
+		rc = DosAllocSharedMem(
+			(PPVOID) &ids,
+			IDMEM,
+			sizeof(IDSTATE),
+			PAG_COMMIT | PAG_READ | PAG_WRITE);
+		if(rc == 0) {
+			(VOID) time(&tod);
+			ids->time = tod - IDEPOCH;
+			ids->seq = 0;
+		}
+	}
+	(VOID) DosReleaseMutexSem(idsem);
+
+	if(rc != 0) {
+		ids = (PIDSTATE) NULL;
+		return(FALSE);
 	}
+
+	return(TRUE);
 }
 
 
 /*
- * Store a line of mail text for future use.
+ * Open the mail ID file in the spool directory described by 'sp'. This
+ * holds a limit below which all IDs given out for this directory lie;
+ * the shared sequence is moved up to it, if it is not there already,
+ * so that no ID is given out twice even if no other SMTPD process is
+ * running.
  *
  * Returns:
- *	TRUE		line stored OK
- *	FALSE		line storage failed
+ *	TRUE		ID file ready
+ *	FALSE		ID file cannot be used
  *
  */
 
-BOOL mail_store(PUCHAR buf)
-{	/* First line is treated specially. The first four characters
-	   (usually "MAIL") are replaced by "TEMP", the original contents
-	   being saved for replacement when the mail file is closed and
-	   committed for transmission. Partial files thus look illegal
-	   to the transmission software, and will not be processed. */
+static BOOL id_spool(PSPOOL sp)
+{	UCHAR path[CCHMAXPATH+1];
 
-	if(first_line_seen == FALSE) {
-#ifdef	DEBUG
-		if(strlen(buf) < PATCHSIZE) {
-			fprintf(stderr, "first mail line too short\n");
-			abort();
+	sprintf(path, "%s\\%s", sp->maildir, IDFILE);
+	sp->idfd = open(path, O_CREAT | O_RDWR | O_BINARY, S_IREAD | S_IWRITE);
+	if(sp->idfd == -1) return(FALSE);
+
+	(VOID) DosRequestMutexSem(idsem, SEM_INDEFINITE_WAIT);
+	if(read(sp->idfd, &sp->idlimit, sizeof(IDSTATE)) != sizeof(IDSTATE))
+		memset(&sp->idlimit, 0, sizeof(IDSTATE));	/* New file */
+	if(sp->idlimit.time > ids->time ||
+	   (sp->idlimit.time == ids->time && sp->idlimit.seq > ids->seq))
+		*ids = sp->idlimit;
+	(VOID) DosReleaseMutexSem(idsem);
+
+	return(TRUE);
+}
+
+
+/*
+ * Generate a new mail ID, for the spool directory described by 'sp',
+ * into 'id'. The ID is the time (in seconds since IDEPOCH) followed by
+ * a sequence number within that second, both as fixed width base 36
+ * numbers, so that IDs sort into the order in which they were given
+ * out. If the sequence for a second runs out, IDs are borrowed from the
+ * next second.
+ *
+ * The same ID is never given out twice, within a process or across
+ * processes, so there is no need to look for an unused one. Processes
+ * running at the same time share the sequence; to carry it on to later
+ * ones, the ID file records a limit a few IDs ahead of the last given
+ * out, so that it need only be written once every IDRESERVE IDs, or
+ * once a second. If the limit cannot be recorded, it does not matter
+ * to this process, and a later one finds any clash when it creates the
+ * mail file.
+ *
+ */
+
+static VOID new_id(PSPOOL sp, PUCHAR id)
+{	static UCHAR digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	INT i;
+	ULONG t, seq;
+	time_t tod;
+
+	(VOID) time(&tod);
+	t = tod - IDEPOCH;
+
+	(VOID) DosRequestMutexSem(idsem, SEM_INDEFINITE_WAIT);
+	if(t > ids->time) {		/* New second */
+		ids->time = t;
+		ids->seq = 0;
+	}
+	t = ids->time;
+	seq = ids->seq;
+	if(++ids->seq == IDSEQMAX) {	/* Run out; move to next second */
+		ids->time++;
+		ids->seq = 0;
+	}
+	if(t > sp->idlimit.time ||
+	   (t == sp->idlimit.time && seq >= sp->idlimit.seq)) {
+		sp->idlimit.time = t;
+		sp->idlimit.seq = seq + IDRESERVE;
+		if(sp->idlimit.seq >= IDSEQMAX) {
+			sp->idlimit.time++;
+			sp->idlimit.seq = 0;
 		}
+		if(lseek(sp->idfd, 0L, SEEK_SET) != 0L ||
+		   write(sp->idfd, &sp->idlimit, sizeof(IDSTATE)) !=
+							sizeof(IDSTATE)) {
+#ifdef	DEBUG
+			trace("cannot record mail ID limit\n");
 #endif
-		strncpy(save_temp, buf, PATCHSIZE);
-		strncpy(buf, temp, PATCHSIZE);
-		first_line_seen = TRUE;
+		}
+	}
+	(VOID) DosReleaseMutexSem(idsem);
+
+	for(i = IDTIMELEN - 1; i >= 0; i--) {
+		id[i] = digits[t % 36];
+		t /= 36;
+	}
+	for(i = MAXMAILID - 1; i >= IDTIMELEN; i--) {
+		id[i] = digits[seq % 36];
+		seq /= 36;
 	}
+	id[MAXMAILID] = '\0';
+}
 
-	if(fputs(buf, mailfp) == EOF) return(FALSE);
 
-	return(TRUE);
+/*
+ * Build into 'path' the name of the directory, within the spool
+ * directory described by 'sp', that holds the mail file for the mail ID
+ * 'id'; it ends in '\'. If the spool directory is sharded, this is a
+ * chain of subdirectories, one for each level, named by successive
+ * bytes of a hash of the ID (as two hex digits). Consecutive IDs thus
+ * go to different subdirectories, and no directory holds more than a
+ * small part of the spool.
+ *
+ * Returns:
+ *	pointer to the end of the directory name in 'path'
+ *
+ */
+
+static PUCHAR shard_dir(PSPOOL sp, PUCHAR id, PUCHAR path)
+{	static UCHAR digits[] = "0123456789abcdef";
+	INT i;
+	ULONG hash = 2166136261UL;	/* FNV-1a */
+	PUCHAR p;
+
+	for(p = id; *p != '\0'; p++)
+		hash = (hash ^ *p) * 16777619UL;
+
+	p = path + sprintf(path, "%s\\", sp->maildir);
+	for(i = 0; i < sp->shards; i++) {
+		*p++ = digits[(hash >> 4) & 0xf];
+		*p++ = digits[hash & 0xf];
+		*p++ = '\\';
+		hash >>= 8;
+	}
+	*p = '\0';
+
+	return(p);
+}
+
+
+/*
+ * Create the subdirectories named in 'path' below the spool directory
+ * described by 'sp', up to the filename at 'name'. Those that already
+ * exist are left alone; any other failure will show up when the file
+ * is created.
+ *
+ */
+
+static VOID make_shard(PSPOOL sp, PUCHAR path, PUCHAR name)
+{	PUCHAR p;
+
+	for(p = path + strlen(sp->maildir) + 1; p < name; p++) {
+		if(*p != '\\') continue;
+		*p = '\0';
+		(VOID) DosCreateDir(path, (PEAOP2) NULL);
+		*p = '\\';
+	}
+}
+
+
+/*
+ * Initialise the mail storage state for a new session, which will store
+ * its messages in the spool directory described by 'sp'.
+ *
+ */
+
+VOID mail_setup(PMAILSTOR mp, PSPOOL sp)
+{	mp->spool = sp;
+	mp->mailfd = -1;
+	mp->auditfd = -1;
+	mp->buf = (PUCHAR) NULL;
+	mp->buflen = 0;
+	mp->first_line_seen = FALSE;
+	mp->nl = TRUE;
+	mp->segment = FALSE;
+	mp->mailfile[0] = '\0';
+	mp->mailname = mp->mailfile;
+	mp->workfile = mp->mailfile;
+	mp->mail_id[0] = '\0';
+}
+
+
+/*
+ * Finish with the mail storage state for a session; any partial mail
+ * file is deleted, and the output buffer is released.
+ *
+ */
+
+VOID mail_end(PMAILSTOR mp)
+{	mail_reset(mp);
+
+	if(mp->buf != (PUCHAR) NULL) {
+		(VOID) DosFreeMem(mp->buf);
+		mp->buf = (PUCHAR) NULL;
+	}
+}
+
+
+/*
+ * Function to determine the type of file system on the drive specified
+ * in 'path'.
+ *
+ * Returns:
+ *	 FS_CDFS, FS_NFS, FS_FAT, FS_HPFS or FS_JFS.
+ *
+ * Any error causes the result to default to FS_FAT.
+ *
+ */
+
+static FSTYPE fstype(PUCHAR path)
+{	ULONG drive, dummy;
+	ULONG fsqbuflen = FSQBUFSIZE;
+	UCHAR fsqbuf[FSQBUFSIZE];
+	PUCHAR p;
+	UCHAR drv[3];
+
+	if(path[1] != ':') {		/* No drive in path - use default */
+		(VOID) DosQueryCurrentDisk(&drive, &dummy);
+		drv[0] = drive + 'a' - 1;
+	} else {
+		drv[0] = path[0];
+	}
+	drv[1] = ':';
+	drv[2] = '\0';
+
+	if(DosQueryFSAttach(
+			drv,
+			0L,
+			FSAIL_QUERYNAME,
+			(PFSQBUFFER2) fsqbuf,
+			&fsqbuflen) != 0)
+		return(FS_FAT);
+
+	/* Set 'p' to point to the file system name */
+
+	p = fsqbuf + sizeof(USHORT);	/* Point past device type */
+	p += (USHORT) *p + 3*sizeof(USHORT) + 1;
+					/* Point past drive name and FS name */
+					/* and FSDA length */
+
+	if(strcmp(p, "CDFS") == 0) return(FS_CDFS);
+	if(strcmp(p, "HPFS") == 0) return(FS_HPFS);
+	if(strcmp(p, "NFS") == 0) return(FS_NFS);
+	if(strcmp(p, "JFS") == 0) return(FS_JFS);
+
+	return(FS_FAT);
+}
+
+
+/*
+ * Check whether a message of 'size' bytes (as announced by the client;
+ * zero if not known) can be accepted, both against the size limit for
+ * the spool directory and against the free space on its drive.
+ *
+ * Returns:
+ *	MAILSIZE_OK		message can be accepted
+ *	MAILSIZE_TOOBIG		message exceeds size limit
+ *	MAILSIZE_NOSPACE	not enough free space for message
+ *
+ */
+
+INT mail_check(PMAILSTOR mp, ULONG size)
+{	ULONG drive;
+	double avail;
+	FSALLOCATE fsa;
+	PSPOOL sp = mp->spool;
+
+	if(sp->maxsize != 0 && size > sp->maxsize) return(MAILSIZE_TOOBIG);
+
+	drive = sp->maildir[1] == ':' ? toupper(sp->maildir[0]) - 'A' + 1 : 0;
+	if(DosQueryFSInfo(drive, FSIL_ALLOC, &fsa, sizeof(fsa)) != 0)
+		return(MAILSIZE_OK);	/* Assume there is room */
+
+	avail = (double) fsa.cUnitAvail * fsa.cSectorUnit * fsa.cbSector;
+	if(avail < (double) size + SPACE_RESERVE) return(MAILSIZE_NOSPACE);
+
+	return(MAILSIZE_OK);
+}
+
+
+/*
+ * Set up for storage of a new mail message, from the sender at the
+ * start of 'sender' (as given in the MAIL command).
+ * 'idptr' points to a pointer to be set to the message ID allocated.
+ * If the size of the message is known in advance ('size' non-zero),
+ * the space for a large message is allocated at once, so that the file
+ * system can keep it in one piece.
+ *
+ * If the spool directory uses commit by renaming, the message is written
+ * under a temporary name (xxxxxxxxx.tmp or xxxxxxxx.xtp), which the
+ * transmission software ignores, and renamed when complete.
+ *
+ * If the spool directory is sharded, the file goes into the
+ * subdirectory chosen by its mail ID (see shard_dir()), which is
+ * created when its first message arrives.
+ *
+ * If the spool directory has segments, no file is created yet; the
+ * message is kept in the output buffer, and added to the current
+ * segment when complete (see segment_add()). Only if it outgrows the
+ * buffer, or is announced as too big for it, does it get a mail file
+ * after all.
+ *
+ * The file is written through a large buffer of the session's own,
+ * allocated here the first time it is needed and kept until mail_end()
+ * is called. It is allocated as whole pages, so that the file system
+ * can copy from it efficiently.
+ *
+ * Returns:
+ *	TRUE		storage set up OK
+ *	FALSE		storage set up failed
+ *
+ */
+
+BOOL mail_open(PMAILSTOR mp, PUCHAR *idptr, ULONG size, PUCHAR sender)
+{	INT fd, tries, len;
+	PUCHAR p;
+	FILESTATUS3 fs;
+	FSTYPE fst = mp->spool->fstype;
+
+	if(mp->buf == (PUCHAR) NULL) {
+		if(DosAllocMem(
+			(PPVOID) &mp->buf,
+			MAILBUFSIZE,
+			PAG_COMMIT | PAG_READ | PAG_WRITE) != 0) {
+			mp->buf = (PUCHAR) NULL;
+			return(FALSE);
+		}
+	}
+
+	/* Generate a unique mail ID and thus mail filename. The
+	   derivation of the filename depends on whether long filenames
+	   are permitted in the mail directory. The ID generator never
+	   repeats itself, but the file is still created exclusively, in
+	   case the ID file could not be written or has been lost; another
+	   ID is then tried. */
+
+	mp->segment = mp->spool->segsize != 0 &&
+		      (size == 0 || size + PREALLOC_SLACK <= MAILBUFSIZE) ?
+			TRUE : FALSE;
+	fd = -1;
+	for(tries = 1; ; tries++) {
+		new_id(mp->spool, mp->mail_id);
+		mp->mailname = shard_dir(mp->spool, mp->mail_id, mp->mailfile);
+		if((fst == FS_HPFS) || (fst == FS_JFS)) {
+						/* xxxxxxxxx.mail */
+			sprintf(mp->mailname, "%s.mail", mp->mail_id);
+		} else {			/* xxxxxxxx.xml */
+			mp->mailname[0] = '\0';
+			strncat(mp->mailname, mp->mail_id, 8);
+			strcat(mp->mailname, ".");
+			strcat(mp->mailname, &mp->mail_id[8]);
+			strcat(mp->mailname, "ml");
+		}
+		mp->workfile = mp->mailfile;
+		if(mp->spool->rename == TRUE) {
+			strcpy(mp->tempfile, mp->mailfile);
+			p = strrchr(mp->tempfile, '.');
+			if((fst == FS_HPFS) || (fst == FS_JFS))
+				strcpy(p, ".tmp");
+			else
+				strcpy(p + 2, "tp");
+			mp->workfile = mp->tempfile;
+		}
+		if(mp->segment == TRUE) break;
+
+		fd = create_file(mp);
+
+		/* When committing by renaming, the proper name must be
+		   free too, or the rename would fail once the whole message
+		   had been received */
+
+		if(fd != -1 && mp->spool->rename == TRUE &&
+		   DosQueryPathInfo(mp->mailfile, FIL_STANDARD, &fs,
+				sizeof(fs)) == 0) {
+			(VOID) close(fd);
+			(VOID) remove(mp->workfile);
+			fd = -1;
+			errno = EEXIST;
+		}
+		if(fd == -1) {
+			if(errno == EEXIST) {
+#ifdef	DEBUG
+				trace("mail file exists\n");
+#endif
+				if(tries == IDTRIES) return(FALSE);
+				continue;
+			}
+			return(FALSE);		/* Some other error */
+		}
+		break;
+	}
+	*idptr = mp->mail_id;
+
+	mp->prealloc = FALSE;
+	if(size >= PREALLOC_MIN && chsize(fd, size + PREALLOC_SLACK) == 0)
+		mp->prealloc = TRUE;
+
+	/* The file is written in binary mode, so that message text
+	   received in chunks (BDAT) can be stored exactly as it arrives;
+	   mail_store() adds the carriage return to each line itself. */
+
+	mp->mailfd = fd;
+	mp->buflen = 0;
+	mp->filesize = 0;
+	mp->first_line_seen = FALSE;
+	mp->nl = TRUE;
+
+	/* Keep the sender for the spool index */
+
+	while(*sender == ' ') sender++;
+	len = strcspn(sender, " \r\n");
+	if(len > MAXSENDER) len = MAXSENDER;
+	memcpy(mp->sender, sender, len);
+	mp->sender[len] = '\0';
+
+	audit_open(mp);
+	return(TRUE);
+}
+
+
+/*
+ * Create the mail file (or temporary file) named in 'mp', exclusively.
+ * If the spool directory is sharded, its subdirectory is created if
+ * need be.
+ *
+ * Returns:
+ *	handle of new file
+ *	-1 if it cannot be created; 'errno' says why
+ *
+ */
+
+static INT create_file(PMAILSTOR mp)
+{	INT fd;
+
+#ifdef	DEBUG
+	trace("creating mail file \"%s\"\n", mp->workfile);
+#endif
+	fd = open(mp->workfile,
+		  O_CREAT | O_EXCL | O_WRONLY | O_BINARY,
+		  S_IREAD | S_IWRITE);
+	if(fd == -1 && errno == ENOENT && mp->spool->shards != 0) {
+		make_shard(mp->spool, mp->mailfile, mp->mailname);
+		fd = open(mp->workfile,
+			  O_CREAT | O_EXCL | O_WRONLY | O_BINARY,
+			  S_IREAD | S_IWRITE);
+	}
+
+	return(fd);
+}
+
+
+/*
+ * Finish storing a completed mail message. All of the message is
+ * written out, but the file is left open, so that it can be flushed
+ * to disk (see sync.c) before mail_close() commits it. If this fails,
+ * the file is deleted.
+ *
+ * Returns:
+ *	TRUE		message stored OK
+ *	FALSE		message storage failed
+ *
+ */
+
+BOOL mail_finish(PMAILSTOR mp)
+{	INT rc = 0;
+
+	if(mp->mailfd == -1 && mp->segment == FALSE) return(TRUE);
+
+	if(mp->nl == FALSE)		/* Complete the last line */
+		if(put(mp, "\r\n", 2) == FALSE) rc = 1;
+
+	/* A message still in the output buffer goes into a segment, with
+	   its first line restored there; the security log copy is written
+	   from the buffer at the same time. The segment is left as the
+	   file to be flushed. */
+
+	if(rc == 0 && mp->segment == TRUE) {
+		if(mp->first_line_seen == TRUE)
+			memcpy(mp->buf, mp->save_temp, PATCHSIZE);
+		if(mp->auditfd != -1 &&
+		   write(mp->auditfd, mp->buf, mp->buflen) != mp->buflen)
+			audit_close(mp, FALSE);
+		mp->filesize = mp->buflen;
+		mp->mailfd = segment_add(mp);
+		mp->buflen = 0;
+		if(mp->mailfd == -1) {
+			mail_reset(mp);
+			return(FALSE);
+		}
+		return(TRUE);
+	}
+
+	if(rc == 0 && flush_file(mp) == FALSE) rc = 1;
+
+	/* Give back any preallocated space not used */
+
+	if(rc == 0 && mp->prealloc == TRUE)
+		rc = chsize(mp->mailfd, mp->filesize);
+
+	/* Restore the patched characters at the start of the file,
+	   thus indicating that the file is legal and complete. */
+
+	if(mp->spool->rename == FALSE) {
+		if(rc == 0 && lseek(mp->mailfd, 0L, SEEK_SET) != 0)
+			rc = 1;
+		if(rc == 0 &&
+		   write(mp->mailfd, mp->save_temp, PATCHSIZE) != PATCHSIZE)
+			rc = 1;
+		if(rc == 0 && mp->auditfd != -1 &&
+		   (lseek(mp->auditfd, 0L, SEEK_SET) != 0 ||
+		    write(mp->auditfd, mp->save_temp, PATCHSIZE) != PATCHSIZE))
+			audit_close(mp, FALSE);
+	}
+
+	if(rc != 0) {
+		mail_reset(mp);
+		return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Close a mail message stored by mail_finish(), and commit the file for
+ * onward transmissiom. Depending on the spool directory, either the
+ * file is already committed, by the patch restored at its start, or it
+ * is renamed here to its proper name in one step; the second way does
+ * not rewrite the start of the file, and a partial file never has a
+ * name the transmission software recognises. The message, which had
+ * 'rcpts' recipients, is then added to the spool index, if there is
+ * one. A message stored in a segment is already committed, and is not
+ * listed in the index; segments list their own messages.
+ *
+ * Returns:
+ *	TRUE		message stored OK
+ *	FALSE		message storage failed
+ *
+ */
+
+BOOL mail_close(PMAILSTOR mp, INT rcpts)
+{	INT rc = 0;
+	APIRET mrc;
+	UCHAR mes[MAXLOG+1];
+
+	if(mp->segment == TRUE) {	/* Segment handle is not ours */
+		mp->mailfd = -1;
+		mp->segment = FALSE;
+	} else if(mp->mailfd != -1) {
+		if(close(mp->mailfd) != 0) rc = 1;
+		mp->mailfd = -1;
+
+		/* If committing by renaming, give the file its proper
+		   name */
+
+		if(rc == 0 && mp->spool->rename == TRUE) {
+			mrc = DosMove(mp->tempfile, mp->mailfile);
+			if(mrc != 0) {
+				sprintf(mes,
+					"cannot rename mail file to %s, "
+					"rc = %lu",
+					mp->mailname, mrc);
+				dolog(LOG_ERR, mes);
+				rc = 1;
+			}
+		}
+		if(rc != 0) {
+			(VOID) remove(mp->workfile);
+			audit_close(mp, FALSE);
+			return(FALSE);
+		}
+		index_add(mp, rcpts);
+	}
+
+	audit_close(mp, TRUE);
+
+	return(TRUE);
+}
+
+
+/*
+ * Add a record for the message just committed in 'mp', which had
+ * 'rcpts' recipients, to the index journal of its spool directory, if
+ * it has one. If the journal has grown to twice the size it had after
+ * it was last compacted, it is compacted again. Any program waiting
+ * for new records (see jnl_wait()) is woken. Failure is ignored; the
+ * message has already been committed, and the record will be added
+ * when the journal is next recovered.
+ *
+ */
+
+static VOID index_add(PMAILSTOR mp, INT rcpts)
+{	LONG end;
+	BOOL ok = FALSE;
+	time_t tod;
+	JNLHDR hdr;
+	JNLREC rec;
+	PSPOOL sp = mp->spool;
+
+	if(sp->journal == -1) return;
+
+	memset(&rec, 0, sizeof(rec));
+	(VOID) time(&tod);
+	rec.time = tod;
+	rec.size = mp->filesize;
+	rec.rcpts = rcpts;
+	strcpy(rec.mail_id, mp->mail_id);
+	strncpy(rec.name, mp->mailfile + strlen(sp->maildir) + 1,
+		JNL_NAMELEN-1);
+	strncpy(rec.sender, mp->sender, JNL_SENDERLEN-1);
+	rec.check = jnl_check(&rec);
+
+	(VOID) DosRequestMutexSem(jnlsem, SEM_INDEFINITE_WAIT);
+	end = lseek(sp->journal, 0L, SEEK_END);
+	end -= end % JNL_RECSIZE;	/* Overwrite any partial record */
+	if(lseek(sp->journal, end, SEEK_SET) != end ||
+	   write(sp->journal, &rec, JNL_RECSIZE) != JNL_RECSIZE) {
+		(VOID) chsize(sp->journal, end);
+#ifdef	DEBUG
+		trace("cannot add \"%s\" to spool index\n", rec.name);
+#endif
+	} else {
+		ok = TRUE;
+		if(end/JNL_RECSIZE >= JNL_COMPACTMIN &&
+		   jnl_header(sp->journal, &hdr) == TRUE &&
+		   end/JNL_RECSIZE >= 2*hdr.live)
+			index_compact(sp);
+	}
+	(VOID) DosReleaseMutexSem(jnlsem);
+
+	if(ok == TRUE) (VOID) DosPostEventSem(jnlevent);
+}
+
+
+/*
+ * Compact the index journal of the spool directory described by 'sp',
+ * removing records of mail files that no longer exist (usually because
+ * they have been sent). This is done in place, so that readers can keep
+ * the journal open; its generation is changed first, so that they will
+ * start reading again from the beginning. The journal semaphore must be
+ * held.
+ *
+ */
+
+static VOID index_compact(PSPOOL sp)
+{	INT i, n, kept;
+	LONG in, out, end;
+	JNLHDR hdr;
+	FILESTATUS3 fs;
+	UCHAR path[CCHMAXPATH+1];
+
+	if(jnl_header(sp->journal, &hdr) == FALSE) return;
+	hdr.generation++;
+	if(lseek(sp->journal, 0L, SEEK_SET) != 0 ||
+	   write(sp->journal, &hdr, JNL_RECSIZE) != JNL_RECSIZE)
+		return;
+
+	end = lseek(sp->journal, 0L, SEEK_END);
+	for(in = out = JNL_RECSIZE; in < end; in += n*JNL_RECSIZE) {
+		if(lseek(sp->journal, in, SEEK_SET) != in) return;
+		n = read(sp->journal, jnlbuf, sizeof(jnlbuf))/JNL_RECSIZE;
+		if(n <= 0) break;
+
+		for(i = kept = 0; i < n; i++) {
+			if(jnl_check(&jnlbuf[i]) != jnlbuf[i].check) continue;
+			sprintf(path, "%s\\%s", sp->maildir, jnlbuf[i].name);
+			if(DosQueryPathInfo(path, FIL_STANDARD, &fs,
+					sizeof(fs)) != 0)
+				continue;
+			if(kept != i) jnlbuf[kept] = jnlbuf[i];
+			kept++;
+		}
+
+		/* Records only ever move towards the start of the file, so
+		   none is overwritten before it has been read. */
+
+		if(kept != 0 && (out != in || kept != n)) {
+			if(lseek(sp->journal, out, SEEK_SET) != out ||
+			   write(sp->journal, jnlbuf, kept*JNL_RECSIZE) !=
+			   kept*JNL_RECSIZE)
+				return;
+		}
+		out += kept*JNL_RECSIZE;
+	}
+
+	hdr.live = out/JNL_RECSIZE - 1;
+	if(chsize(sp->journal, out) == 0 &&
+	   lseek(sp->journal, 0L, SEEK_SET) == 0)
+		(VOID) write(sp->journal, &hdr, JNL_RECSIZE);
+}
+
+
+/*
+ * Add the complete message in the output buffer of 'mp' to the current
+ * segment of its spool directory, starting a new segment if there is
+ * not room in this one. The record header and the message are written
+ * separately; until both are there, the checksum in the header is
+ * wrong, and readers do not see the record.
+ *
+ * Returns:
+ *	handle of the segment, for flushing to disk
+ *	-1 if the message could not be added
+ *
+ */
+
+static INT segment_add(PMAILSTOR mp)
+{	INT fd = -1;
+	LONG off;
+	ULONG reclen;
+	time_t tod;
+	SEGREC rec;
+	PSPOOL sp = mp->spool;
+
+	memset(&rec, 0, sizeof(rec));
+	(VOID) time(&tod);
+	rec.magic = SEG_RECMAGIC;
+	rec.length = mp->buflen;
+	rec.time = tod;
+	strcpy(rec.mail_id, mp->mail_id);
+	rec.state = SEG_LIVE;
+	rec.check = seg_check(&rec, mp->buf);
+	reclen = SEG_ROUND(SEG_RECSIZE + rec.length);
+
+	(VOID) DosRequestMutexSem(sp->seglock, SEM_INDEFINITE_WAIT);
+	if((sp->segfd != -1 && sp->segtail + reclen <= sp->segsize) ||
+	   segment_roll(sp) == TRUE) {
+		off = sp->segtail;
+		if(lseek(sp->segfd, off, SEEK_SET) == off &&
+		   write(sp->segfd, &rec, SEG_RECSIZE) == SEG_RECSIZE &&
+		   write(sp->segfd, mp->buf, mp->buflen) == mp->buflen) {
+			fd = sp->segfd;
+			sp->segtail += reclen;
+			mp->segnum = sp->segnum;
+			mp->segoff = off;
+		}
+	}
+	(VOID) DosReleaseMutexSem(sp->seglock);
+
+#ifdef	DEBUG
+	if(fd == -1) trace("cannot add message to segment\n");
+#endif
+	return(fd);
+}
+
+
+/*
+ * Mark the message stored in a segment by 'mp' as done, because it has
+ * not been accepted after all (for example, because it could not be
+ * flushed to disk).
+ *
+ */
+
+static VOID segment_cancel(PMAILSTOR mp)
+{	static UCHAR done = SEG_DONE;
+	INT fd;
+	LONG off;
+	PSPOOL sp = mp->spool;
+	UCHAR path[CCHMAXPATH+1];
+
+	off = mp->segoff + offsetof(SEGREC, state);
+
+	(VOID) DosRequestMutexSem(sp->seglock, SEM_INDEFINITE_WAIT);
+	if(mp->segnum == sp->segnum) {
+		fd = sp->segfd;
+	} else if(mp->segnum == sp->segnum - 1) {
+		fd = sp->oldfd;
+	} else {
+		seg_name(path, sp->maildir, mp->segnum);
+		fd = open(path, O_WRONLY | O_BINARY);
+	}
+	if(fd != -1 && lseek(fd, off, SEEK_SET) == off)
+		(VOID) write(fd, &done, 1);
+	if(fd != -1 && fd != sp->segfd && fd != sp->oldfd)
+		(VOID) close(fd);
+	(VOID) DosReleaseMutexSem(sp->seglock);
+}
+
+
+/*
+ * Start a new segment in the spool directory described by 'sp'. Its
+ * space is allocated in full at once. The previous segment is kept
+ * open until the next one is started, so that messages just added to
+ * it can still be flushed to disk; readers know that it is finished
+ * when they see the new one. The segment lock must be held (or the
+ * segments not yet be in use).
+ *
+ * Returns:
+ *	TRUE		new segment started
+ *	FALSE		new segment could not be created
+ *
+ */
+
+static BOOL segment_roll(PSPOOL sp)
+{	INT fd;
+	SEGHDR hdr;
+	UCHAR path[CCHMAXPATH+1];
+
+	if(sp->oldfd != -1) (VOID) close(sp->oldfd);
+	sp->oldfd = sp->segfd;
+	sp->segfd = -1;
+
+	seg_name(path, sp->maildir, sp->segnum + 1);
+	fd = open(path,
+		  O_CREAT | O_TRUNC | O_RDWR | O_BINARY,
+		  S_IREAD | S_IWRITE);
+	if(fd == -1) return(FALSE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SEG_MAGIC;
+	hdr.version = SEG_VERSION;
+	hdr.number = sp->segnum + 1;
+	hdr.size = sp->segsize;
+	if(chsize(fd, sp->segsize) != 0 ||
+	   lseek(fd, 0L, SEEK_SET) != 0 ||
+	   write(fd, &hdr, SEG_HDRSIZE) != SEG_HDRSIZE) {
+		(VOID) close(fd);
+		(VOID) remove(path);
+		return(FALSE);
+	}
+
+	sp->segfd = fd;
+	sp->segnum++;
+	sp->segtail = SEG_HDRSIZE;
+	segment_reclaim(sp);
+
+	return(TRUE);
+}
+
+
+/*
+ * Delete the oldest segments of the spool directory described by 'sp',
+ * as long as every message in them has been sent. A segment that cannot
+ * be deleted because it is still open (e.g. by a reader) is left until
+ * this is next done. The segment lock must be held (or the segments not
+ * yet be in use).
+ *
+ */
+
+static VOID segment_reclaim(PSPOOL sp)
+{	INT fd;
+	BOOL live;
+	PUCHAR buf;
+	UCHAR path[CCHMAXPATH+1];
+
+	buf = malloc(SEG_MAXDATA);
+	if(buf == (PUCHAR) NULL) return;
+
+	while(sp->segfirst < sp->segnum) {
+		seg_name(path, sp->maildir, sp->segfirst);
+		fd = open(path, O_RDONLY | O_BINARY);
+		if(fd != -1) {
+			live = FALSE;
+			(VOID) segment_scan(fd, buf, &live);
+			(VOID) close(fd);
+			if(live == TRUE || DosDelete(path) != 0) break;
+		} else if(errno != ENOENT) {
+			break;
+		}
+		sp->segfirst++;
+	}
+
+	free(buf);
+}
+
+
+/*
+ * Look through the records of the segment open on handle 'fd', using
+ * 'buf' (SEG_MAXDATA bytes) to check messages. If 'live' is not NULL,
+ * this stops at the first message not yet done, and sets '*live' to
+ * TRUE. The checksums of messages already done are not checked.
+ *
+ * Returns:
+ *	offset just past the last complete record looked at
+ *
+ */
+
+static ULONG segment_scan(INT fd, PUCHAR buf, PBOOL live)
+{	LONG off = SEG_HDRSIZE;
+	SEGREC rec;
+
+	for(;;) {
+		if(lseek(fd, off, SEEK_SET) != off ||
+		   read(fd, &rec, SEG_RECSIZE) != SEG_RECSIZE ||
+		   rec.magic != SEG_RECMAGIC ||
+		   rec.length > SEG_MAXDATA)
+			break;
+		if(rec.state != SEG_DONE &&
+		   (read(fd, buf, rec.length) != (INT) rec.length ||
+		    seg_check(&rec, buf) != rec.check))
+			break;
+		if(rec.state != SEG_DONE && live != (PBOOL) NULL) {
+			*live = TRUE;
+			break;
+		}
+		off += SEG_ROUND(SEG_RECSIZE + rec.length);
+	}
+
+	return(off);
+}
+
+
+/*
+ * Reset state after an incomplete transaction.
+ * Simply close and delete any partial mail file. A message that has
+ * already been added to a segment is marked there as done.
+ *
+ */
+
+VOID mail_reset(PMAILSTOR mp)
+{	if(mp->segment == TRUE) {
+		if(mp->mailfd != -1) segment_cancel(mp);
+		mp->mailfd = -1;
+		mp->segment = FALSE;
+	} else if(mp->mailfd != -1) {
+		(VOID) close(mp->mailfd);
+		(VOID) remove(mp->workfile);	/* Ignore failure */
+		mp->mailfd = -1;
+	}
+	audit_close(mp, FALSE);
+}
+
+
+/*
+ * Store a line of mail text for future use. The newline at the end of
+ * the line is stored as carriage return and linefeed.
+ *
+ * Returns:
+ *	TRUE		line stored OK
+ *	FALSE		line storage failed
+ *
+ */
+
+BOOL mail_store(PMAILSTOR mp, PUCHAR buf)
+{	INT len;
+
+	len = strlen(buf);
+	if(len > 0 && buf[len-1] == '\n') len--;
+	if(put(mp, buf, len) == FALSE) return(FALSE);
+	if(put(mp, "\r\n", 2) == FALSE) return(FALSE);
+	mp->nl = TRUE;
+
+	/* First line is treated specially. The first four characters
+	   (usually "MAIL") are replaced by "TEMP", the original contents
+	   being saved for replacement when the mail file is closed and
+	   committed for transmission. Partial files thus look illegal
+	   to the transmission software, and will not be processed. The
+	   first line is still in the output buffer, so it is patched
+	   there. This is not needed when committing by renaming. */
+
+	if(mp->first_line_seen == FALSE && mp->spool->rename == FALSE) {
+#ifdef	DEBUG
+		if(len < PATCHSIZE || mp->filesize != 0) {
+			fprintf(stderr, "first mail line too short\n");
+			abort();
+		}
+#endif
+		memcpy(mp->save_temp, mp->buf, PATCHSIZE);
+		memcpy(mp->buf, temp, PATCHSIZE);
+		mp->first_line_seen = TRUE;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Store 'len' bytes of raw message text, exactly as received.
+ *
+ * Returns:
+ *	TRUE		text stored OK
+ *	FALSE		text storage failed
+ *
+ */
+
+BOOL mail_write(PMAILSTOR mp, PUCHAR buf, INT len)
+{	if(len == 0) return(TRUE);
+
+	if(put(mp, buf, len) == FALSE) return(FALSE);
+	mp->nl = buf[len-1] == '\n' ? TRUE : FALSE;
+
+	return(TRUE);
+}
+
+
+/*
+ * Add 'len' bytes at 'p' to the mail file output buffer, writing out
+ * the buffer first if there is not room. Anything at least as big as
+ * the buffer is written directly, without being copied. A message
+ * being kept for a segment that will not fit gets a mail file first.
+ *
+ * Returns:
+ *	TRUE		data stored OK
+ *	FALSE		write failed
+ *
+ */
+
+static BOOL put(PMAILSTOR mp, PUCHAR p, INT len)
+{	if(mp->buflen + len > MAILBUFSIZE) {
+		if(mp->segment == TRUE && spill(mp) == FALSE) return(FALSE);
+		if(flush_file(mp) == FALSE) return(FALSE);
+	}
+
+	if(len >= MAILBUFSIZE && mp->segment == FALSE)
+		return(write_file(mp, p, len));
+
+	memcpy(&mp->buf[mp->buflen], p, len);
+	mp->buflen += len;
+
+	return(TRUE);
+}
+
+
+/*
+ * Give the message in 'mp', which was being kept for a segment, a mail
+ * file of its own after all, because it has outgrown the output
+ * buffer. Its mail ID has already been used, so if a file with that
+ * name exists, the message fails.
+ *
+ * Returns:
+ *	TRUE		mail file created
+ *	FALSE		mail file could not be created
+ *
+ */
+
+static BOOL spill(PMAILSTOR mp)
+{	mp->mailfd = create_file(mp);
+	if(mp->mailfd == -1) return(FALSE);
+	mp->segment = FALSE;
+
+	return(TRUE);
+}
+
+
+/*
+ * Write out whatever is in the mail file output buffer.
+ *
+ * Returns:
+ *	TRUE		buffer written OK
+ *	FALSE		write failed
+ *
+ */
+
+static BOOL flush_file(PMAILSTOR mp)
+{	INT len = mp->buflen;
+
+	mp->buflen = 0;
+
+	return(write_file(mp, mp->buf, len));
+}
+
+
+/*
+ * Write 'len' bytes at 'p' to the mail file.
+ *
+ * Returns:
+ *	TRUE		data written OK
+ *	FALSE		write failed
+ *
+ */
+
+static BOOL write_file(PMAILSTOR mp, PUCHAR p, INT len)
+{	INT rc;
+
+	if(mp->auditfd != -1 && write(mp->auditfd, p, len) != len)
+		audit_close(mp, FALSE);
+
+	while(len > 0) {
+		rc = write(mp->mailfd, p, len);
+		if(rc <= 0) return(FALSE);
+		p += rc;
+		len -= rc;
+		mp->filesize += rc;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Start the security log copy of a new mail file, if the spool directory
+ * has a security log. The copy is written alongside the mail file, from
+ * the same output buffer, so that it costs no extra reading; it is named
+ * after the mail file, with 'S_' in front. If the copy cannot be made,
+ * the message is stored anyway.
+ *
+ */
+
+static VOID audit_open(PMAILSTOR mp)
+{	mp->auditfd = -1;
+	if(mp->spool->auditdir[0] == '\0') return;
+
+	sprintf(mp->auditfile, "%sS_%s", mp->spool->auditdir, mp->mailname);
+	mp->auditfd = open(mp->auditfile,
+			   O_CREAT | O_TRUNC | O_WRONLY | O_BINARY,
+			   S_IREAD | S_IWRITE);
+#ifdef	DEBUG
+	if(mp->auditfd == -1)
+		trace("cannot create security log copy \"%s\"\n",
+			mp->auditfile);
+#endif
+}
+
+
+/*
+ * Close the security log copy of the current mail file, if there is one.
+ * If 'keep' is FALSE, the copy is deleted; this is done if the message
+ * is not stored, or if the copy could not be written in full.
+ *
+ */
+
+static VOID audit_close(PMAILSTOR mp, BOOL keep)
+{	if(mp->auditfd == -1) return;
+
+	(VOID) close(mp->auditfd);
+	if(keep == FALSE) (VOID) remove(mp->auditfile);
+	mp->auditfd = -1;
 }
 
 /*
@@ -10,8 +10,30 @@
 /* Miscellaneous constants */
 
 #define	MAXMAILID		9	/* Maximum length of a mail ID */
+#define	MAXSENDER		63	/* Longest sender kept for index */
+#define	IDTIMELEN		6	/* Digits of mail ID giving the time */
+#define	IDSEQMAX		46656	/* Mail IDs per second (36**3) */
+#define	IDEPOCH			946684800L /* Time origin for mail IDs (2000) */
+#define	IDMEM			"\\SHAREMEM\\SMTPD\\MAILID"
+					/* Mail ID state, shared by processes */
+#define	IDSEM			"\\SEM32\\SMTPD\\MAILID"
+					/* Serialises access to mail ID state */
+#define	IDFILE			"SPOOL.ID"
+					/* Limit of mail IDs given out, in
+					   spool directory */
+#define	IDRESERVE		64	/* Mail IDs recorded at a time */
+#define	IDTRIES			10	/* Attempts to create a mail file */
+#define	PATCHSIZE		4	/* Size of first line patch area */
+#define	MAILBUFSIZE		65536	/* Size of mail file output buffer */
+#define	PREALLOC_MIN		65536	/* Smallest message preallocated */
+#define	PREALLOC_SLACK		1024	/* Allowance for envelope and header */
+#define	SPACE_RESERVE		1048576	/* Free space always left in spool */
+#define	MAXSHARDS		3	/* Most levels of spool subdirectories */
 #ifndef	NOLOG
 #define	SECURITY_LOG		"I:\\MPTN\\ETC\\SECURITY\\"
+					/* Default security log directory */
+#else
+#define	SECURITY_LOG		""	/* No security log by default */
 #endif
 
 #define	FALSE			0
@@ -22,14 +44,83 @@
 #define	MAILINIT_OK		0	/* Initialisation successful */
 #define	MAILINIT_NOENV		1	/* Environment variable not set */
 #define	MAILINIT_BADDIR		2	/* Cannot access directory */
+#define	MAILINIT_NOIDS		3	/* Cannot set up mail ID generator */
+
+/* Results from mail_check() */
+
+#define	MAILSIZE_OK		0	/* Message can be accepted */
+#define	MAILSIZE_TOOBIG		1	/* Message exceeds size limit */
+#define	MAILSIZE_NOSPACE	2	/* Not enough free space for message */
+
+/* Type definitions */
+
+typedef	enum	{ FS_CDFS, FS_FAT, FS_HPFS, FS_NFS, FS_JFS }
+	FSTYPE;
+
+/* Structure definitions */
+
+typedef	struct	_IDSTATE {		/* Mail ID generator state */
+ULONG		time;			/* Time part of next ID */
+ULONG		seq;			/* Sequence part of next ID */
+} IDSTATE, *PIDSTATE;
+
+typedef	struct	_SPOOL {		/* Mail spool directory */
+UCHAR		maildir[CCHMAXPATH+1];	/* Directory name, no trailing '\' */
+FSTYPE		fstype;			/* Type of file system holding it */
+ULONG		maxsize;		/* Largest message accepted (0 = any) */
+BOOL		rename;			/* Commit by renaming, not patching */
+PUCHAR		auditdir;		/* Security log directory, or empty */
+INT		shards;			/* Levels of hashed subdirectories */
+INT		journal;		/* Index journal handle, or -1 */
+INT		idfd;			/* Mail ID file handle */
+IDSTATE		idlimit;		/* Limit recorded in it */
+ULONG		segsize;		/* Segment size (bytes), or 0 if none */
+HMTX		seglock;		/* Serialises access to segments */
+INT		segfd;			/* Current segment handle, or -1 */
+INT		oldfd;			/* Previous segment handle, or -1 */
+ULONG		segnum;			/* Number of current segment */
+ULONG		segtail;		/* Where next record goes in it */
+ULONG		segfirst;		/* Oldest segment not yet deleted */
+} SPOOL, *PSPOOL;
+
+typedef	struct	_MAILSTOR {		/* Mail storage state for one session */
+PSPOOL		spool;			/* Spool directory in use */
+INT		mailfd;			/* Current mail file, or -1 */
+INT		auditfd;		/* Security log copy, or -1 */
+PUCHAR		buf;			/* Output buffer, or NULL */
+INT		buflen;			/* Bytes waiting in output buffer */
+ULONG		filesize;		/* Bytes written to mail file */
+BOOL		first_line_seen;	/* First line has been patched */
+BOOL		nl;			/* Text stored so far ends in newline */
+BOOL		prealloc;		/* File space was preallocated */
+BOOL		segment;		/* Message goes in a segment */
+ULONG		segnum;			/* Segment holding it, once stored */
+ULONG		segoff;			/* ...and offset of its record */
+PUCHAR		mailname;		/* Filename part of 'mailfile' */
+UCHAR		mailfile[CCHMAXPATH+1];	/* Full pathname of mail file */
+UCHAR		tempfile[CCHMAXPATH+1];	/* Pathname while being written */
+PUCHAR		workfile;		/* File being written */
+UCHAR		auditfile[CCHMAXPATH+1];/* Pathname of security log copy */
+UCHAR		mail_id[MAXMAILID+1];	/* Message ID as a string */
+UCHAR		sender[MAXSENDER+1];	/* Reverse path of message */
+UCHAR		save_temp[PATCHSIZE];	/* Original text of patch area */
+} MAILSTOR, *PMAILSTOR;
 
 /* External references */
 
-extern	BOOL	mail_close(VOID);
-extern	INT	mail_init(PUCHAR);
-extern	BOOL	mail_open(PUCHAR *);
-extern	VOID	mail_reset(VOID);
-extern	BOOL	mail_store(PUCHAR);
+extern	INT	mail_check(PMAILSTOR, ULONG);
+extern	BOOL	mail_close(PMAILSTOR, INT);
+extern	BOOL	mail_finish(PMAILSTOR);
+extern	INT	mail_index(PSPOOL, BOOL);
+extern	INT	mail_init(PUCHAR, PSPOOL);
+extern	BOOL	mail_open(PMAILSTOR, PUCHAR *, ULONG, PUCHAR);
+extern	VOID	mail_end(PMAILSTOR);
+extern	INT	mail_migrate(PSPOOL);
+extern	VOID	mail_reset(PMAILSTOR);
+extern	BOOL	mail_segments(PSPOOL);
+extern	VOID	mail_setup(PMAILSTOR, PSPOOL);
+extern	BOOL	mail_store(PMAILSTOR, PUCHAR);
+extern	BOOL	mail_write(PMAILSTOR, PUCHAR, INT);
 
 /*
  * End of file: mailstor.h
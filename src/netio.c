@@ -9,94 +9,298 @@
 
 #pragma	strings(readonly)
 
-#pragma	alloc_text(a_init_seg, netio_init)
+#pragma	alloc_text(a_init_seg, netio_setup)
 
 #define	OS2
+#define	INCL_DOSSEMAPHORES
 #include <os2.h>
 
 #include <stdlib.h>
 #include <string.h>
 #include <types.h>
 #include <sys\socket.h>
+#include <sys\ioctl.h>
+#include <sys\uio.h>
 #include <nerrno.h>
 
 #include "netio.h"
 
-#define	BUFSIZE		1024		/* Size of network input buffer */
+#define	FILL_TIMEOUT	-1		/* fill_buffer() timed out */
+#define	FILL_AGAIN	-2		/* fill_buffer() would block */
+#define	CLOSE_TIMEOUT	5		/* Timeout for output at close (secs) */
 
 /* Forward references */
 
-static	INT	fill_buffer(INT, INT);
-static	INT	sock_send(INT, PUCHAR, INT, INT);
+static	INT	fill_buffer(PNETIO, INT);
+static	BOOL	flush_nowait(PNETIO);
+static	BOOL	hold_output(PNETIO, PUCHAR, INT);
+static	BOOL	lose_output(PNETIO);
+static	VOID	put_line(PNETIO, PUCHAR, INT, PUCHAR, INT);
+static	VOID	queue_output(PNETIO, PUCHAR, INT);
+static	VOID	resize_buffer(PNETIO, INT);
+static	INT	skip_sent(struct iovec **, INT, INT);
+static	INT	sock_send(PNETIO, PUCHAR, INT, INT);
 
 /* Local storage */
 
-static	INT	count;			/* Bytes remaining in input buffer */
-static	INT	next;			/* Offset of next byte in input buffer */
-static	UCHAR	buf[BUFSIZE];		/* Network input buffer */
+static	INT	minbuf = NETBUFMIN;	/* Initial size of input buffers */
+static	INT	maxbuf = NETBUFMAX;	/* Largest size of input buffers */
+static	HMTX	statsem;		/* Serialises access to totals */
+static	NETSTATS totals;		/* Input statistics for closed sockets */
 
 
 /*
- * Initialise buffering, etc.
+ * Set the smallest and largest sizes for input buffers, and prepare
+ * for keeping statistics. Must be called before any other function
+ * here.
+ *
  * Returns:
  *	TRUE		success
  *	FALSE		failure
  *
  */
 
-BOOL netio_init(VOID)
-{	/* Initialise count of bytes in network input buffer */
+BOOL netio_setup(INT min, INT max)
+{	minbuf = min;
+	maxbuf = max;
+
+	return(DosCreateMutexSem((PSZ) NULL, &statsem, 0, FALSE) == 0 ?
+		TRUE : FALSE);
+}
 
-	count = 0;
+
+/*
+ * Initialise buffering, etc. for the socket 'sockno', using the state
+ * structure pointed to by 'np'. The socket is always set to
+ * non-blocking mode, so that input can be read without first waiting
+ * for it. If 'nonblock' is TRUE, sock_gets() will return SOCKIO_AGAIN
+ * rather than wait when no complete line is available, output that
+ * cannot be sent at once is held back rather than waited for (see
+ * sock_flush()), and the caller is responsible for timeouts.
+ *
+ * Returns:
+ *	TRUE		success
+ *	FALSE		failure
+ *
+ */
+
+BOOL netio_init(PNETIO np, INT sockno, BOOL nonblock)
+{	INT on = 1;
+
+	np->sockno = sockno;
+	np->nonblock = nonblock;
+	np->count = 0;			/* Input buffer is empty */
+	np->next = 0;
+	np->len = 0;			/* No partial line */
+	np->full = FALSE;
+	np->cr = FALSE;
+	memset(&np->stats, 0, sizeof(NETSTATS));
+	np->niov = 0;			/* No output waiting */
+	np->olen = 0;
+	np->held = 0;
+	np->holdsize = 0;
+	np->hold = (PUCHAR) NULL;
+
+	np->bufsize = minbuf;
+	np->buf = (PUCHAR) malloc(minbuf);
+	if(np->buf == (PUCHAR) NULL) return(FALSE);
+
+	if(ioctl(sockno, FIONBIO, (PUCHAR) &on, sizeof(on)) != 0)
+		return(FALSE);
 
 	return(TRUE);
 }
 
 
+/*
+ * Finish with the socket whose state is in 'np'; any output still
+ * waiting is sent, the buffers are released, and the statistics for
+ * the socket are added to the totals. The socket itself is not closed.
+ * On a non-blocking socket, output that the socket will not take at
+ * once is lost; this happens only if the client has stopped reading.
+ *
+ */
+
+VOID netio_close(PNETIO np)
+{	if(np->buf == (PUCHAR) NULL) return;	/* Never initialised */
+
+	(VOID) sock_flush(np, CLOSE_TIMEOUT);
+	free(np->buf);
+	np->buf = (PUCHAR) NULL;
+	if(np->hold != (PUCHAR) NULL) free(np->hold);
+	np->hold = (PUCHAR) NULL;
+
+	(VOID) DosRequestMutexSem(statsem, SEM_INDEFINITE_WAIT);
+	totals.bytes += np->stats.bytes;
+	totals.recvs += np->stats.recvs;
+	totals.polls += np->stats.polls;
+	(VOID) DosReleaseMutexSem(statsem);
+}
+
+
+/*
+ * Get the input statistics for all sockets closed since the last call,
+ * into the structure pointed to by 'sp', and reset them.
+ *
+ */
+
+VOID netio_stats(PNETSTATS sp)
+{	(VOID) DosRequestMutexSem(statsem, SEM_INDEFINITE_WAIT);
+	*sp = totals;
+	memset(&totals, 0, sizeof(NETSTATS));
+	(VOID) DosReleaseMutexSem(statsem);
+}
+
+
 /*
  * Get a line from a socket. Carriage return, linefeed sequence is replaced
- * by a linefeed.
+ * by a linefeed. Line ends are found with memchr, and each run of data
+ * is copied into 'line' in one go.
+ *
+ * On a non-blocking socket, a partial line is retained in 'line' and
+ * in the state structure, and completed by a later call; the caller
+ * must pass the same buffer each time.
  *
  * Returns:
  *	>= 0			length of line read
  *	SOCKIO_TOOLONG		line too long for buffer; rest of line absorbed
  *	SOCKIO_TIMEOUT		input timed out
  *	SOCKIO_ERR		nonspecific network read error
+ *	SOCKIO_AGAIN		no complete line yet (non-blocking only)
  *
  */
 
-INT sock_gets(PUCHAR line, INT size, INT sockno, INT timeout)
-{	INT len = 0;
-	UCHAR c;
-	BOOL full = FALSE;
+INT sock_gets(PUCHAR line, INT size, PNETIO np, INT timeout)
+{	INT len, n, data;
+	BOOL crlf = FALSE;
+	PUCHAR p, nl;
 
 	for(;;) {
-		if(count == 0) count = fill_buffer(sockno, timeout);
-		if(count == 0) return(SOCKIO_ERR);
-		if(count < 0) return(SOCKIO_TIMEOUT);
-
-		c = buf[next++];
-		count--;
-		if(c == '\r') {
-			if(count == 0) count = fill_buffer(sockno, timeout);
-			if(count == 0) return(SOCKIO_ERR);
-			if(count < 0) return(SOCKIO_TIMEOUT);
-
-			if(buf[next] == '\n') {
-				next++;
-				count--;
-				if(full == FALSE) line[len++] = '\n';
+		if(np->count == 0) np->count = fill_buffer(np, timeout);
+		if(np->count == 0) return(SOCKIO_ERR);
+		if(np->count == FILL_AGAIN) {
+			np->count = 0;
+			return(SOCKIO_AGAIN);
+		}
+		if(np->count < 0) return(SOCKIO_TIMEOUT);
+
+		if(np->cr == TRUE) {		/* Previous byte was CR */
+			np->cr = FALSE;
+			if(np->buf[np->next] == '\n') {
+				np->next++;
+				np->count--;
+				if(np->full == FALSE) line[np->len++] = '\n';
 				break;
 			}
+			put_line(np, line, size, "\r", 1);
+		}
+
+		/* Find the end of the line in what is left of the buffer,
+		   and take everything up to it in one go. A CR just before
+		   the LF is dropped; a CR at the very end of the buffer is
+		   held back until we can see what follows it. */
+
+		p = &np->buf[np->next];
+		nl = (PUCHAR) memchr(p, '\n', np->count);
+		n = nl == (PUCHAR) NULL ? np->count : nl - p + 1;
+		data = nl == (PUCHAR) NULL ? n : n - 1;
+		if(data > 0 && p[data-1] == '\r') {
+			data--;
+			if(nl == (PUCHAR) NULL)
+				np->cr = TRUE;
+			else
+				crlf = TRUE;
+		}
+
+		put_line(np, line, size, p, data);
+		np->next += n;
+		np->count -= n;
+		if(nl != (PUCHAR) NULL) {
+			if(crlf == FALSE)
+				put_line(np, line, size, "\n", 1);
+			else if(np->full == FALSE)
+				line[np->len++] = '\n';
+			break;
 		}
-		if(full == FALSE) line[len++] = c;
-		if(len == size - 1) full = TRUE;
-		if(c == '\n') break;
 	}
-	
+
+	len = np->len;
 	line[len] = '\0';
+	np->len = 0;			/* Ready for next line */
+	if(np->full == TRUE) {
+		np->full = FALSE;
+		return(SOCKIO_TOOLONG);
+	}
+
+	return(len);
+}
+
+
+/*
+ * Get a block of raw data, of at most 'max' bytes, from a socket, with
+ * no line handling at all. The data is not copied; '*data' is set to
+ * point to it in the input buffer, where it remains valid until the
+ * next call of any input function.
+ *
+ * Returns:
+ *	> 0			number of bytes available at '*data'
+ *	SOCKIO_TIMEOUT		input timed out
+ *	SOCKIO_ERR		nonspecific network read error
+ *	SOCKIO_AGAIN		no data yet (non-blocking only)
+ *
+ */
+
+INT sock_read(PUCHAR *data, ULONG max, PNETIO np, INT timeout)
+{	INT n;
+
+	if(np->count == 0) np->count = fill_buffer(np, timeout);
+	if(np->count == 0) return(SOCKIO_ERR);
+	if(np->count == FILL_AGAIN) {
+		np->count = 0;
+		return(SOCKIO_AGAIN);
+	}
+	if(np->count < 0) return(SOCKIO_TIMEOUT);
+
+	n = max < np->count ? max : np->count;
+	*data = &np->buf[np->next];
+	np->next += n;
+	np->count -= n;
 
-	return(full ? SOCKIO_TOOLONG : len);
+	return(n);
+}
+
+
+/*
+ * See if there is input in the buffer that has not yet been taken by
+ * sock_gets() or sock_read(). Such input is no longer waiting at the
+ * socket, so select() will not report it.
+ *
+ * Returns:
+ *	TRUE		input is waiting in the buffer
+ *	FALSE		buffer is empty
+ *
+ */
+
+BOOL sock_pending(PNETIO np)
+{	return(np->count > 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Append 'n' bytes at 'p' to the partial line in 'line', whose size is
+ * 'size'. Once the line is full, anything further is discarded.
+ *
+ */
+
+static VOID put_line(PNETIO np, PUCHAR line, INT size, PUCHAR p, INT n)
+{	INT room = size - 1 - np->len;
+
+	if(np->full == TRUE || n == 0) return;
+
+	if(n > room) n = room;
+	memcpy(&line[np->len], p, n);
+	np->len += n;
+	if(np->len == size - 1) np->full = TRUE;
 }
 
 
@@ -104,76 +308,392 @@ INT sock_gets(PUCHAR line, INT size, INT sockno, INT timeout)
  * Send a line to a socket. Massages a terminating linefeed (\n)
  * into carriage return followed by linefeed.
  *
+ * The line is not sent at once, but copied into the output buffer, so
+ * that several replies can go out together; see sock_flush().
+ *
  */
 
-VOID sock_puts(PUCHAR line, INT sockno, INT timeout)
+VOID sock_puts(PUCHAR line, PNETIO np, INT timeout)
 {	static const UCHAR crlf[] = "\r\n";
 	INT len = strlen(line);
+	BOOL nl = FALSE;
 
 	if(line[len-1] == '\n') {
 		len--;
-		sock_send(sockno, line, len, timeout);
-		len = strlen(crlf);
-		line = (PUCHAR) &crlf[0];
+		nl = TRUE;
+	}
+
+	if(np->olen + len + 2 > NETOUTSIZE || np->niov == NETIOVMAX)
+		(VOID) sock_flush(np, timeout);
+
+	if(len + 2 > NETOUTSIZE) {	/* Too big to buffer */
+		sock_send(np, line, len, timeout);
+		if(nl == TRUE)
+			sock_send(np, (PUCHAR) crlf, strlen(crlf), timeout);
+		return;
+	}
+
+	memcpy(&np->obuf[np->olen], line, len);
+	if(nl == TRUE) {
+		memcpy(&np->obuf[np->olen+len], crlf, 2);
+		len += 2;
+	}
+	queue_output(np, &np->obuf[np->olen], len);
+	np->olen += len;
+}
+
+
+/*
+ * Send a reply of length 'len' to a socket. The reply must already end
+ * in carriage return and linefeed, and must be in static storage; it is
+ * not copied, but is sent directly from where it is by sock_flush().
+ *
+ */
+
+VOID sock_putr(PUCHAR reply, INT len, PNETIO np, INT timeout)
+{	if(np->niov == NETIOVMAX) (VOID) sock_flush(np, timeout);
+
+	queue_output(np, reply, len);
+}
+
+
+/*
+ * Add 'len' bytes at 'p' to the output waiting to be sent, joining them
+ * onto the previous piece if they follow on from it.
+ *
+ */
+
+static VOID queue_output(PNETIO np, PUCHAR p, INT len)
+{	struct iovec *iov;
+
+	if(np->niov > 0) {
+		iov = &np->iov[np->niov-1];
+		if((PUCHAR) iov->iov_base + iov->iov_len == p) {
+			iov->iov_len += len;
+			return;
+		}
+	}
+
+	iov = &np->iov[np->niov];
+	iov->iov_base = (caddr_t) p;
+	iov->iov_len = len;
+	np->niov++;
+}
+
+
+/*
+ * Send all output waiting for the socket in one go. This is done
+ * whenever the session is about to wait for input, so that replies to
+ * commands that arrived together also go out together.
+ *
+ * On a blocking socket, this waits (for up to 'timeout' seconds each
+ * time) for buffer space to become available if necessary. On a
+ * non-blocking socket it never waits; see flush_nowait().
+ *
+ * Returns:
+ *	TRUE		all output sent, or held back (non-blocking only)
+ *	FALSE		failure; output discarded
+ *
+ */
+
+BOOL sock_flush(PNETIO np, INT timeout)
+{	INT rc;
+	INT n = np->niov;
+	struct iovec *iov = &np->iov[0];
+	INT sockset[1];
+
+	if(np->nonblock == TRUE) return(flush_nowait(np));
+
+	while(n > 0) {
+		rc = writev(np->sockno, iov, n);
+		if(rc < 0) {
+			if(sock_errno() != SOCEWOULDBLOCK) break;
+			sockset[0] = np->sockno;
+			rc = select(sockset, 0, 1, 0, timeout*1000);
+			if(rc <= 0) break;
+			continue;
+		}
+		n = skip_sent(&iov, n, rc);
+	}
+
+	np->niov = 0;
+	np->olen = 0;
+
+	return(n == 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Send as much of the output waiting for a non-blocking socket as the
+ * socket will take, without waiting. Output held back by an earlier
+ * call goes first. Anything that cannot be sent now is copied and held
+ * back, and sock_blocked() reports it until a later call, made once the
+ * socket is writable, has sent it all.
+ *
+ * Returns:
+ *	TRUE		all output sent, or held back
+ *	FALSE		failure; output discarded
+ *
+ */
+
+static BOOL flush_nowait(PNETIO np)
+{	INT i, rc;
+	INT n = np->niov;
+	struct iovec *iov = &np->iov[0];
+
+	if(np->held == 0 && n > 0) {	/* Nothing in the way */
+		rc = writev(np->sockno, iov, n);
+		if(rc < 0) {
+			if(sock_errno() != SOCEWOULDBLOCK)
+				return(lose_output(np));
+			rc = 0;
+		}
+		n = skip_sent(&iov, n, rc);
+	}
+
+	for(i = 0; i < n; i++) {
+		if(hold_output(np, (PUCHAR) iov[i].iov_base,
+				iov[i].iov_len) == FALSE)
+			return(lose_output(np));
+	}
+	np->niov = 0;
+	np->olen = 0;
+
+	if(np->held > 0) {
+		rc = send(np->sockno, np->hold, np->held, 0);
+		if(rc < 0 && sock_errno() != SOCEWOULDBLOCK)
+			return(lose_output(np));
+		if(rc > 0) {
+			np->held -= rc;
+			memmove(np->hold, np->hold + rc, np->held);
+		}
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Step past 'sent' bytes, which have been written to the socket, of the
+ * 'n' output pieces starting at '*piov'; '*piov' is updated to point
+ * to the first piece still to be sent, adjusted if it went in part.
+ *
+ * Returns:
+ *	number of pieces still to be sent
+ *
+ */
+
+static INT skip_sent(struct iovec **piov, INT n, INT sent)
+{	struct iovec *iov = *piov;
+
+	while(n > 0 && sent >= iov->iov_len) {
+		sent -= iov->iov_len;
+		iov++;
+		n--;
+	}
+	if(n > 0) {
+		iov->iov_base = (caddr_t) ((PUCHAR) iov->iov_base + sent);
+		iov->iov_len -= sent;
+	}
+
+	*piov = iov;
+	return(n);
+}
+
+
+/*
+ * Add 'len' bytes at 'p' to the output held back for a non-blocking
+ * socket, making room for them if necessary.
+ *
+ * Returns:
+ *	TRUE		output held
+ *	FALSE		not enough memory
+ *
+ */
+
+static BOOL hold_output(PNETIO np, PUCHAR p, INT len)
+{	INT size;
+	PUCHAR q;
+
+	if(np->held + len > np->holdsize) {
+		size = np->holdsize == 0 ? NETOUTSIZE : np->holdsize;
+		while(size < np->held + len) size *= 2;
+		q = (PUCHAR) realloc(np->hold, size);
+		if(q == (PUCHAR) NULL) return(FALSE);
+		np->hold = q;
+		np->holdsize = size;
 	}
-	sock_send(sockno, line, len, timeout);
+
+	memcpy(&np->hold[np->held], p, len);
+	np->held += len;
+
+	return(TRUE);
 }
 
 
 /*
- * Refill the network input buffer.
+ * Throw away all output waiting for the socket, after a failure.
+ *
+ * Returns:
+ *	FALSE, for the convenience of the caller
+ *
+ */
+
+static BOOL lose_output(PNETIO np)
+{	np->niov = 0;
+	np->olen = 0;
+	np->held = 0;
+
+	return(FALSE);
+}
+
+
+/*
+ * See if output for a non-blocking socket has been held back because
+ * the socket would not take it. If so, sock_flush() should be called
+ * again once the socket is writable.
+ *
+ * Returns:
+ *	TRUE		output is held back
+ *	FALSE		nothing held back
+ *
+ */
+
+BOOL sock_blocked(PNETIO np)
+{	return(np->held > 0 ? TRUE : FALSE);
+}
+
+
+/*
+ * Refill the network input buffer. The socket is read straight away;
+ * only if there is nothing to read is select() used to wait (unless the
+ * caller does its own waiting). The buffer grows while the client keeps
+ * filling it (e.g. when streaming message text), up to the configured
+ * maximum, and shrinks again when the input slows down.
  *
  * Returns:
  *	>0		number of bytes in buffer
  *	0		nonspecific network read error
- *	<0		timeout
+ *	FILL_TIMEOUT	timeout
+ *	FILL_AGAIN	no data available (non-blocking only)
  *
  */
 
-static INT fill_buffer(INT sockno, INT timeout)
+static INT fill_buffer(PNETIO np, INT timeout)
 {	INT rc;
 	INT len;
 	INT sockset[2];
 
-	next = 0;			/* Reset buffer pointer */
+	np->next = 0;			/* Reset buffer pointer */
 
-	/* Set up and perform select call */
+	for(;;) {
+		np->stats.recvs++;
+		len = recv(np->sockno, np->buf, np->bufsize, 0);
+		if(len >= 0) break;
+		if(sock_errno() != SOCEWOULDBLOCK) return(0);
 
-	sockset[0] = sockno;		/* Read waiting */
-	sockset[1] = sockno;		/* Exception */
+		/* About to wait for input; send any replies first */
 
-	rc = select(
-		sockset,		/* List of sockets */
-		1,			/* Sockets for read check */
-		0,			/* Sockets for write check */
-		1,			/* Sockets for exception check */
-		timeout*1000);		/* Timeout period */
+		if(np->niov != 0 && sock_flush(np, timeout) == FALSE)
+			return(0);
+		if(np->nonblock == TRUE) return(FILL_AGAIN);
 
-	if(rc == 0) return(-1);		/* Timeout expired */
-	if(rc < 0) return(0);		/* Error */
+		/* Nothing there yet; set up and perform select call */
 
-	if(sockset[1] != -1)		/* Exception on socket */
-		return(0);
+		sockset[0] = np->sockno;	/* Read waiting */
+		sockset[1] = np->sockno;	/* Exception */
 
-	if(sockset[0] != -1) {	/* Read ready */
-		len = recv(sockno, buf, BUFSIZE, 0);
-		return(len);
+		np->stats.polls++;
+		rc = select(
+			sockset,		/* List of sockets */
+			1,			/* Sockets for read check */
+			0,			/* Sockets for write check */
+			1,			/* Sockets for exception check */
+			timeout*1000);		/* Timeout period */
+
+		if(rc == 0) return(FILL_TIMEOUT);/* Timeout expired */
+		if(rc < 0) return(0);		/* Error */
+
+		if(sockset[1] != -1)		/* Exception on socket */
+			return(0);
 	}
 
-	return(0);			/* Some other problem */
+	np->stats.bytes += len;
+	if(len == np->bufsize && np->bufsize < maxbuf)
+		resize_buffer(np, np->bufsize*2);
+	else if(len < np->bufsize/8 && np->bufsize > minbuf)
+		resize_buffer(np, np->bufsize/2);
+
+	return(len);
+}
+
+
+/*
+ * Change the size of the input buffer to 'size', but not beyond the
+ * configured limits. The contents are kept. If there is not enough
+ * memory, the buffer is left as it is.
+ *
+ */
+
+static VOID resize_buffer(PNETIO np, INT size)
+{	PUCHAR p;
+
+	if(size > maxbuf) size = maxbuf;
+	if(size < minbuf) size = minbuf;
+
+	p = (PUCHAR) realloc(np->buf, size);
+	if(p == (PUCHAR) NULL) return;
+
+	np->buf = p;
+	np->bufsize = size;
 }
 
 
 /*
- * Write a buffer to a socket.
+ * Write a buffer to a socket. As the socket is non-blocking, this waits
+ * (for up to 'timeout' seconds each time) for buffer space to become
+ * available if necessary; but if the caller does all waiting, whatever
+ * cannot be sent at once is held back instead, as by sock_flush().
  *
  * Returns:
  *	same as for 'send'
  *
  */
 
-static INT sock_send(INT sockno, PUCHAR buf, INT len, INT timeout)
-{	return(send(sockno, buf, len, 0));
+static INT sock_send(PNETIO np, PUCHAR buf, INT len, INT timeout)
+{	INT rc;
+	INT sent = 0;
+	INT sockset[1];
+
+	if(np->nonblock == TRUE) {
+		if(np->held == 0) {	/* Nothing in the way */
+			sent = send(np->sockno, buf, len, 0);
+			if(sent < 0) {
+				if(sock_errno() != SOCEWOULDBLOCK)
+					return(sent);
+				sent = 0;
+			}
+		}
+		if(sent < len &&
+		   hold_output(np, buf + sent, len - sent) == FALSE)
+			return(-1);
+		return(len);
+	}
+
+	while(sent < len) {
+		rc = send(np->sockno, buf + sent, len - sent, 0);
+		if(rc >= 0) {
+			sent += rc;
+			continue;
+		}
+		if(sock_errno() != SOCEWOULDBLOCK) return(rc);
+
+		sockset[0] = np->sockno;
+		rc = select(sockset, 0, 1, 0, timeout*1000);
+		if(rc <= 0) return(-1);
+	}
+
+	return(sent);
 }
 
 /*
@@ -15,12 +15,58 @@
 #define	SOCKIO_TOOLONG		-1	/* Line too long from sock_gets() */
 #define	SOCKIO_TIMEOUT		-2	/* Timeout on sock_gets()/sock_puts() */
 #define	SOCKIO_ERR		-3	/* Nonspecific socket I/O error */
+#define	SOCKIO_AGAIN		-4	/* No complete line yet (non-blocking) */
+					/* or no data (sock_read()) */
+
+/* Tunable constants */
+
+#define	NETBUFMIN		4096	/* Default initial input buffer size */
+#define	NETBUFMAX		262144	/* Default largest input buffer size */
+#define	NETBUFLIMIT		1048576	/* Largest allowable input buffer */
+#define	NETOUTSIZE		2048	/* Size of output buffer */
+#define	NETIOVMAX		16	/* Most output pieces held at once */
+
+/* Structure definitions */
+
+typedef	struct	_NETSTATS {		/* Input statistics */
+ULONG		bytes;			/* Bytes received */
+ULONG		recvs;			/* Calls to recv() */
+ULONG		polls;			/* Calls to select() */
+} NETSTATS, *PNETSTATS;
+
+typedef	struct	_NETIO {		/* Network I/O state for one socket */
+INT		sockno;			/* Socket number */
+BOOL		nonblock;		/* TRUE if caller does all waiting */
+INT		count;			/* Bytes remaining in input buffer */
+INT		next;			/* Offset of next byte in input buffer */
+INT		len;			/* Length of partial line so far */
+BOOL		full;			/* Partial line has overflowed */
+BOOL		cr;			/* Last byte of partial line was CR */
+INT		bufsize;		/* Current size of input buffer */
+PUCHAR		buf;			/* Network input buffer */
+NETSTATS	stats;			/* Input statistics for this socket */
+INT		niov;			/* Number of output pieces held */
+INT		olen;			/* Bytes used in output buffer */
+struct	iovec	iov[NETIOVMAX];		/* Output waiting to be sent */
+UCHAR		obuf[NETOUTSIZE];	/* Output buffer */
+INT		held;			/* Bytes of output held back */
+INT		holdsize;		/* Size of held-back output buffer */
+PUCHAR		hold;			/* Output socket would not take */
+} NETIO, *PNETIO;
 
 /* Network I/O functions */
 
-extern	BOOL	netio_init(VOID);
-extern	INT	sock_gets(PUCHAR, INT, INT, INT);
-extern	VOID	sock_puts(PUCHAR, INT, INT);
+extern	VOID	netio_close(PNETIO);
+extern	BOOL	netio_init(PNETIO, INT, BOOL);
+extern	BOOL	netio_setup(INT, INT);
+extern	VOID	netio_stats(PNETSTATS);
+extern	BOOL	sock_blocked(PNETIO);
+extern	BOOL	sock_flush(PNETIO, INT);
+extern	INT	sock_gets(PUCHAR, INT, PNETIO, INT);
+extern	BOOL	sock_pending(PNETIO);
+extern	VOID	sock_putr(PUCHAR, INT, PNETIO, INT);
+extern	INT	sock_read(PUCHAR *, ULONG, PNETIO, INT);
+extern	VOID	sock_puts(PUCHAR, PNETIO, INT);
 
 /*
  * End of file: netio.h
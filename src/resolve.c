@@ -0,0 +1,766 @@
+/*
+ * File: resolve.c
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Asynchronous reverse name lookup. Client addresses are looked up
+ * in the background while the session carries on, and the results
+ * (including failures) are kept in a cache shared by all sessions,
+ * for a limited time.
+ *
+ * Queries are sent directly to the configured name servers over UDP,
+ * and the answers are collected by a single resolver thread, so that
+ * any number of lookups can be outstanding at once and a slow or dead
+ * name server holds up nobody. If there are no name servers (e.g. all
+ * names come from the HOSTS file), the resolver thread uses
+ * gethostbyaddr instead, one lookup at a time.
+ *
+ * Answers are accepted only from a configured name server, only if
+ * they carry the (random) ID of an outstanding query and repeat its
+ * question, and only if the name they give is a plausible host name;
+ * anything else would be cached, and copied into the Received: line
+ * of every message from the address.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, resolve_init)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <process.h>
+
+#include "smtpd.h"
+#include "clock.h"
+#include "resolve.h"
+#include <nerrno.h>
+
+#define	DNSPACKET	512		/* Maximum size of a UDP DNS message */
+#define	DNSHDRSIZE	12		/* Size of DNS message header */
+#define	RETRY_MS	2000		/* Time before resending a query (ms) */
+#define	MAXTRIES	3		/* Number of times a query is sent */
+#define	RESOLVE_TICK	250		/* Interval for retry checks (ms) */
+#define	WAIT_TICK	1000		/* Interval for blocking waits (ms) */
+#define	RESOLVERSTACK	32768		/* Stack size for resolver thread */
+#define	MAXLABEL	63		/* Longest label in a domain name */
+
+/* Type definitions */
+
+typedef	struct	_RCENT {		/* One cache entry */
+struct	_RCENT	*hnext;			/* Next entry in hash chain */
+struct	_RCENT	*older;			/* Next older entry in use order */
+struct	_RCENT	*newer;			/* Next newer entry in use order */
+struct	_RCENT	*pnext;			/* Next entry awaiting an answer */
+ULONG		addr;			/* Address (network order) */
+BOOL		inuse;			/* Entry holds an address */
+BOOL		pending;		/* Lookup still in progress */
+INT		tries;			/* Number of times query sent */
+USHORT		qid;			/* ID of query last sent */
+ULONG		sent;			/* Time query last sent (ms) */
+time_t		expires;		/* Time at which entry lapses */
+UCHAR		name[MAXDNAME+1];	/* Name, or bracketed address */
+} RCENT, *PRCENT;
+
+/* Forward references */
+
+static	VOID	complete(PRCENT, PUCHAR, ULONG);
+static	PUCHAR	dns_name(PUCHAR, PUCHAR, PUCHAR, PUCHAR, INT);
+static	VOID	dns_reply(PUCHAR, INT);
+static	BOOL	from_server(PSOCK);
+static	PRCENT	find_entry(ULONG);
+static	VOID	literal(ULONG, PUCHAR);
+static	PRCENT	new_entry(ULONG);
+static	USHORT	new_qid(VOID);
+static	VOID	_Optlink resolver_dns(PVOID);
+static	VOID	_Optlink resolver_local(PVOID);
+static	VOID	retry_queries(VOID);
+static	VOID	reverse_name(ULONG, PUCHAR);
+static	VOID	send_query(PRCENT);
+static	VOID	start_lookup(PRCENT);
+static	VOID	touch(PRCENT);
+static	BOOL	valid_name(PUCHAR);
+
+/* Local storage */
+
+static	PRCENT	cache;			/* Cache entries */
+static	INT	centries;		/* Number of cache entries */
+static	HEV	donesem;		/* Posted when any lookup completes */
+static	INT	dnssock = -1;		/* Socket for name server queries */
+static	PRCENT	*hash;			/* Hash table of entries in use */
+static	ULONG	hashmask;		/* Hash table size, less one */
+static	HMTX	lock;			/* Serialises access to cache */
+static	INT	negttl;			/* Lifetime of failed lookups */
+static	PRCENT	newest;			/* Most recently used entry */
+static	PRCENT	oldest;			/* Least recently used entry */
+static	PRCENT	pending;		/* Entries awaiting an answer */
+static	ULONG	qidstate;		/* State for generating query IDs */
+static	INT	ttl;			/* Maximum lifetime of names */
+static	HEV	worksem;		/* Posted when local lookup queued */
+
+
+/*
+ * Initialise the resolver, with a cache of 'entries' entries. Names are
+ * kept for at most 'maxttl' seconds (less if the name server says so),
+ * and failures for 'failttl' seconds. The resolver thread is started.
+ *
+ * Returns:
+ *	TRUE		resolver ready
+ *	FALSE		initialisation failed; error already reported
+ *
+ */
+
+BOOL resolve_init(INT entries, INT maxttl, INT failttl)
+{	INT i, rc;
+	ULONG hsize;
+	SOCK local;
+
+	centries = entries;
+	ttl = maxttl;
+	negttl = failttl;
+
+	for(hsize = 1; hsize < centries; hsize <<= 1)
+		;
+	hashmask = hsize - 1;
+
+	cache = (PRCENT) calloc(centries, sizeof(RCENT));
+	hash = (PRCENT *) calloc(hsize, sizeof(PRCENT));
+	if(cache == (PRCENT) NULL || hash == (PRCENT *) NULL) {
+		error("cannot allocate memory for name cache");
+		return(FALSE);
+	}
+
+	/* All entries start out free, on the use list */
+
+	for(i = 0; i < centries; i++) {
+		cache[i].older = i == 0 ? (PRCENT) NULL : &cache[i-1];
+		cache[i].newer = i == centries-1 ? (PRCENT) NULL : &cache[i+1];
+	}
+	oldest = &cache[0];
+	newest = &cache[centries-1];
+	pending = (PRCENT) NULL;
+	qidstate = (ULONG) time((time_t *) NULL) ^ (clock_msecs() << 12) ^
+		   ((ULONG) getpid() << 20) ^ (ULONG) cache;
+	if(qidstate == 0) qidstate = 1;
+
+	rc = DosCreateMutexSem((PSZ) NULL, &lock, 0, FALSE);
+	if(rc == 0) rc = DosCreateEventSem((PSZ) NULL, &donesem, 0, FALSE);
+	if(rc == 0) rc = DosCreateEventSem((PSZ) NULL, &worksem, 0, FALSE);
+	if(rc != 0) {
+		error("cannot create resolver semaphore, rc = %d", rc);
+		return(FALSE);
+	}
+
+	if(_res.nscount > 0) {
+		dnssock = socket(PF_INET, SOCK_DGRAM, 0);
+		if(dnssock < 0) {
+			error("cannot create resolver socket, errno = %d",
+				sock_errno());
+			return(FALSE);
+		}
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = INADDR_ANY;
+		local.sin_port = 0;
+		if(bind(dnssock, (PSOCKG) &local, sizeof(local)) != 0) {
+			error("cannot bind resolver socket, errno = %d",
+				sock_errno());
+			(VOID) soclose(dnssock);
+			return(FALSE);
+		}
+	}
+
+	if(_beginthread(dnssock >= 0 ? resolver_dns : resolver_local,
+			NULL, RESOLVERSTACK, NULL) == -1) {
+		error("cannot start resolver thread");
+		return(FALSE);
+	}
+
+#ifdef	DEBUG
+	trace("resolver: %d cache entries, %d name server%s", centries,
+		_res.nscount, _res.nscount == 1 ? "" : "s");
+#endif
+
+	return(TRUE);
+}
+
+
+/*
+ * Get the name of the host with address 'addr' (network order) into
+ * 'name', which must hold at least MAXDNAME+1 characters. If the name
+ * is not in the cache, a lookup is started. If 'wait' is TRUE, this
+ * waits for the lookup to finish; otherwise it returns at once.
+ *
+ * If the address has no name, or the lookup fails, 'name' is set to
+ * the address in square brackets.
+ *
+ * Returns:
+ *	RESOLVE_OK	name (or bracketed address) returned
+ *	RESOLVE_PENDING	lookup in progress; 'name' unchanged
+ *
+ */
+
+INT resolve_name(ULONG addr, PUCHAR name, BOOL wait)
+{	PRCENT e;
+	ULONG posts;
+	time_t now;
+
+	(VOID) time(&now);
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+
+	e = find_entry(addr);
+	if(e != (PRCENT) NULL && e->pending == FALSE && now >= e->expires) {
+		start_lookup(e);	/* Lapsed; look it up again */
+	}
+	if(e == (PRCENT) NULL) {
+		e = new_entry(addr);
+		if(e == (PRCENT) NULL) {/* Every entry is busy */
+			(VOID) DosReleaseMutexSem(lock);
+			literal(addr, name);
+			return(RESOLVE_OK);
+		}
+		start_lookup(e);
+	}
+
+	while(e->pending == TRUE) {
+		if(wait == FALSE) {
+			(VOID) DosReleaseMutexSem(lock);
+			return(RESOLVE_PENDING);
+		}
+		(VOID) DosResetEventSem(donesem, &posts);
+		(VOID) DosReleaseMutexSem(lock);
+		(VOID) DosWaitEventSem(donesem, WAIT_TICK);
+		(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+		e = find_entry(addr);
+		if(e == (PRCENT) NULL) {/* Cannot happen, but be safe */
+			(VOID) DosReleaseMutexSem(lock);
+			literal(addr, name);
+			return(RESOLVE_OK);
+		}
+	}
+
+	strcpy(name, e->name);
+	touch(e);
+	(VOID) DosReleaseMutexSem(lock);
+
+	return(RESOLVE_OK);
+}
+
+
+/*
+ * Find the cache entry for address 'addr'. The cache lock must be held.
+ *
+ * Returns:
+ *	pointer to entry, or NULL if none
+ *
+ */
+
+static PRCENT find_entry(ULONG addr)
+{	PRCENT e;
+
+	for(e = hash[(addr ^ (addr >> 16)) & hashmask]; e != (PRCENT) NULL;
+	    e = e->hnext) {
+		if(e->addr == addr) return(e);
+	}
+
+	return((PRCENT) NULL);
+}
+
+
+/*
+ * Obtain a cache entry for address 'addr', reusing the least recently
+ * used one. Entries awaiting an answer are never reused. The cache lock
+ * must be held.
+ *
+ * Returns:
+ *	pointer to entry, or NULL if every entry is busy
+ *
+ */
+
+static PRCENT new_entry(ULONG addr)
+{	PRCENT e, *pe;
+
+	for(e = oldest; e != (PRCENT) NULL; e = e->newer) {
+		if(e->pending == FALSE) break;
+	}
+	if(e == (PRCENT) NULL) return((PRCENT) NULL);
+
+	if(e->inuse == TRUE) {		/* Remove from its hash chain */
+		pe = &hash[(e->addr ^ (e->addr >> 16)) & hashmask];
+		while(*pe != e) pe = &(*pe)->hnext;
+		*pe = e->hnext;
+	}
+
+	e->addr = addr;
+	e->inuse = TRUE;
+	e->pending = FALSE;
+	pe = &hash[(addr ^ (addr >> 16)) & hashmask];
+	e->hnext = *pe;
+	*pe = e;
+	touch(e);
+
+	return(e);
+}
+
+
+/*
+ * Move entry 'e' to the most recently used end of the use list. The
+ * cache lock must be held.
+ *
+ */
+
+static VOID touch(PRCENT e)
+{	if(e == newest) return;
+
+	if(e->older != (PRCENT) NULL)
+		e->older->newer = e->newer;
+	else
+		oldest = e->newer;
+	e->newer->older = e->older;
+
+	e->older = newest;
+	e->newer = (PRCENT) NULL;
+	newest->newer = e;
+	newest = e;
+}
+
+
+/*
+ * Start a lookup for entry 'e', and put it on the list of entries
+ * awaiting an answer. The cache lock must be held.
+ *
+ */
+
+static VOID start_lookup(PRCENT e)
+{	e->pending = TRUE;
+	e->tries = 0;
+	e->pnext = pending;
+	pending = e;
+
+	if(dnssock >= 0)
+		send_query(e);
+	else
+		(VOID) DosPostEventSem(worksem);
+}
+
+
+/*
+ * Finish the lookup for entry 'e'; 'name' is the result, or NULL if the
+ * lookup failed, and 'life' is the time for which a name may be kept.
+ * A name that is not a plausible host name counts as a failure. Anyone
+ * waiting is woken. The cache lock must be held.
+ *
+ */
+
+static VOID complete(PRCENT e, PUCHAR name, ULONG life)
+{	PRCENT *pe;
+	time_t now;
+
+	for(pe = &pending; *pe != (PRCENT) NULL; pe = &(*pe)->pnext) {
+		if(*pe == e) {
+			*pe = e->pnext;
+			break;
+		}
+	}
+
+	(VOID) time(&now);
+	if(name == (PUCHAR) NULL || valid_name(name) == FALSE) {
+		literal(e->addr, e->name);
+#ifdef	DEBUG
+		if(name != (PUCHAR) NULL)
+			trace("resolver: bad name for %s ignored", e->name);
+#endif
+		e->expires = now + negttl;
+	} else {
+		strncpy(e->name, name, MAXDNAME);
+		e->name[MAXDNAME] = '\0';
+		fix_domain(e->name);
+		e->expires = now + (life < ttl ? life : ttl);
+	}
+	e->pending = FALSE;
+
+	(VOID) DosPostEventSem(donesem);
+}
+
+
+/*
+ * Send (or resend) a PTR query for entry 'e' to a name server; each
+ * retry goes to the next server in turn. Each query has a new random
+ * ID, kept in the entry so that the answer can be matched up. The cache
+ * lock must be held.
+ *
+ */
+
+static VOID send_query(PRCENT e)
+{	INT len, n;
+	UCHAR qname[MAXDNAME+1];
+	UCHAR packet[DNSPACKET];
+	PUCHAR p, q;
+	USHORT id = new_qid();
+	PSOCK ns = &_res.nsaddr_list[e->tries % _res.nscount];
+
+	memset(packet, 0, DNSHDRSIZE);
+	packet[0] = id >> 8;
+	packet[1] = id & 0xff;
+	packet[2] = 0x01;		/* Recursion desired */
+	packet[5] = 1;			/* One question */
+
+	reverse_name(e->addr, qname);
+	p = &packet[DNSHDRSIZE];
+	for(q = qname; *q != '\0'; q += n) {
+		if(*q == '.') q++;
+		n = strcspn(q, ".");
+		*p++ = n;
+		memcpy(p, q, n);
+		p += n;
+	}
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = T_PTR;
+	*p++ = 0;
+	*p++ = C_IN;
+	len = p - packet;
+
+	e->qid = id;
+	e->tries++;
+	e->sent = clock_msecs();
+	if(sendto(dnssock, packet, len, 0, (PSOCKG) ns, sizeof(SOCK)) < 0) {
+#ifdef	DEBUG
+		trace("resolver: sendto failed, errno = %d", sock_errno());
+#endif
+	}
+}
+
+
+/*
+ * Main loop of the resolver thread when there are name servers to ask.
+ * Answers are matched to their entries as they arrive, and queries that
+ * have gone unanswered for too long are sent again, or given up.
+ *
+ */
+
+static VOID _Optlink resolver_dns(PVOID arg)
+{	INT len, rc, fromlen;
+	INT sockset[1];
+	SOCK from;
+	UCHAR packet[DNSPACKET];
+
+	for(;;) {
+		sockset[0] = dnssock;
+		rc = select(sockset, 1, 0, 0, (LONG) RESOLVE_TICK);
+		if(rc > 0) {
+			fromlen = sizeof(from);
+			len = recvfrom(dnssock, packet, sizeof(packet), 0,
+					(PSOCKG) &from, &fromlen);
+			if(len >= DNSHDRSIZE && from_server(&from) == TRUE) {
+				(VOID) DosRequestMutexSem(lock,
+						SEM_INDEFINITE_WAIT);
+				dns_reply(packet, len);
+				(VOID) DosReleaseMutexSem(lock);
+			}
+		} else if(rc < 0 && sock_errno() != SOCEINTR) {
+			dolog(LOG_ERR, "resolver: select failed");
+			(VOID) DosSleep(RESOLVE_TICK);
+		}
+
+		(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+		retry_queries();
+		(VOID) DosReleaseMutexSem(lock);
+	}
+}
+
+
+/*
+ * Check whether the datagram whose source address is in 'from' came
+ * from one of the configured name servers, at the address and port
+ * (normally 53) to which queries are sent.
+ *
+ * Returns:
+ *	TRUE		datagram came from a name server
+ *	FALSE		datagram came from somewhere else
+ *
+ */
+
+static BOOL from_server(PSOCK from)
+{	INT i;
+	PSOCK ns;
+
+	if(from->sin_family != AF_INET) return(FALSE);
+
+	for(i = 0; i < _res.nscount; i++) {
+		ns = &_res.nsaddr_list[i];
+		if(from->sin_addr.s_addr == ns->sin_addr.s_addr &&
+		   from->sin_port == ns->sin_port)
+			return(TRUE);
+	}
+
+#ifdef	DEBUG
+	trace("resolver: answer from %s ignored", inet_ntoa(from->sin_addr));
+#endif
+
+	return(FALSE);
+}
+
+
+/*
+ * Resend, or give up, any queries that have gone unanswered for too
+ * long. The cache lock must be held.
+ *
+ */
+
+static VOID retry_queries(VOID)
+{	PRCENT e, next;
+	ULONG now = clock_msecs();
+
+	for(e = pending; e != (PRCENT) NULL; e = next) {
+		next = e->pnext;
+		if(now - e->sent < RETRY_MS) continue;
+		if(e->tries >= MAXTRIES)
+			complete(e, (PUCHAR) NULL, 0);
+		else
+			send_query(e);
+	}
+}
+
+
+/*
+ * Handle a reply from a name server, in 'packet' with length 'len'. It
+ * is ignored unless it carries the ID of a query still outstanding and
+ * repeats the question asked by that query. The cache lock must be
+ * held.
+ *
+ */
+
+static VOID dns_reply(PUCHAR packet, INT len)
+{	INT i, nq, na, type, rdlen;
+	USHORT id;
+	ULONG life;
+	PRCENT e;
+	PUCHAR p, end = packet + len;
+	UCHAR qname[MAXDNAME+1];
+	UCHAR name[MAXDNAME+1];
+
+	id = (packet[0] << 8) | packet[1];
+	nq = (packet[4] << 8) | packet[5];
+	na = (packet[6] << 8) | packet[7];
+	if((packet[2] & 0x80) == 0 || nq != 1) return;
+
+	p = dns_name(packet, end, packet + DNSHDRSIZE, name, sizeof(name));
+	if(p == (PUCHAR) NULL || p + 4 > end) return;
+	if(((p[0] << 8) | p[1]) != T_PTR || ((p[2] << 8) | p[3]) != C_IN)
+		return;
+	p += 4;				/* Skip type and class */
+
+	/* Find the query with this ID that asked this question; IDs are
+	   random, so two outstanding queries may share one */
+
+	for(e = pending; e != (PRCENT) NULL; e = e->pnext) {
+		if(e->tries == 0 || e->qid != id) continue;
+		reverse_name(e->addr, qname);
+		if(stricmp(name, qname) == 0) break;
+	}
+	if(e == (PRCENT) NULL) return;
+
+	if((packet[3] & 0x0f) != 0) {	/* Error, or no such name */
+		complete(e, (PUCHAR) NULL, 0);
+		return;
+	}
+
+	for(i = 0; i < na; i++) {
+		p = dns_name(packet, end, p, (PUCHAR) NULL, 0);
+		if(p == (PUCHAR) NULL || p + 10 > end) break;
+		type = (p[0] << 8) | p[1];
+		life = ((ULONG) p[4] << 24) | ((ULONG) p[5] << 16) |
+		       ((ULONG) p[6] << 8) | p[7];
+		rdlen = (p[8] << 8) | p[9];
+		p += 10;
+		if(p + rdlen > end) break;
+		if(type == T_PTR &&
+		   dns_name(packet, end, p, name, sizeof(name)) !=
+							(PUCHAR) NULL) {
+			complete(e, name, life);
+			return;
+		}
+		p += rdlen;
+	}
+
+	complete(e, (PUCHAR) NULL, 0);	/* No usable answer */
+}
+
+
+/*
+ * Decode the (possibly compressed) domain name at 'p' in the DNS message
+ * starting at 'msg' and ending at 'end'. If 'out' is not NULL, the name
+ * is stored there in dotted form; 'size' is the size of 'out'.
+ *
+ * Returns:
+ *	pointer to the data following the name
+ *	NULL if the name is malformed or too long
+ *
+ */
+
+static PUCHAR dns_name(PUCHAR msg, PUCHAR end, PUCHAR p, PUCHAR out,
+			INT size)
+{	INT n;
+	INT olen = 0;
+	INT jumps = 0;
+	PUCHAR next = (PUCHAR) NULL;
+
+	for(;;) {
+		if(p >= end) return((PUCHAR) NULL);
+		n = *p;
+		if((n & 0xc0) == 0xc0) {	/* Compression pointer */
+			if(p + 1 >= end || ++jumps > 16)
+				return((PUCHAR) NULL);
+			if(next == (PUCHAR) NULL) next = p + 2;
+			p = msg + (((n & 0x3f) << 8) | p[1]);
+			continue;
+		}
+		if(n == 0) break;
+		p++;
+		if(p + n > end) return((PUCHAR) NULL);
+		if(out != (PUCHAR) NULL) {
+			if(olen + n + 2 > size) return((PUCHAR) NULL);
+			if(olen != 0) out[olen++] = '.';
+			memcpy(&out[olen], p, n);
+			olen += n;
+		}
+		p += n;
+	}
+	if(out != (PUCHAR) NULL) out[olen] = '\0';
+
+	return(next != (PUCHAR) NULL ? next : p + 1);
+}
+
+
+/*
+ * Check that 'name' is a plausible host name: labels of letters, digits
+ * and hyphens, separated by dots, with sensible lengths. Names from the
+ * network are copied into the Received: lines of messages, so nothing
+ * else is accepted.
+ *
+ * Returns:
+ *	TRUE		name acceptable
+ *	FALSE		name not acceptable
+ *
+ */
+
+static BOOL valid_name(PUCHAR name)
+{	INT n = 0;
+	PUCHAR p;
+
+	if(*name == '\0' || strlen(name) > MAXDNAME) return(FALSE);
+
+	for(p = name; *p != '\0'; p++) {
+		if(*p == '.') {
+			if(n == 0) return(FALSE);	/* Empty label */
+			n = 0;
+			continue;
+		}
+		if(*p > 0x7f || (!isalnum(*p) && *p != '-')) return(FALSE);
+		if(++n > MAXLABEL) return(FALSE);
+	}
+
+	return(n == 0 ? FALSE : TRUE);
+}
+
+
+/*
+ * Main loop of the resolver thread when there are no name servers;
+ * each lookup waiting to be done is passed to gethostbyaddr in turn.
+ *
+ */
+
+static VOID _Optlink resolver_local(PVOID arg)
+{	PRCENT e;
+	PHOST host;
+	INADDR addr;
+	ULONG posts;
+	UCHAR name[MAXDNAME+1];
+
+	for(;;) {
+		(VOID) DosWaitEventSem(worksem, SEM_INDEFINITE_WAIT);
+		(VOID) DosResetEventSem(worksem, &posts);
+
+		for(;;) {
+			(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+			for(e = pending; e != (PRCENT) NULL; e = e->pnext) {
+				if(e->tries == 0) break;
+			}
+			if(e == (PRCENT) NULL) {
+				(VOID) DosReleaseMutexSem(lock);
+				break;
+			}
+			e->tries++;
+			addr.s_addr = e->addr;
+			(VOID) DosReleaseMutexSem(lock);
+
+			host = gethostbyaddr((PUCHAR) &addr, sizeof(addr),
+					AF_INET);
+			if(host != (PHOST) NULL) {
+				strncpy(name, host->h_name, MAXDNAME);
+				name[MAXDNAME] = '\0';
+			}
+
+			(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+			if(e->pending == TRUE && e->addr == addr.s_addr)
+				complete(e, host == (PHOST) NULL ?
+					(PUCHAR) NULL : name, ttl);
+			(VOID) DosReleaseMutexSem(lock);
+		}
+	}
+}
+
+
+/*
+ * Generate a query ID; this uses a simple shift register generator, so
+ * that IDs cannot be guessed from the order in which they are sent. The
+ * cache lock must be held.
+ *
+ */
+
+static USHORT new_qid(VOID)
+{	qidstate ^= qidstate << 13;
+	qidstate ^= qidstate >> 17;
+	qidstate ^= qidstate << 5;
+
+	return((USHORT) ((qidstate >> 16) ^ qidstate ^ clock_msecs()));
+}
+
+
+/*
+ * Build the reverse lookup name (d.c.b.a.in-addr.arpa) for address
+ * 'addr' in 'name'.
+ *
+ */
+
+static VOID reverse_name(ULONG addr, PUCHAR name)
+{	PUCHAR a = (PUCHAR) &addr;
+
+	sprintf(name, "%d.%d.%d.%d.in-addr.arpa", a[3], a[2], a[1], a[0]);
+}
+
+
+/*
+ * Set 'name' to the address 'addr' in dotted form, in square brackets.
+ * This does not use inet_ntoa, which returns its result in static
+ * storage.
+ *
+ */
+
+static VOID literal(ULONG addr, PUCHAR name)
+{	PUCHAR a = (PUCHAR) &addr;
+
+	sprintf(name, "[%d.%d.%d.%d]", a[0], a[1], a[2], a[3]);
+}
+
+/*
+ * End of file: resolve.c
+ *
+ */
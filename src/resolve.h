@@ -0,0 +1,32 @@
+/*
+ * File: resolve.h
+ *
+ * Asynchronous reverse name lookup, with a shared cache; header file.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	RESOLVE_ENTRIES		1024	/* Default number of cache entries */
+#define	RESOLVE_TTL		3600	/* Default lifetime of a name (secs) */
+#define	RESOLVE_NEGTTL		300	/* Default lifetime of a failure (secs) */
+#define	RESOLVE_MAXENTRIES	65535	/* Maximum number of cache entries */
+
+/* Results from resolve_name() */
+
+#define	RESOLVE_OK		0	/* Name (or address literal) returned */
+#define	RESOLVE_PENDING		1	/* Lookup still in progress */
+
+/* External references */
+
+extern	BOOL	resolve_init(INT, INT, INT);
+extern	INT	resolve_name(ULONG, PUCHAR, BOOL);
+
+/*
+ * End of file: resolve.h
+ *
+ */
+
+
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+ * File: segment.h
+ *
+ * Segment spool, in which small messages are appended to large
+ * preallocated segment files, instead of each having a mail file of its
+ * own; header file. This is shared with the mail sending software,
+ * which reads segments using the routines in segread.c.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	SEG_MINSIZE		1024	/* Smallest segment size (KB) */
+#define	SEG_MAXSIZE		1048576	/* Largest segment size (KB) */
+
+/* Miscellaneous constants */
+
+#define	SEG_FILES		"????????.SEG"
+					/* Segments, in spool directory */
+#define	SEG_MAGIC		0x47455353L
+					/* Segment file identifier ("SSEG") */
+#define	SEG_RECMAGIC		0x43455253L
+					/* Record identifier ("SREC") */
+#define	SEG_VERSION		1	/* Segment file format version */
+#define	SEG_HDRSIZE		sizeof(SEGHDR)
+					/* Size of segment header */
+#define	SEG_RECSIZE		sizeof(SEGREC)
+					/* Size of record header */
+#define	SEG_ALIGN		16	/* Records start on multiples of this */
+#define	SEG_MAXDATA		65536	/* Largest message held in a segment */
+#define	SEG_IDLEN		12	/* Space for mail ID */
+
+#define	SEG_ROUND(n)		(((n) + SEG_ALIGN - 1) & ~(SEG_ALIGN - 1))
+					/* Round up to record boundary */
+
+#define	FALSE			0
+#define	TRUE			1
+
+/* Record states */
+
+#define	SEG_LIVE		0	/* Waiting to be sent */
+#define	SEG_DONE		1	/* Sent, or withdrawn by SMTPD */
+
+/* Results from seg_open(), seg_next() and seg_done() */
+
+#define	SEG_OK			0	/* Success; record returned */
+#define	SEG_END			1	/* No more records at present */
+#define	SEG_NOFILE		2	/* No segments in spool directory */
+#define	SEG_ERROR		3	/* Segment unreadable */
+
+/* Structure definitions */
+
+typedef	struct	_SEGHDR {		/* Segment header */
+ULONG		magic;			/* SEG_MAGIC */
+ULONG		version;		/* SEG_VERSION */
+ULONG		number;			/* Segment number (as in its name) */
+ULONG		size;			/* Size of segment file (bytes) */
+ULONG		reserved[4];		/* Zero */
+} SEGHDR, *PSEGHDR;
+
+typedef	struct	_SEGREC {		/* Record header; message follows */
+ULONG		magic;			/* SEG_RECMAGIC */
+ULONG		check;			/* Checksum of rest of record */
+ULONG		length;			/* Length of message (bytes) */
+ULONG		time;			/* Time stored (time_t) */
+UCHAR		mail_id[SEG_IDLEN];	/* Mail ID */
+UCHAR		state;			/* SEG_LIVE or SEG_DONE (unchecked) */
+UCHAR		reserved[3];		/* Zero */
+} SEGREC, *PSEGREC;			/* 32 bytes */
+
+typedef	struct	_SEGREADER {		/* State of one segment reader */
+UCHAR		maildir[CCHMAXPATH+1];	/* Spool directory */
+INT		fd;			/* Segment file handle, or -1 */
+ULONG		number;			/* Number of segment being read */
+ULONG		offset;			/* Offset of next record */
+ULONG		current;		/* Offset of record last returned */
+} SEGREADER, *PSEGREADER;
+
+/* External references */
+
+extern	ULONG	seg_check(PSEGREC, PUCHAR);
+extern	VOID	seg_close(PSEGREADER);
+extern	INT	seg_done(PSEGREADER);
+extern	VOID	seg_name(PUCHAR, PUCHAR, ULONG);
+extern	INT	seg_next(PSEGREADER, PSEGREC, PUCHAR);
+extern	INT	seg_open(PSEGREADER, PUCHAR);
+
+/*
+ * End of file: segment.h
+ *
+ */
+
+
\ No newline at end of file
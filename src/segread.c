@@ -0,0 +1,290 @@
+/*
+ * File: segread.c
+ *
+ * Segment spool; routines for reading segments, and those shared with
+ * the code that writes them (in mailstor.c).
+ *
+ * This file uses nothing else from SMTPD, so that the mail sending
+ * software can be linked with it. Each message held in a segment is
+ * stored exactly as it would be in a mail file of its own, after a
+ * record header giving its length and mail ID; records are read in the
+ * order in which they were stored, straight into the caller's buffer,
+ * which must hold SEG_MAXDATA bytes. Typical use is:
+ *
+ *	if(seg_open(&sr, spooldir) == SEG_OK) {
+ *		for(;;) {
+ *			rc = seg_next(&sr, &rec, buf);
+ *			if(rc == SEG_OK) {
+ *				...send rec.length bytes at buf...
+ *				if(sent) (VOID) seg_done(&sr);
+ *			}
+ *			else if(rc == SEG_END) ...wait a while...
+ *			else if(rc == SEG_ERROR) break;
+ *		}
+ *		seg_close(&sr);
+ *	}
+ *
+ * Marking each message as done when it has been sent allows SMTPD to
+ * delete a segment once all of its messages have been sent. Messages
+ * that are not marked are returned again when reading next starts.
+ * Messages too large for a segment are still stored in mail files of
+ * their own, and must be found in the usual way.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#define	INCL_DOSFILEMGR
+#include <os2.h>
+
+#include "segment.h"
+
+/* Forward references */
+
+static	INT	open_segment(PSEGREADER);
+static	BOOL	read_record(PSEGREADER, PSEGREC, PUCHAR);
+
+
+/*
+ * Start reading the segments in the spool directory 'maildir' (given
+ * without a trailing '\'), from the first record of the oldest one,
+ * using the reader state pointed to by 'rp'.
+ *
+ * Returns:
+ *	SEG_OK		ready to read
+ *	SEG_NOFILE	spool directory has no segments
+ *
+ */
+
+INT seg_open(PSEGREADER rp, PUCHAR maildir)
+{	HDIR hdir = HDIR_CREATE;
+	ULONG count = 1;
+	ULONG n, first = 0xFFFFFFFFUL;
+	PUCHAR end;
+	FILEFINDBUF3 ff;
+	UCHAR path[CCHMAXPATH+1];
+
+	sprintf(path, "%s\\%s", maildir, SEG_FILES);
+	if(DosFindFirst(
+			path,
+			&hdir,
+			FILE_NORMAL,
+			&ff,
+			sizeof(ff),
+			&count,
+			FIL_STANDARD) != 0)
+		return(SEG_NOFILE);
+
+	do {
+		n = strtoul(ff.achName, (char **) &end, 16);
+		if(end == (PUCHAR) &ff.achName[8] && n < first)
+			first = n;
+	} while(DosFindNext(hdir, &ff, sizeof(ff), &count) == 0);
+	(VOID) DosFindClose(hdir);
+	if(first == 0xFFFFFFFFUL) return(SEG_NOFILE);
+
+	strcpy(rp->maildir, maildir);
+	rp->fd = -1;			/* Opened by seg_next() */
+	rp->number = first;
+	rp->offset = SEG_HDRSIZE;
+	rp->current = 0;
+
+	return(SEG_OK);
+}
+
+
+/*
+ * Read the next message not already marked as done, from the segments
+ * being read with the reader state pointed to by 'rp'. Its record
+ * header is put in the structure pointed to by 'rec', and the message
+ * itself in the buffer 'buf'.
+ *
+ * Returns:
+ *	SEG_OK		message returned
+ *	SEG_END		no more messages at present
+ *	SEG_ERROR	segment cannot be read
+ *
+ */
+
+INT seg_next(PSEGREADER rp, PSEGREC rec, PUCHAR buf)
+{	INT rc;
+	FILESTATUS3 fs;
+	UCHAR path[CCHMAXPATH+1];
+
+	for(;;) {
+		if(rp->fd == -1) {
+			rc = open_segment(rp);
+			if(rc != SEG_OK) return(rc);
+		}
+
+		if(read_record(rp, rec, buf) == FALSE) {
+			/* Nothing more here for now. The segment is finished
+			   once SMTPD has started the next one, but a record
+			   may have been added just before that, so look once
+			   more before moving on. */
+
+			seg_name(path, rp->maildir, rp->number + 1);
+			if(DosQueryPathInfo(path, FIL_STANDARD, &fs,
+					sizeof(fs)) != 0)
+				return(SEG_END);
+			if(read_record(rp, rec, buf) == FALSE) {
+				(VOID) close(rp->fd);
+				rp->fd = -1;
+				rp->number++;
+				rp->offset = SEG_HDRSIZE;
+				rp->current = 0;
+				continue;
+			}
+		}
+
+		rp->current = rp->offset;
+		rp->offset += SEG_ROUND(SEG_RECSIZE + rec->length);
+		if(rec->state == SEG_LIVE) return(SEG_OK);
+	}
+}
+
+
+/*
+ * Mark the message last returned by seg_next(), from the segments being
+ * read with the reader state pointed to by 'rp', as done. This must be
+ * called before seg_next() is called again.
+ *
+ * Returns:
+ *	SEG_OK		message marked
+ *	SEG_ERROR	no message to mark, or segment cannot be written
+ *
+ */
+
+INT seg_done(PSEGREADER rp)
+{	static UCHAR done = SEG_DONE;
+	LONG offset;
+
+	if(rp->fd == -1 || rp->current == 0) return(SEG_ERROR);
+
+	offset = rp->current + offsetof(SEGREC, state);
+	if(lseek(rp->fd, offset, SEEK_SET) != offset ||
+	   write(rp->fd, &done, 1) != 1)
+		return(SEG_ERROR);
+
+	return(SEG_OK);
+}
+
+
+/*
+ * Finish reading the segments being read with the reader state pointed
+ * to by 'rp'.
+ *
+ */
+
+VOID seg_close(PSEGREADER rp)
+{	if(rp->fd != -1) (VOID) close(rp->fd);
+	rp->fd = -1;
+}
+
+
+/*
+ * Open the segment to be read next with the reader state pointed to by
+ * 'rp', and check its header. The segment may not have been completely
+ * set up yet, in which case it is tried again on the next call.
+ *
+ * Returns:
+ *	SEG_OK		segment open
+ *	SEG_END		segment not ready
+ *	SEG_ERROR	segment cannot be opened
+ *
+ */
+
+static INT open_segment(PSEGREADER rp)
+{	SEGHDR hdr;
+	UCHAR path[CCHMAXPATH+1];
+
+	seg_name(path, rp->maildir, rp->number);
+	rp->fd = open(path, O_RDWR | O_BINARY);
+	if(rp->fd == -1) return(errno == ENOENT ? SEG_END : SEG_ERROR);
+
+	if(read(rp->fd, &hdr, SEG_HDRSIZE) != SEG_HDRSIZE ||
+	   hdr.magic != SEG_MAGIC ||
+	   hdr.version != SEG_VERSION ||
+	   hdr.number != rp->number) {
+		(VOID) close(rp->fd);
+		rp->fd = -1;
+		return(SEG_END);
+	}
+
+	return(SEG_OK);
+}
+
+
+/*
+ * Read the record at the current position in the segment being read
+ * with the reader state pointed to by 'rp'; its header goes into the
+ * structure pointed to by 'rec', and the message into 'buf'.
+ *
+ * Returns:
+ *	TRUE		record read
+ *	FALSE		no record there, or not all of it written yet
+ *
+ */
+
+static BOOL read_record(PSEGREADER rp, PSEGREC rec, PUCHAR buf)
+{	if(lseek(rp->fd, rp->offset, SEEK_SET) != rp->offset ||
+	   read(rp->fd, rec, SEG_RECSIZE) != SEG_RECSIZE ||
+	   rec->magic != SEG_RECMAGIC ||
+	   rec->length > SEG_MAXDATA ||
+	   read(rp->fd, buf, rec->length) != (INT) rec->length)
+		return(FALSE);
+
+	return(seg_check(rec, buf) == rec->check ? TRUE : FALSE);
+}
+
+
+/*
+ * Compute the checksum of the record whose header is pointed to by
+ * 'rec', and whose message is at 'data'. It covers the header (apart
+ * from the checksum itself, and the state, which changes) and the
+ * message, so a record written only in part has the wrong checksum.
+ *
+ * Returns:
+ *	checksum
+ *
+ */
+
+ULONG seg_check(PSEGREC rec, PUCHAR data)
+{	ULONG i;
+	ULONG sum = SEG_MAGIC;
+	PUCHAR p;
+
+	for(p = (PUCHAR) &rec->length; p < &rec->state; p++)
+		sum = ((sum << 1) | (sum >> 31)) + *p;
+	for(i = 0; i < rec->length; i++)
+		sum = ((sum << 1) | (sum >> 31)) + data[i];
+
+	return(sum);
+}
+
+
+/*
+ * Build into 'path' the name of segment number 'n' in the spool
+ * directory 'maildir'.
+ *
+ */
+
+VOID seg_name(PUCHAR path, PUCHAR maildir, ULONG n)
+{	sprintf(path, "%s\\%08lX.SEG", maildir, n);
+}
+
+/*
+ * End of file: segread.c
+ *
+ */
+
\ No newline at end of file
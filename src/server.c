@@ -1,8 +1,8 @@
 /*
  * File: server.c
  *
- * SMTP daemon for receiving mail on Tavi network; to be invoked only
- * by INETD.
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
  *
  * Protocol handler for server
  *
@@ -12,60 +12,76 @@
 
 #pragma	strings(readonly)
 
-#pragma	alloc_text(a_init_seg, server)
-#pragma	alloc_text(a_init_seg, greeting)
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "smtpd.h"
 #include "cmds.h"
+#include "clock.h"
+#include "evlog.h"
 #include "mailstor.h"
 #include "netio.h"
+#include "resolve.h"
+#include "sync.h"
+#include "session.h"
 
-#define	MAXCMD		514		/* Maximum length of a command */
-#define	MAXLINE		1002		/* Maximum length of line */
-#define	MAXREPLY	514		/* Maximum length of reply message */
 #define	CMD_TIMEOUT	60		/* Command timeout (secs) */
 #define	DATA_TIMEOUT	60		/* Data timeout (secs) */
 #define	MSG_TIMEOUT	5		/* Fatal message write timeout (secs) */
+#define	NAME_TIMEOUT	30		/* Longest wait for client name (secs) */
+#define	MAXBATCH	32		/* Input items dealt with per call */
+
+/* Macros */
 
-/* Type definitions */
+/* Fixed replies are queued for sending without being copied */
 
-typedef	enum	{ ST_CONNECT, ST_READY, ST_MAIL, ST_RCPT, ST_DATA }
-	STATE;
+#define	REPLY(s, r)	sock_putr((r), sizeof(r)-1, &(s)->net, CMD_TIMEOUT)
 
 /* Forward references */
 
-static	BOOL	do_helo(INT, UCHAR [], PUCHAR);
-static	BOOL	do_ehlo(INT, UCHAR [], PUCHAR);
-static	VOID	do_help(INT);
-static	BOOL	do_data(INT, PUCHAR, PUCHAR, PUCHAR, PUCHAR);
-static	VOID	do_mail(INT, UCHAR []);
-static	VOID	do_quit(INT, PUCHAR);
-static	VOID	do_rcpt(INT, UCHAR []);
-static	VOID	expect_ehlo(INT);
+static	BOOL	client_name(PSESSION);
+static	VOID	commit_message(PSESSION, INT);
+static	BOOL	do_bdat(PSESSION);
+static	VOID	do_chunk(PSESSION, PUCHAR, INT);
+static	BOOL	do_command(PSESSION, INT);
+static	BOOL	do_data(PSESSION);
+static	BOOL	do_data_line(PSESSION);
+static	BOOL	do_ehlo(PSESSION);
+static	BOOL	do_helo(PSESSION);
+static	VOID	do_help(PSESSION);
+static	VOID	do_mail(PSESSION);
+static	VOID	do_quit(PSESSION);
+static	VOID	do_rcpt(PSESSION);
+static	VOID	end_chunk(PSESSION);
+static	VOID	end_message(PSESSION);
+static	VOID	expect_ehlo(PSESSION);
 static	INT	getcmd(PUCHAR);
-static	VOID	greeting(INT, PUCHAR);
-static	VOID	net_read_error(INT, PUCHAR);
-static	VOID	net_read_timeout(INT, PUCHAR);
+static	BOOL	too_big(PSESSION, ULONG);
+static	VOID	greeting(PSESSION);
+static	BOOL	hello(PSESSION);
+static	VOID	net_read_error(PSESSION);
+static	VOID	net_read_timeout(PSESSION);
 static	BOOL	no_params(PUCHAR);
-static	VOID	process_commands(INT, PUCHAR, PUCHAR, PUCHAR);
+static	BOOL	size_param(PUCHAR, PULONG);
+static	BOOL	start_message(PSESSION);
 
 /* Local storage */
 
-static	BOOL	esmtp;			/* True if EHLO seen */
-static	UCHAR	logmsg[MAXREPLY];	/* Logging buffer */
-static	UCHAR	*msg_id;		/* Message ID as a string */
-static	INT	nrcpts;			/* Number of recipients so far */
-static	STATE	state;			/* Internal state */
+static	PUCHAR	extensions[] = {	/* Service extensions, for EHLO */
+	"PIPELINING",			/* RFC2920 */
+	"CHUNKING",			/* RFC3030 */
+	(PUCHAR) NULL
+};
 
 
 /*
- * Do the conversation between the server and the client.
+ * Do the conversation between the server and the client, waiting for
+ * input as necessary. This is used when there is only one session in
+ * the process (INETD mode).
  *
  * Returns:
  *	TRUE		server ran and terminated
@@ -73,246 +89,398 @@ static	STATE	state;			/* Internal state */
  *
  */
 
+BOOL server(PSESSION sess)
+{	if(server_open(sess, FALSE) == FALSE) return(FALSE);
 
-BOOL server(INT sockno, PUCHAR clientname, PUCHAR clientip,
-		PUCHAR servername, PUCHAR direnv)
-{	INT rc;
-	PUCHAR mes;
-
-	rc = mail_init(direnv);
-	switch(rc) {
-		case MAILINIT_OK:
-			break;
+	while(server_input(sess) != SERVER_DONE)
+		;
 
-		case MAILINIT_NOENV:
-			error("environment variable %s not set", direnv);
-			return(FALSE);
+	return(TRUE);
+}
 
-		case MAILINIT_BADDIR:
-			error("cannot access mail storage directory");
-			return(FALSE);
 
-		default:
-			error("mail storage initialisation failed");
-			return(FALSE);
-	}
+/*
+ * Start a new session on the socket in 'sess', and send the greeting.
+ * If 'nonblock' is TRUE, the socket is made non-blocking, and the caller
+ * must call server_input() whenever input arrives, or whenever the
+ * socket becomes writable while output is held back (see sock_blocked()),
+ * and server_timeout() if nothing happens before the session deadline.
+ *
+ * Returns:
+ *	TRUE		session started
+ *	FALSE		session failed to start
+ *
+ */
 
-	if(netio_init() == FALSE) {
+BOOL server_open(PSESSION sess, BOOL nonblock)
+{	if(netio_init(&sess->net, sess->sockno, nonblock) == FALSE) {
 		error("network initialisation failure");
 		return(FALSE);
 	}
 
-	greeting(sockno, servername);
+	sess->state = ST_CONNECT;
+	sess->esmtp = FALSE;
+	sess->nrcpts = 0;
+	sess->logmsg[0] = '\0';
+	sess->parked = FALSE;
+	sess->chunk = 0;
+
+	greeting(sess);
+	(VOID) sock_flush(&sess->net, CMD_TIMEOUT);
 
-	process_commands(sockno, clientname, clientip, servername);
+	(VOID) time(&sess->deadline);
+	sess->deadline += CMD_TIMEOUT;
 
 	return(TRUE);
 }
 
 
 /*
- * Process SMTP commands.
+ * Process input from the client. All complete lines already received
+ * are dealt with; on a non-blocking socket, control returns as soon as
+ * more input is needed. On a blocking socket, this waits for input as
+ * necessary. Replies are held back until all of the input to hand has
+ * been dealt with, then sent together; this is what makes PIPELINING
+ * (RFC2920) effective, since a client may send a whole group of commands
+ * at once.
+ *
+ * So that one busy client cannot keep the others waiting, at most
+ * MAXBATCH lines (or pieces of a BDAT chunk) are dealt with on each
+ * call. If input is left in the buffer after that, control returns at
+ * once; sock_pending() tells the caller that the session should be run
+ * again without waiting for the socket.
+ *
+ * On a non-blocking socket, replies that the client is not reading are
+ * held back rather than waited for. No more input is dealt with until
+ * they have gone, so that the replies cannot pile up without limit.
+ *
+ * On a non-blocking socket, a DATA command that arrives before the
+ * client's host name is known parks the session (see client_name()),
+ * as does the end of a message that is being flushed to disk with
+ * others (see end_message()). The caller should then call this again
+ * from time to time, without waiting for input, until the session is
+ * no longer parked.
+ *
+ * Returns:
+ *	SERVER_MORE	waiting for more input or to send output,
+ *			or parked
+ *	SERVER_DONE	session has finished
  *
  */
 
-static VOID process_commands(INT sockno, PUCHAR clientname, PUCHAR clientip,
-			PUCHAR servername)
-{	INT cmd, len, i;
-	UCHAR cmdbuf[MAXCMD+1];
-	BOOL nlflag;
-#ifdef	DEBUG
-	UCHAR dbugbuf1[10];
-	UCHAR dbugbuf2[MAXCMD*3+1];
-#endif
-	state = ST_CONNECT;
+INT server_input(PSESSION sess)
+{	INT len, size, timeout, rc;
+	INT n = 0;
+	PUCHAR data;
+
+	if(sess->parked == TRUE && sess->state == ST_SYNC) {
+		rc = sync_wait(&sess->sync);
+		if(rc == SYNC_PENDING) return(SERVER_MORE);
+		sess->parked = FALSE;
+		commit_message(sess, rc);
+	} else if(sess->parked == TRUE) {	/* Retry the parked command */
+		if(client_name(sess) == FALSE) return(SERVER_MORE);
+		sess->parked = FALSE;
+		if(do_command(sess, strlen(sess->line)) == FALSE)
+			return(SERVER_DONE);
+	}
 
 	for(;;) {
-		len = sock_gets(cmdbuf, sizeof(cmdbuf), sockno, CMD_TIMEOUT);
-		if(len == SOCKIO_ERR) {
-			net_read_error(sockno, servername);
-			return;
+		if(sess->parked == TRUE) {
+			(VOID) sock_flush(&sess->net, CMD_TIMEOUT);
+			return(SERVER_MORE);
+		}
+		if(sock_blocked(&sess->net) == TRUE) {
+			(VOID) sock_flush(&sess->net, CMD_TIMEOUT);
+			if(sock_blocked(&sess->net) == TRUE) {
+				(VOID) time(&sess->deadline);
+				sess->deadline += CMD_TIMEOUT;
+				return(SERVER_MORE);
+			}
+		}
+		if(n >= MAXBATCH && sock_pending(&sess->net) == TRUE)
+			return(SERVER_MORE);	/* Let other sessions run */
+		n++;
+		if(sess->chunk > 0) {		/* Within a BDAT chunk */
+			timeout = DATA_TIMEOUT;
+			len = sock_read(&data, sess->chunk, &sess->net, timeout);
+		} else {
+			if(sess->state == ST_DATA) {
+				size = MAXLINE+1;
+				timeout = DATA_TIMEOUT;
+			} else {
+				size = MAXCMD+1;
+				timeout = CMD_TIMEOUT;
+			}
+
+			len = sock_gets(sess->line, size, &sess->net, timeout);
+		}
+		if(len == SOCKIO_AGAIN) {
+			(VOID) time(&sess->deadline);
+			sess->deadline += timeout;
+			return(SERVER_MORE);
+		}
+		if(len == SOCKIO_ERR || len == 0) {
+			net_read_error(sess);
+			return(SERVER_DONE);
 		}
 		if(len == SOCKIO_TIMEOUT) {
-			net_read_timeout(sockno, servername);
-			return;
+			net_read_timeout(sess);
+			return(SERVER_DONE);
+		}
+		if(sess->chunk > 0) {
+			do_chunk(sess, data, len);
+			continue;
 		}
 		if(len == SOCKIO_TOOLONG) {
-			sock_puts("500 Line too long\n", sockno, CMD_TIMEOUT);
+			REPLY(sess, "500 Line too long\r\n");
 			continue;
 		}
 
-		cmd = getcmd(cmdbuf);
-		for(i = 0; i < CMDSIZE; i++)
-			cmdbuf[i] = toupper(cmdbuf[i]);
+		if(sess->state == ST_DATA) {
+			if(do_data_line(sess) == FALSE) return(SERVER_DONE);
+		} else {
+			if(do_command(sess, len) == FALSE) return(SERVER_DONE);
+		}
+	}
+}
 
-		/* Remove the trailing newline, strip trailing spaces,
-		   then put it back. */
 
-		nlflag = FALSE;
-		if(cmdbuf[len-1] == '\n') {
-			nlflag = TRUE;
-			len--;
-		}
-		while(cmdbuf[len-1] == ' ') len--;
-		if(nlflag == TRUE) cmdbuf[len++] = '\n';
-		cmdbuf[len] = '\0';
+/*
+ * Called when no input has arrived before the session deadline.
+ *
+ */
+
+VOID server_timeout(PSESSION sess)
+{	net_read_timeout(sess);
+}
+
+
+/*
+ * Write a string of log entry type 'type' to the log, along with the
+ * session number and client address of session 'sess'.
+ *
+ */
+
+VOID session_log(PSESSION sess, UINT type, PUCHAR s)
+{	LOGINFO info;
+
+	info.session = sess->id;
+	info.client = sess->clientip;
+	info.mail_id = (PUCHAR) NULL;
+	info.size = 0;
+	dolog_info(type, &info, s);
+}
+
+
+/*
+ * Make sure that the client's host name is known, as it is needed for
+ * the Received: line. On a blocking socket, this waits for the lookup
+ * to finish. On a non-blocking socket it does not wait; if the lookup
+ * takes too long, the bracketed address is used instead.
+ *
+ * Returns:
+ *	TRUE		client name is in the session
+ *	FALSE		lookup still in progress
+ *
+ */
+
+static BOOL client_name(PSESSION sess)
+{	time_t now;
+
+	if(sess->clientname[0] != '\0') return(TRUE);
+
+	if(resolve_name(sess->clientaddr, sess->clientname,
+			sess->net.nonblock == FALSE) == RESOLVE_OK)
+		return(TRUE);
+
+	(VOID) time(&now);
+	if(sess->parked == FALSE) {
+		sess->parktime = now;
+	} else if(now - sess->parktime >= NAME_TIMEOUT) {
+		sprintf(sess->clientname, "[%s]", sess->clientip);
+		return(TRUE);
+	}
+
+	return(FALSE);
+}
+
+
+/*
+ * Process one SMTP command, of length 'len', in the session line buffer.
+ * A DATA command may park the session, leaving the command in the line
+ * buffer to be processed again later.
+ *
+ * Returns:
+ *	TRUE		continue the session
+ *	FALSE		session has finished
+ *
+ */
+
+static BOOL do_command(PSESSION sess, INT len)
+{	INT cmd, i;
+	PUCHAR cmdbuf = sess->line;
+	BOOL nlflag;
 #ifdef	DEBUG
-		trace(cmdbuf);
-		dbugbuf2[0] = '\0';
-		for(i = 0; i < strlen(cmdbuf); i++) {
-			sprintf(dbugbuf1, "%02x ", cmdbuf[i]);
-			strcat(dbugbuf2, dbugbuf1);
-		}
-		trace(dbugbuf2);
+	UCHAR dbugbuf1[10];
+	UCHAR dbugbuf2[MAXCMD*3+1];
 #endif
 
-		switch(cmd) {
-			case EHLO:
-				esmtp = TRUE;
-				if(do_ehlo(sockno, cmdbuf, servername) == TRUE)
-					state = ST_READY;
-				break;
+	cmd = getcmd(cmdbuf);
+	for(i = 0; i < CMDSIZE; i++)
+		cmdbuf[i] = toupper(cmdbuf[i]);
 
-			case HELO:
-				esmtp = FALSE;
-				if(do_helo(sockno, cmdbuf, servername) == TRUE)
-					state = ST_READY;
-				break;
+	/* Remove the trailing newline, strip trailing spaces,
+	   then put it back. */
 
-			case NOOP:
-				if(no_params(cmdbuf) == TRUE) {
-					sock_puts(
-						"250 OK\n",
-						sockno,
-						CMD_TIMEOUT);
-				} else {
-					sock_puts(
-						"501 Syntax error "
-						"in parameters or arguments\n",
-						sockno,
-						CMD_TIMEOUT);
-				}
-				break;
+	nlflag = FALSE;
+	if(cmdbuf[len-1] == '\n') {
+		nlflag = TRUE;
+		len--;
+	}
+	while(cmdbuf[len-1] == ' ') len--;
+	if(nlflag == TRUE) cmdbuf[len++] = '\n';
+	cmdbuf[len] = '\0';
+#ifdef	DEBUG
+	trace(cmdbuf);
+	dbugbuf2[0] = '\0';
+	for(i = 0; i < strlen(cmdbuf); i++) {
+		sprintf(dbugbuf1, "%02x ", cmdbuf[i]);
+		strcat(dbugbuf2, dbugbuf1);
+	}
+	trace(dbugbuf2);
+#endif
 
-			case MAIL:
-				if(state == ST_CONNECT) {
-					expect_ehlo(sockno);
-					break;
-				}
-				if(state != ST_READY) {
-					sock_puts(
-						"503 Bad sequence of "
-						"commands\n",
-						sockno,
-						CMD_TIMEOUT);
-					break;
-				}
-				do_mail(sockno, cmdbuf);
-				break;
+	switch(cmd) {
+		case EHLO:
+			sess->esmtp = TRUE;
+			if(do_ehlo(sess) == TRUE)
+				sess->state = ST_READY;
+			break;
 
-			case RCPT:
-				if(state == ST_CONNECT) {
-					expect_ehlo(sockno);
-					break;
-				}
-				if(state != ST_MAIL && state != ST_RCPT) {
-					sock_puts(
-						"503 Bad sequence "
-						"of commands\n",
-						sockno,
-						CMD_TIMEOUT);
-					break;
-				}
-				do_rcpt(sockno, cmdbuf);
-				break;
+		case HELO:
+			sess->esmtp = FALSE;
+			if(do_helo(sess) == TRUE)
+				sess->state = ST_READY;
+			break;
 
-			case DATA:
-				if(state == ST_CONNECT) {
-					expect_ehlo(sockno);
-					break;
-				}
-				if(state != ST_RCPT) {
-					sock_puts(
-						"503 Bad sequence "
-						"of commands\n",
-						sockno,
-						CMD_TIMEOUT);
-					break;
-				}
-				if(do_data(
-					sockno,
-					clientname,
-					clientip,
-					servername,
-					cmdbuf) == FALSE) return;
-				state = ST_READY;
-				break;
+		case NOOP:
+			if(no_params(cmdbuf) == TRUE) {
+				REPLY(sess,
+					"250 OK\r\n");
+			} else {
+				REPLY(sess,
+					"501 Syntax error "
+					"in parameters or arguments\r\n");
+			}
+			break;
 
-			case RSET:
-				if(no_params(cmdbuf) == TRUE) {
-					mail_reset();
-					sock_puts(
-						"250 OK\n",
-						sockno,
-						CMD_TIMEOUT);
-					state = ST_READY;
-					logmsg[0] = '\0';
-				} else {
-					sock_puts(
-						"501 Syntax error "
-						"in parameters or arguments\n",
-						sockno,
-						CMD_TIMEOUT);
-				}
+		case MAIL:
+			if(sess->state == ST_CONNECT) {
+				expect_ehlo(sess);
 				break;
-
-			case QUIT:
-				if(no_params(cmdbuf) == TRUE) {
-					do_quit(sockno, servername);
-					return;
-				} else {
-					sock_puts(
-						"501 Syntax error "
-						"in parameters or arguments\n",
-						sockno,
-						CMD_TIMEOUT);
-				}
+			}
+			if(sess->state != ST_READY) {
+				REPLY(sess,
+					"503 Bad sequence of "
+					"commands\r\n");
 				break;
+			}
+			do_mail(sess);
+			break;
 
-			case HELP:
-				do_help(sockno);
+		case RCPT:
+			if(sess->state == ST_CONNECT) {
+				expect_ehlo(sess);
 				break;
-
-			case VRFY:
-			case EXPN:
-			case SEND:
-			case SOML:
-			case SAML:
-			case TURN:
-				sock_puts(
-					"502 Command not implemented\n",
-					sockno,
-					CMD_TIMEOUT);
+			}
+			if(sess->state != ST_MAIL && sess->state != ST_RCPT) {
+				REPLY(sess,
+					"503 Bad sequence "
+					"of commands\r\n");
 				break;
+			}
+			do_rcpt(sess);
+			break;
 
-			case BAD:
-				sock_puts(
-					"500 Syntax error, "
-					"command not recognized\n",
-					sockno,
-					CMD_TIMEOUT);
+		case DATA:
+			if(sess->state == ST_CONNECT) {
+				expect_ehlo(sess);
+				break;
+			}
+			if(sess->state != ST_RCPT) {
+				REPLY(sess,
+					"503 Bad sequence "
+					"of commands\r\n");
 				break;
+			}
+			if(client_name(sess) == FALSE) {
+				sess->parked = TRUE;
+				break;
+			}
+			if(do_data(sess) == FALSE) return(FALSE);
+			break;
 
-			default:
-				error("bad case in command switch %d", cmd);
-				sprintf(
-					cmdbuf,
-					"bad case in command switch %d\n",
-					cmd);
-				dolog(LOG_CRIT, cmdbuf);
-				exit(EXIT_FAILURE);
-		}
+		case BDAT:
+			if(do_bdat(sess) == FALSE) sess->parked = TRUE;
+			break;
+
+		case RSET:
+			if(no_params(cmdbuf) == TRUE) {
+				mail_reset(&sess->mail);
+				REPLY(sess,
+					"250 OK\r\n");
+				sess->state = ST_READY;
+				sess->logmsg[0] = '\0';
+			} else {
+				REPLY(sess,
+					"501 Syntax error "
+					"in parameters or arguments\r\n");
+			}
+			break;
+
+		case QUIT:
+			if(no_params(cmdbuf) == TRUE) {
+				do_quit(sess);
+				return(FALSE);
+			} else {
+				REPLY(sess,
+					"501 Syntax error "
+					"in parameters or arguments\r\n");
+			}
+			break;
+
+		case HELP:
+			do_help(sess);
+			break;
+
+		case VRFY:
+		case EXPN:
+		case SEND:
+		case SOML:
+		case SAML:
+		case TURN:
+			REPLY(sess,
+				"502 Command not implemented\r\n");
+			break;
+
+		case BAD:
+			REPLY(sess,
+				"500 Syntax error, "
+				"command not recognized\r\n");
+			break;
+
+		default:
+			error("bad case in command switch %d", cmd);
+			sprintf(
+				cmdbuf,
+				"bad case in command switch %d\n",
+				cmd);
+			dolog(LOG_CRIT, cmdbuf);
+			exit(EXIT_FAILURE);
 	}
+
+	return(TRUE);
 }
 
 
@@ -339,8 +507,8 @@ static INT getcmd(PUCHAR buf)
  *
  */
 
-static VOID expect_ehlo(INT sockno)
-{	sock_puts("503 Bad sequence of commands\n", sockno, CMD_TIMEOUT);
+static VOID expect_ehlo(PSESSION sess)
+{	REPLY(sess, "503 Bad sequence of commands\r\n");
 }
 
 
@@ -349,19 +517,20 @@ static VOID expect_ehlo(INT sockno)
  *
  */
 
-static VOID net_read_error(INT sockno, PUCHAR servername)
+static VOID net_read_error(PSESSION sess)
 {	UCHAR mes[MAXREPLY+1];
 
 	sprintf(
 		mes,
 		"421 %s Service closing transmission channel\n",
-		servername);
-	sock_puts(mes, sockno, MSG_TIMEOUT); 
-	dolog(LOG_ERR, "network read error\n");
+		sess->servername);
+	sock_puts(mes, &sess->net, MSG_TIMEOUT);
+	session_log(sess, LOG_ERR, "network read error\n");
+	sess->events.reason = EVR_ERROR;
 #ifdef	DEBUG
 	trace("sock_errno = %d", sock_errno());
 #endif
-	mail_reset();
+	mail_reset(&sess->mail);
 }
 
 
@@ -370,16 +539,17 @@ static VOID net_read_error(INT sockno, PUCHAR servername)
  *
  */
 
-static VOID net_read_timeout(INT sockno, PUCHAR servername)
+static VOID net_read_timeout(PSESSION sess)
 {	UCHAR mes[MAXREPLY+1];
 
 	sprintf(
 		mes,
 		"421 %s Service closing transmission channel\n",
-		servername);
-	sock_puts(mes, sockno, MSG_TIMEOUT); 
-	dolog(LOG_ERR, "network read timeout\n");
-	mail_reset();
+		sess->servername);
+	sock_puts(mes, &sess->net, MSG_TIMEOUT);
+	session_log(sess, LOG_ERR, "network read timeout\n");
+	sess->events.reason = EVR_TIMEOUT;
+	mail_reset(&sess->mail);
 }
 
 
@@ -388,34 +558,55 @@ static VOID net_read_timeout(INT sockno, PUCHAR servername)
  *
  */
 
-static VOID greeting(INT sockno, PUCHAR servername)
+static VOID greeting(PSESSION sess)
 {	UCHAR mes[MAXREPLY+1];
 
 	sprintf(
 		mes,
 		"220 %s SMTP server version %d.%d ready\n",
-		servername,
+		sess->servername,
 		VERSION,
 		EDIT);
-	sock_puts(mes, sockno, CMD_TIMEOUT);
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
 }
 
 
 /*
- * Handle a EHLO command.
+ * Handle a EHLO command. This is the same as HELO, except that the
+ * reply lists the service extensions supported.
  *
  * Returns:
  *	TRUE	if command OK
  *	FALSE	if syntax error
  *
- * Currently, there are no service extensions defined;
- * thus, EHLO is treated exactly the same as HELO.
- *
  */
 
-static BOOL do_ehlo(INT sockno, PUCHAR cmdbuf, PUCHAR servername)
-{
-	return(do_helo(sockno, cmdbuf, servername));
+static BOOL do_ehlo(PSESSION sess)
+{	INT i;
+	UCHAR mes[MAXREPLY+1];
+
+	if(hello(sess) == FALSE) return(FALSE);
+
+	sprintf(mes, "250-%s service ready\n", sess->servername);
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
+
+	/* SIZE (RFC1870) carries the size limit, so is done separately */
+
+	if(sess->mail.spool->maxsize != 0)
+		sprintf(mes, "250-SIZE %lu\n", sess->mail.spool->maxsize);
+	else
+		strcpy(mes, "250-SIZE\n");
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
+	for(i = 0; extensions[i] != (PUCHAR) NULL; i++) {
+		sprintf(
+			mes,
+			"250%c%s\n",
+			extensions[i+1] == (PUCHAR) NULL ? ' ' : '-',
+			extensions[i]);
+		sock_puts(mes, &sess->net, CMD_TIMEOUT);
+	}
+
+	return(TRUE);
 }
 
 
@@ -428,24 +619,42 @@ static BOOL do_ehlo(INT sockno, PUCHAR cmdbuf, PUCHAR servername)
  *
  */
 
-static BOOL do_helo(INT sockno, PUCHAR cmdbuf, PUCHAR servername)
+static BOOL do_helo(PSESSION sess)
 {	UCHAR mes[MAXREPLY+1];
-	PUCHAR p = &cmdbuf[CMDSIZE];
+
+	if(hello(sess) == FALSE) return(FALSE);
+
+	sprintf(mes, "250 %s service ready\n", sess->servername);
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
+
+	return(TRUE);
+}
+
+
+/*
+ * Common processing for EHLO and HELO; checks the parameter, and
+ * resets the session.
+ *
+ * Returns:
+ *	TRUE	if command OK
+ *	FALSE	if syntax error (reply already sent)
+ *
+ */
+
+static BOOL hello(PSESSION sess)
+{	PUCHAR p = &sess->line[CMDSIZE];
 
 	while(*p == ' ') p++;
 	if(*p == '\n') {
-		sock_puts(
-			"501 Syntax error in parameters or arguments\n",
-			sockno,
-			CMD_TIMEOUT);
+		REPLY(sess,
+			"501 Syntax error in parameters or arguments\r\n");
 		return(FALSE);
 	}
 
-	sprintf(mes, "250 %s service ready\n", servername);
-	sock_puts(mes, sockno, CMD_TIMEOUT);
-
-	mail_reset();			/* In case this is not first time */
-	logmsg[0] = '\0';
+	mail_reset(&sess->mail);	/* In case this is not first time */
+	sess->logmsg[0] = '\0';
+	ev_put(&sess->events, EV_HELO,
+		sess->esmtp == TRUE ? EVF_ESMTP : 0, 0, p);
 
 	return(TRUE);
 }
@@ -456,14 +665,15 @@ static BOOL do_helo(INT sockno, PUCHAR cmdbuf, PUCHAR servername)
  *
  */
 
-static VOID do_quit(INT sockno, PUCHAR servername)
+static VOID do_quit(PSESSION sess)
 {	UCHAR mes[MAXREPLY+1];
 
 	sprintf(
 		mes,
 		"221 %s Service closing transmission channel\n",
-		servername);
-	sock_puts(mes, sockno, CMD_TIMEOUT);
+		sess->servername);
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
+	sess->events.reason = EVR_QUIT;
 }
 
 
@@ -472,219 +682,490 @@ static VOID do_quit(INT sockno, PUCHAR servername)
  *
  */
 
-static VOID do_mail(INT sockno, PUCHAR cmdbuf)
+static VOID do_mail(PSESSION sess)
 {	static UCHAR from[] = { 'F', 'R', 'O', 'M', ':' };
+	INT rc;
+	ULONG size;
+	PUCHAR cmdbuf = sess->line;
 	PUCHAR p = &cmdbuf[CMDSIZE];
 
 	while(*p == ' ') p++;		/* Skip spaces and move to "From:" */
 
 	if(((strlen(p) <= sizeof(from)+1) ||
-	   (strnicmp(p, from, sizeof(from)) != 0))) {
-		sock_puts(
-			"501 Syntax error in parameters or arguments\n",
-			sockno,
-			CMD_TIMEOUT);
+	   (strnicmp(p, from, sizeof(from)) != 0)) ||
+	   size_param(p, &size) == FALSE) {
+		REPLY(sess,
+			"501 Syntax error in parameters or arguments\r\n");
+		return;
+	}
+
+	/* Refuse a message that is too big before any of it is sent */
+
+	rc = mail_check(&sess->mail, size);
+	if(rc == MAILSIZE_TOOBIG) {
+		REPLY(sess,
+			"552 Message size exceeds fixed maximum "
+			"message size\r\n");
 	} else {
-		if(mail_open(&msg_id) == FALSE ||
-		   mail_store(cmdbuf) == FALSE) {
-			sock_puts(
+		if(rc == MAILSIZE_NOSPACE ||
+		   mail_open(&sess->mail, &sess->msg_id, size,
+				p + sizeof(from)) == FALSE ||
+		   mail_store(&sess->mail, cmdbuf) == FALSE) {
+			REPLY(sess,
 				"452 Requested action not taken: "
-				"insufficient system storage\n",
-				sockno,
-				CMD_TIMEOUT);
+				"insufficient system storage\r\n");
 		} else {
-			strcpy(logmsg, "mail from ");
-			strcat(logmsg, p + sizeof(from));
-			logmsg[strlen(logmsg)-1] = '\0';	/* Lose '\n' */
-			sock_puts("250 OK\n", sockno, CMD_TIMEOUT);
-			nrcpts = 0;
-			state = ST_MAIL;
+			strcpy(sess->logmsg, "mail from ");
+			strcat(sess->logmsg, p + sizeof(from));
+			sess->logmsg[strlen(sess->logmsg)-1] = '\0';
+							/* Lose '\n' */
+			ev_put(&sess->events, EV_MAIL, 0, size,
+				p + sizeof(from));
+			REPLY(sess, "250 OK\r\n");
+			sess->nrcpts = 0;
+			sess->state = ST_MAIL;
 		}
 	}
 }
 
 
+/*
+ * Look for a SIZE parameter (RFC1870) after the reverse path in the
+ * MAIL command text 'p'; if found, its value is returned in 'size' and
+ * the parameter is removed from the command, which is stored in the
+ * mail file. If there is none, 'size' is set to zero.
+ *
+ * Returns:
+ *	TRUE	if parameters OK
+ *	FALSE	if SIZE parameter is malformed
+ *
+ */
+
+static BOOL size_param(PUCHAR p, PULONG size)
+{	ULONG n;
+	PUCHAR q;
+
+	*size = 0;
+
+	p = strchr(p, '>');
+	if(p == (PUCHAR) NULL) return(TRUE);	/* No parameters */
+
+	while(*p != '\0') {
+		if(*p != ' ' || strnicmp(p+1, "SIZE=", 5) != 0) {
+			p++;
+			continue;
+		}
+		q = p + 6;
+		if(!isdigit(*q)) return(FALSE);
+		for(n = 0; isdigit(*q); q++) {
+			if(n > (ULONG_MAX - 9)/10) return(FALSE);
+			n = n*10 + (*q - '0');
+		}
+		if(*q != ' ' && *q != '\n') return(FALSE);
+		*size = n;
+		memmove(p, q, strlen(q)+1);	/* Remove it */
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Check whether 'extra' more bytes of message text would take the
+ * message beyond the size limit.
+ *
+ * Returns:
+ *	TRUE	if message would be too big
+ *	FALSE	if message is within the limit
+ *
+ */
+
+static BOOL too_big(PSESSION sess, ULONG extra)
+{	ULONG max = sess->mail.spool->maxsize;
+
+	if(max == 0) return(FALSE);
+
+	return(sess->octets > max || extra > max - sess->octets ?
+		TRUE : FALSE);
+}
+
+
 /*
  * Handle a RCPT command.
  *
  */
 
-static VOID do_rcpt(INT sockno, PUCHAR cmdbuf)
+static VOID do_rcpt(PSESSION sess)
 {	static UCHAR to[] = { 'T', 'O', ':' };
+	PUCHAR cmdbuf = sess->line;
 	PUCHAR p = cmdbuf + CMDSIZE;
 
 	while(*p == ' ') p++;		/* Skip spaces and move to "To:" */
 
 	if(((strlen(p) <= sizeof(to)+1) ||
 	   (strnicmp(p, to, sizeof(to)) != 0))) {
-		sock_puts(
-			"501 Syntax error in parameters or arguments\n",
-			sockno,
-			CMD_TIMEOUT);
+		REPLY(sess,
+			"501 Syntax error in parameters or arguments\r\n");
 	} else {
-		if(mail_store(cmdbuf) == FALSE) {
-			sock_puts(
+		if(mail_store(&sess->mail, cmdbuf) == FALSE) {
+			REPLY(sess,
 				"452 Requested action not taken: "
-				"insufficient system storage\n",
-				sockno,
-				CMD_TIMEOUT);
+				"insufficient system storage\r\n");
 		} else {
-			if(++nrcpts == 1) {
-				strcat(logmsg, " to ");
-				strcat(logmsg, p + sizeof(to));
-				logmsg[strlen(logmsg)-1] = '\0';/* Lose '\n' */
+			if(++sess->nrcpts == 1) {
+				strcat(sess->logmsg, " to ");
+				strcat(sess->logmsg, p + sizeof(to));
+				sess->logmsg[strlen(sess->logmsg)-1] = '\0';
+							/* Lose '\n' */
 			} else {
-				if(nrcpts == 2) strcat(logmsg, "...");
+				if(sess->nrcpts == 2)
+					strcat(sess->logmsg, "...");
 			}
-			sock_puts("250 OK\n", sockno, CMD_TIMEOUT);
-			state = ST_RCPT;
+			ev_put(&sess->events, EV_RCPT, 0,
+				(ULONG) sess->nrcpts, p + sizeof(to));
+			REPLY(sess, "250 OK\r\n");
+			sess->state = ST_RCPT;
 		}
 	}
 }
 
 
 /*
- * Handle a DATA command.
+ * Handle a DATA command. This invites the client to send the message;
+ * the message text itself is handled by do_data_line().
  *
  * Returns:
- *	TRUE	if message stored OK
- *	FALSE	if message not stored OK
+ *	TRUE	if ready for message text
+ *	FALSE	if message cannot be stored
  *
  */
 
-static BOOL do_data(INT sockno, PUCHAR clientname, PUCHAR clientip,
-			PUCHAR servername, PUCHAR cmdbuf)
-{	time_t tod, utc, utcdiff;
-	struct tm gtm;
-	INT len, index;
-	PUCHAR p = cmdbuf + CMDSIZE;
-	UCHAR offset[20];
-	UCHAR timeinfo[40];
-	UCHAR buf[MAXLINE+1];
-	UCHAR buf2[MAXLINE+1];
+static BOOL do_data(PSESSION sess)
+{	PUCHAR p = sess->line + CMDSIZE;
 
 	while(*p == ' ') p++;		/* Skip spaces */
 
 	if(*p != '\n') {		/* Something else on the line */
-		sock_puts(
-			"501 Syntax error in parameters or arguments\n",
-			sockno,
-			CMD_TIMEOUT);
+		REPLY(sess,
+			"501 Syntax error in parameters or arguments\r\n");
 		return(FALSE);
 	}
 
-	/* Set up timestamp. To be RFC2821 compliant, the timezone
-	   must be displayed as an offset. To get that offset, we
-	   get the UTC time into a 'tm' structure using gmtime, then
-	   convert it back to a 'time_t' so that we can use difftime
-	   to get the actual difference. */
+	if(start_message(sess) == FALSE) {
+		REPLY(sess,
+			"452 Requested action not taken: "
+			"insufficient system storage\r\n");
+		return(FALSE);
+	}
+
+	REPLY(sess, "354 Start mail input; end with <CRLF>.<CRLF>\r\n");
+	sess->state = ST_DATA;
+	sess->octets = 0;
+	ev_put(&sess->events, EV_DATA, 0, 0, (PUCHAR) NULL);
+
+	return(TRUE);
+}
+
+
+/*
+ * Handle a BDAT command (RFC3030). The chunk of message text that
+ * follows the command is read by do_chunk(), straight into the mail
+ * file; the reply is sent once the whole chunk has arrived. A chunk
+ * that cannot be accepted must still be read, so that it is not taken
+ * for commands.
+ *
+ * Returns:
+ *	TRUE	if command dealt with
+ *	FALSE	if the client's host name is not yet known
+ *
+ */
+
+static BOOL do_bdat(PSESSION sess)
+{	ULONG size = 0;
+	BOOL last = FALSE;
+	BOOL ok;
+	PUCHAR p = sess->line + CMDSIZE;
+
+	/* Get the chunk size, and see if this is the last chunk */
+
+	ok = *p == ' ' ? TRUE : FALSE;
+	while(*p == ' ') p++;		/* Skip spaces */
+	if(!isdigit(*p)) ok = FALSE;
+	for(; isdigit(*p); p++) {
+		if(size > (ULONG_MAX - 9)/10) ok = FALSE;
+		size = size*10 + (*p - '0');
+	}
+	while(*p == ' ') p++;
+	if(strnicmp(p, "LAST", 4) == 0) {
+		last = TRUE;
+		p += 4;
+		while(*p == ' ') p++;
+	}
+	if(*p != '\n') ok = FALSE;
+
+	if(ok == FALSE) {
+		REPLY(sess,
+			"501 Syntax error in parameters or arguments\r\n");
+		return(TRUE);
+	}
+
+	/* The first chunk needs the client name for the Received: line */
+
+	if(sess->state == ST_RCPT && client_name(sess) == FALSE)
+		return(FALSE);
+
+	sess->chunk = size;
+	sess->lastchunk = last;
+	sess->chunkreply = (PUCHAR) NULL;
+
+	if(sess->state == ST_RCPT) {
+		sess->octets = 0;
+		if(start_message(sess) == FALSE) {
+			mail_reset(&sess->mail);
+			sess->state = ST_READY;
+			sess->chunkreply =
+				"452 Requested action not taken: "
+				"insufficient system storage\r\n";
+		} else {
+			sess->state = ST_BDAT;
+			ev_put(&sess->events, EV_DATA, EVF_BDAT, 0,
+				(PUCHAR) NULL);
+		}
+	} else if(sess->state != ST_BDAT) {
+		sess->chunkreply = "503 Bad sequence of commands\r\n";
+	}
+
+	if(sess->state == ST_BDAT && too_big(sess, size) == TRUE)
+		sess->chunkreply =
+			"552 Message size exceeds fixed maximum "
+			"message size\r\n";
+
+	if(size == 0) end_chunk(sess);
+
+	return(TRUE);
+}
+
+
+/*
+ * Handle 'len' bytes of a BDAT chunk, at 'data'. Storage failure is
+ * not reported until the end of the chunk; the rest of the chunk is
+ * then discarded.
+ *
+ */
+
+static VOID do_chunk(PSESSION sess, PUCHAR data, INT len)
+{	sess->chunk -= len;
+
+	if(sess->chunkreply == (PUCHAR) NULL) {
+		if(mail_write(&sess->mail, data, len) == FALSE)
+			sess->chunkreply =
+				"452 Requested action not taken: "
+				"insufficient system storage\r\n";
+		sess->octets += len;
+	}
+
+	if(sess->chunk == 0) end_chunk(sess);
+}
 
-	(VOID) time(&tod);
-	gtm = *(gmtime(&tod));		/* Get UTC as a structure */
-	utc = mktime(&gtm);		/* Convert back to time_t */
-	utcdiff = difftime(tod, utc)/60;/* Offset in minutes */
-	sprintf(
-		offset,
-		" %c%02d%02d",
-		utcdiff >= 0 ? '+': '-', abs(utcdiff)/60, abs(utcdiff)%60);
 
-	(VOID) strftime(
-			timeinfo,
-			sizeof(timeinfo),
-			"%a, %Od %b %Y %X",
-			localtime(&tod));
-	strcat(timeinfo, offset);
+/*
+ * Reply at the end of a BDAT chunk. After the last chunk, the message
+ * is committed.
+ *
+ */
+
+static VOID end_chunk(PSESSION sess)
+{	UCHAR mes[MAXREPLY+1];
+
+	if(sess->chunkreply != (PUCHAR) NULL) {
+		if(sess->state == ST_BDAT) {	/* Message abandoned */
+			ev_put(&sess->events, EV_DATAEND, 0, sess->octets,
+				(PUCHAR) NULL);
+			mail_reset(&sess->mail);
+			sess->state = ST_READY;
+		}
+		sock_putr(
+			sess->chunkreply,
+			strlen(sess->chunkreply),
+			&sess->net,
+			CMD_TIMEOUT);
+		return;
+	}
+
+	if(sess->lastchunk == TRUE) {
+		end_message(sess);
+		return;
+	}
+
+	sprintf(mes, "250 %lu octets received\n", sess->octets);
+	sock_puts(mes, &sess->net, CMD_TIMEOUT);
+}
+
+
+/*
+ * Start storing the message text, by writing the Received: line.
+ *
+ * Returns:
+ *	TRUE	if ready for message text
+ *	FALSE	if message cannot be stored
+ *
+ */
+
+static BOOL start_message(PSESSION sess)
+{	time_t tod;
+	UCHAR timeinfo[CLOCK_MAXSTR];
+	UCHAR buf[MAXLINE+1];
+	UCHAR buf2[MAXLINE+1];
+
+	/* Set up timestamp, with the timezone as an offset */
+
+	(VOID) time(&tod);
+	(VOID) clock_format(CLOCK_RFC5322, tod, timeinfo);
 
 	sprintf(
 		buf,
 		"Received: from %s (%s) by %s\n",
-		clientname,
-		clientip,
-		servername);
+		sess->clientname,
+		sess->clientip,
+		sess->servername);
 	sprintf(buf2,
 		"          with %s id %s; %s\n",
-		esmtp == TRUE ? "ESMTP" : "SMTP",
-		msg_id,
+		sess->esmtp == TRUE ? "ESMTP" : "SMTP",
+		sess->msg_id,
 		timeinfo);
 #ifdef	DEBUG
 	trace("%s", buf);
 	trace("%s", buf2);
 #endif
-	if(mail_store("DATA\n") == FALSE ||
-	   mail_store(buf) == FALSE ||
-	   mail_store(buf2) == FALSE) {
-		sock_puts(
-			"452 Requested action not taken: "
-			"insufficient system storage\n",
-			sockno,
-			CMD_TIMEOUT);
+	if(mail_store(&sess->mail, "DATA\n") == FALSE ||
+	   mail_store(&sess->mail, buf) == FALSE ||
+	   mail_store(&sess->mail, buf2) == FALSE)
 		return(FALSE);
-	}
 
-	sock_puts("354 Start mail input; end with <CRLF>.<CRLF>\n",
-		sockno, CMD_TIMEOUT);
-	state = ST_DATA;
+	return(TRUE);
+}
 
-	for (;;) {
-		index = 0;
-		len = sock_gets(buf, sizeof(buf), sockno, DATA_TIMEOUT);
-		if(len == SOCKIO_ERR || len == 0) {
-			net_read_error(sockno, servername);
-			return(FALSE);
-		}
-		if(len == SOCKIO_TIMEOUT) {
-			net_read_timeout(sockno, servername);
-			return(FALSE);
-		}
-		if(len == SOCKIO_TOOLONG) {
-			sock_puts("500 Line too long\n", sockno, CMD_TIMEOUT);
-			continue;
-		}
 
-		if (buf[0] == '.') {
-			index = 1;			/* Un-stuff dots */
-			if(buf[index] == '\n') break;	/* End of data */
-		}
-		if(mail_store(&buf[index]) == FALSE) {
-			sock_puts(
-				"452 Requested action not taken: "
-				"insufficient system storage\n",
-				sockno,
-				CMD_TIMEOUT);
-			return(FALSE);
+/*
+ * Handle a line of message text, in the session line buffer. The end
+ * of the message commits it for onward transmission, unless it has
+ * grown beyond the size limit.
+ *
+ * Returns:
+ *	TRUE	if line handled OK
+ *	FALSE	if message not stored OK
+ *
+ */
+
+static BOOL do_data_line(PSESSION sess)
+{	INT index = 0;
+	PUCHAR buf = sess->line;
+
+	if (buf[0] == '.') {
+		index = 1;			/* Un-stuff dots */
+		if(buf[index] == '\n') {	/* End of data */
+			if(too_big(sess, 0) == TRUE) {
+				ev_put(&sess->events, EV_DATAEND, 0,
+					sess->octets, (PUCHAR) NULL);
+				mail_reset(&sess->mail);
+				REPLY(sess,
+					"552 Message size exceeds fixed "
+					"maximum message size\r\n");
+				sess->state = ST_READY;
+				return(TRUE);
+			}
+			end_message(sess);
+			return(TRUE);
 		}
-#ifdef	DEBUG
-		trace("data(%d): %s", strlen(buf), buf);
-#endif
 	}
 
-	if(mail_close() == FALSE) {
-		sock_puts(
+	/* Once the message is too big, the rest of it is discarded */
+
+	sess->octets += strlen(&buf[index]) + 1;	/* Stored with CRLF */
+	if(too_big(sess, 0) == TRUE) return(TRUE);
+
+	if(mail_store(&sess->mail, &buf[index]) == FALSE) {
+		REPLY(sess,
 			"452 Requested action not taken: "
-			"insufficient system storage\n",
-			sockno,
-			CMD_TIMEOUT);
+			"insufficient system storage\r\n");
+		return(FALSE);
 	}
+#ifdef	DEBUG
+	trace("data(%d): %s", strlen(buf), buf);
+#endif
 
-	dolog(LOG_INFO, logmsg);
-	sock_puts("250 OK\n", sockno, CMD_TIMEOUT);
 	return(TRUE);
 }
 
 
+/*
+ * Deal with the end of a complete message. It must be safe on disk
+ * before the client is told that it has been accepted; if it is being
+ * flushed together with others, the session is parked until that has
+ * been done.
+ *
+ */
+
+static VOID end_message(PSESSION sess)
+{	INT rc = SYNC_FAILED;
+
+	ev_put(&sess->events, EV_DATAEND, 0, sess->octets, (PUCHAR) NULL);
+	if(mail_finish(&sess->mail) == TRUE)
+		rc = sync_start(sess->mail.mailfd, &sess->sync);
+
+	if(rc == SYNC_PENDING) {
+		sess->state = ST_SYNC;
+		sess->parked = TRUE;
+		return;
+	}
+
+	commit_message(sess, rc);
+}
+
+
+/*
+ * Commit a complete message for onward transmission, and reply to the
+ * client; 'rc' is the result of flushing it to disk.
+ *
+ */
+
+static VOID commit_message(PSESSION sess, INT rc)
+{	INT flags = 0;
+	LOGINFO info;
+
+	if(rc != SYNC_OK ||
+	   mail_close(&sess->mail, sess->nrcpts) == FALSE) {
+		mail_reset(&sess->mail);
+		REPLY(sess,
+			"452 Requested action not taken: "
+			"insufficient system storage\r\n");
+		flags = EVF_FAILED;
+	} else {
+		REPLY(sess, "250 OK\r\n");
+	}
+	ev_put(&sess->events, EV_COMMIT, flags, sess->mail.filesize,
+		sess->mail.mail_id);
+
+	info.session = sess->id;
+	info.client = sess->clientip;
+	info.mail_id = sess->mail.mail_id;
+	info.size = sess->mail.filesize;
+	dolog_info(LOG_INFO, &info, sess->logmsg);
+	sess->state = ST_READY;
+}
+
+
 /*
  * Handle a HELP command.
  *
  */
 
-static VOID do_help(INT sockno)
+static VOID do_help(PSESSION sess)
 {	INT i;
 	UCHAR helpbuf[MAXREPLY+1];
 
-	sock_puts(
-		"214-Commands supported:\n",
-		sockno,
-		CMD_TIMEOUT);
+	REPLY(sess,
+		"214-Commands supported:\r\n");
 
 	strcpy(helpbuf, "214 ");
 	for(i = 0; cmdtab[i].cmdcode != BAD; i++) {
@@ -696,7 +1177,7 @@ static VOID do_help(INT sockno)
 	helpbuf[strlen(helpbuf)-1] = '\n';	/* Replace comma with newline */
 	sock_puts(
 		helpbuf,
-		sockno,
+		&sess->net,
 		CMD_TIMEOUT);
 }
 
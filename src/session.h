@@ -0,0 +1,76 @@
+/*
+ * File: session.h
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Per-session state; header file. Everything needed to carry on one
+ * SMTP conversation is kept here, so that any number of sessions can
+ * run within one process.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Session limits */
+
+#define	MAXCMD		514		/* Maximum length of a command */
+#define	MAXLINE		1002		/* Maximum length of line */
+#define	MAXREPLY	514		/* Maximum length of reply message */
+
+/* Results from server_input() */
+
+#define	SERVER_MORE	0		/* Session wants more input */
+#define	SERVER_DONE	1		/* Session has finished */
+
+/* Type definitions */
+
+typedef	enum	{ ST_CONNECT, ST_READY, ST_MAIL, ST_RCPT, ST_DATA, ST_BDAT,
+		  ST_SYNC }
+	STATE;
+
+/* Structure definitions */
+
+typedef	struct	_SESSION {		/* State of one SMTP session */
+struct	_SESSION	*next;		/* Next session in list */
+INT		sockno;			/* Socket for this session */
+ULONG		id;			/* Session number, for logging */
+STATE		state;			/* Internal state */
+BOOL		esmtp;			/* True if EHLO seen */
+PUCHAR		msg_id;			/* Message ID as a string */
+INT		nrcpts;			/* Number of recipients so far */
+time_t		deadline;		/* Time at which input times out */
+PUCHAR		servername;		/* Name of this server */
+BOOL		parked;			/* Waiting for client name, or sync */
+time_t		parktime;		/* Time at which parked */
+ULONG		chunk;			/* Bytes of BDAT chunk still to come */
+ULONG		octets;			/* Bytes of message text so far */
+BOOL		lastchunk;		/* Current BDAT chunk is the last */
+PUCHAR		chunkreply;		/* Error reply for current chunk */
+SYNCREQ		sync;			/* Flush of message just received */
+ULONG		clientaddr;		/* IP address of client */
+UCHAR		clientname[MAXDNAME+1];	/* Name of client, or empty */
+UCHAR		clientip[MAXADDR];	/* Dotted IP address of client */
+UCHAR		logmsg[MAXREPLY];	/* Logging buffer */
+UCHAR		line[MAXLINE+1];	/* Current input line */
+NETIO		net;			/* Network I/O state */
+MAILSTOR	mail;			/* Mail storage state */
+EVLOG		events;			/* Event log state */
+} SESSION, *PSESSION;
+
+/* External references */
+
+extern	PSESSION connection(INT);
+extern	VOID	connection_close(PSESSION);
+extern	BOOL	server(PSESSION);
+extern	INT	server_input(PSESSION);
+extern	BOOL	server_open(PSESSION, BOOL);
+extern	VOID	server_timeout(PSESSION);
+extern	VOID	session_log(PSESSION, UINT, PUCHAR);
+
+/*
+ * End of file: session.h
+ *
+ */
+
+
\ No newline at end of file
@@ -1,8 +1,8 @@
 /*
  * File: smtpd.c
  *
- * SMTP daemon for receiving mail on Tavi network; to be invoked only
- * by INETD.
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
  *
  * Main program
  *
@@ -56,15 +56,78 @@
  *		with RFC2821.
  *		Make timestamps conform to RFC2821/RFC2822 in terms of
  *		leading zeros and four digit year values.
+ *	5.0	Added standalone mode (-d), in which the daemon binds its own
+ *		listening sockets and accepts calls directly instead of being
+ *		started by INETD for each one. Configuration, logging and
+ *		service port lookup are done once at startup.
+ *		All session state is now held in a per-session structure, so
+ *		that the standalone daemon runs any number of sessions at once
+ *		from a single event loop.
+ *		Added REACTORS and AFFINITY configuration options, to run
+ *		standalone sessions on several threads.
+ *		Client host names are now looked up in the background, and
+ *		cached for all sessions, so the greeting is sent at once;
+ *		a failed lookup no longer refuses the call. Added DNS_CACHE
+ *		configuration option.
+ *		Trusted hosts are now held in a radix trie, so that large
+ *		numbers of them can be checked quickly. TRUSTED_HOST now
+ *		also accepts address/length (CIDR) form, and IPv6 networks.
+ *		Faster input line scanning.
+ *		Network input buffers now grow while a client is sending
+ *		quickly, and input is read without waiting first unless
+ *		there is none. Added RECV_BUFFER configuration option.
+ *		Standalone daemon logs input statistics hourly.
+ *		Replies are now held until all waiting commands have been
+ *		dealt with, then sent together in a single write.
+ *		EHLO now advertises the PIPELINING extension (RFC2920).
+ *		Added the CHUNKING extension (BDAT command, RFC3030); chunks
+ *		are copied straight into the mail file in large blocks.
+ *		Added the SIZE extension (RFC1870), and MESSAGE_SIZE
+ *		configuration option. Space for large messages is allocated
+ *		in advance when their size is announced.
+ *		Mail files are written through a large buffer, instead of
+ *		line by line.
+ *		New form of mail ID, allowing thousands of messages a second
+ *		without searching for an unused file name.
+ *		Added COMMIT configuration option, to allow messages to be
+ *		committed by renaming a temporary file.
+ *		Added SYNC configuration option, to flush messages to disk
+ *		before they are acknowledged; singly, or in groups.
+ *		Security log copies are now written alongside the spool file,
+ *		instead of being copied afterwards. Added SECURITY_LOG
+ *		configuration option to set their directory.
+ *		Added SPOOL_SHARDS configuration option, to spread spool
+ *		files over hashed subdirectories of the spool directory.
+ *		Added SPOOL_INDEX configuration option, to keep a journal of
+ *		committed spool files for the mail sending software to follow,
+ *		instead of searching the spool directory.
+ *		Spool index journal readers can now wait to be told of new
+ *		records, instead of polling.
+ *		Added SPOOL_SEGMENTS configuration option, to append small
+ *		messages to large preallocated segment files, instead of
+ *		giving each a mail file of its own.
+ *		Log records are now queued for a separate writer thread,
+ *		which writes them out in batches, so that sessions never
+ *		wait for the logfile or the syslog daemon.
+ *		Added SYSLOG_FORMAT configuration option, to send syslog
+ *		records in RFC 5424 format with structured data, and
+ *		SYSLOG_SOCKET option, to send them to a local socket.
+ *		The time is now rendered for log records and Received:
+ *		lines just once a second, instead of for every one.
+ *		Added EVENT_LOG configuration option, to record each step of
+ *		every session in a compact binary event log, and the EVDUMP
+ *		program to turn it into JSON or CSV.
+ *		Added LOG_LIMIT configuration option, to limit the records
+ *		logged for floods of calls from untrusted hosts, with
+ *		summaries of those suppressed.
  *
  */
 
 #pragma	strings(readonly)
 
 #pragma	alloc_text(a_init_seg, main)
+#pragma	alloc_text(a_init_seg, initialise)
 #pragma	alloc_text(a_init_seg, error)
-#pragma	alloc_text(a_init_seg, fix_domain)
-#pragma	alloc_text(a_init_seg, log_connection)
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -73,7 +136,13 @@
 #include <time.h>
 
 #include "smtpd.h"
+#include "evlog.h"
+#include "limit.h"
 #include "mailstor.h"
+#include "netio.h"
+#include "resolve.h"
+#include "sync.h"
+#include "session.h"
 
 #define	LOGFILE		"SMTPD.Log"	/* Name of log file */
 #define	LOGENV		"ETC"		/* Environment variable for log dir */
@@ -87,17 +156,23 @@
 
 /* Forward references */
 
-static	VOID	fix_domain(PUCHAR);
-static	VOID	log_connection(VOID);
+static	VOID	initialise(BOOL);
+static	VOID	log_connection(PSESSION);
+static	BOOL	open_spool(PUCHAR, PSPOOL);
 
 /* Local storage */
 
 static	CONFIG	config;
-static	UCHAR	hostip[16];
-static	UCHAR 	hostname[MAXDNAME+1];
+static	HMTX	connsem;		/* Serialises connection setup */
+static	USHORT	alt_serv_port;
 static	UCHAR 	myname[MAXDNAME+1];
-static	USHORT	myport;
+static	USHORT	main_serv_port;
 static	PUCHAR	progname;
+static	SPOOL	spool[2];		/* Main and alternate spool areas */
+static	BOOL	spool_ready[2];		/* Spool area initialised */
+static	BOOL	recover_index;		/* Bring spool index up to date */
+static	BOOL	standalone_mode;	/* Running as standalone daemon */
+static	ULONG	sessions;		/* Sessions started, for numbering */
 
 
 /*
@@ -106,18 +181,10 @@ static	PUCHAR	progname;
  */
 
 INT main(INT argc, PUCHAR argv[])
-{	INT sockno, namelen, rc;
-	SOCK serv, client;
-	PSERV smtpserv;
-	USHORT main_serv_port, alt_serv_port;
-	PHOST host;
-	BOOL trusted;
-	PUCHAR p, smtpdir;
-	IFREQ ifr;
-	PINADDRENT phost;
-#ifdef	DEBUG
-	INT i;
-#endif
+{	INT sockno, rc;
+	BOOL standalone = FALSE;
+	PUCHAR p;
+	PSESSION sess;
 
 	progname = strrchr(argv[0], '\\');
 	if(progname != (PUCHAR) NULL)
@@ -132,44 +199,69 @@ INT main(INT argc, PUCHAR argv[])
 	res_init();			/* Initialise resolver */
 
 	if(argc != 2) {
-		error("usage: %s sockno", progname);
+		error("usage: %s sockno | -d", progname);
 		exit(EXIT_FAILURE);
 	}
 
-	sockno = atoi(argv[1]);
-	if(sockno <= 0) {
-		error("bad arg from INETD");
-		exit(EXIT_FAILURE);
+	if(stricmp(argv[1], "-d") == 0) {
+		standalone = TRUE;	/* Run as a standalone daemon */
+	} else {
+		sockno = atoi(argv[1]);
+		if(sockno <= 0) {
+			error("bad arg from INETD");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	rc = sock_init();		/* Initialise socket library */
-	if(rc != 0) {
-		error("INET.SYS not running");
-		exit(EXIT_FAILURE);
+	initialise(standalone);
+
+	if(standalone == TRUE) {
+		rc = listener(&config, main_serv_port, alt_serv_port) == TRUE ?
+			0 : 1;
+	} else {
+		addsockettolist(sockno);/* Ensure socket belongs to us now */
+		sess = connection(sockno);
+		if(sess == (PSESSION) NULL) {
+			rc = 1;
+		} else {		/* Run the server */
+			rc = server(sess) == TRUE ? 0 : 1;
+			connection_close(sess);
+		}
 	}
-	addsockettolist(sockno);	/* Ensure socket belongs to us now */
 
-	/* Get IP address of the client */
+	/* Shut down */
 
-	client.sin_family = AF_INET;
-	namelen = sizeof(client);
-	rc = getpeername(sockno, (PSOCKG) &client, &namelen);
+	close_log();
+
+	return(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/*
+ * Perform all the once-only initialisation: socket library, service
+ * ports, local host name, configuration and logging. In standalone
+ * mode ('standalone' TRUE) this is done just once, rather than once per
+ * connection.
+ *
+ * Any failure is fatal.
+ *
+ */
+
+static VOID initialise(BOOL standalone)
+{	INT rc;
+	PSERV smtpserv;
+
+	rc = sock_init();		/* Initialise socket library */
 	if(rc != 0) {
-		error("cannot get peer name, errno = %d", sock_errno());
+		error("INET.SYS not running");
 		exit(EXIT_FAILURE);
 	}
 
-	/* Get the IP address and port to which the socket passed to us was
-	   bound. */
-
-	serv.sin_family = AF_INET;
-	namelen = sizeof(serv);
-	rc = getsockname(sockno, (PSOCKG) &serv, &namelen);
+	rc = DosCreateMutexSem((PSZ) NULL, &connsem, 0, FALSE);
 	if(rc != 0) {
-		error("cannot get local name, errno = %d", sock_errno());
+		error("cannot create semaphore, rc = %d", rc);
 		exit(EXIT_FAILURE);
 	}
-	myport = ntohs(serv.sin_port);
 
 	/* Get the host name of this server; if not possible, set it to the
 	   dotted address. */
@@ -184,25 +276,6 @@ INT main(INT argc, PUCHAR argv[])
 		fix_domain(myname);
 	}
 
-	/* Get the host name of the client; if not possible, set it to the
-	   dotted address. Store the dotted address anyway, as it's needed
-	   for the Received: line. */
-
-	host = gethostbyaddr((PUCHAR) &client.sin_addr,
-			     sizeof(client.sin_addr), AF_INET);
-	if(host == (struct hostent *) NULL) {
-		if(h_errno == HOST_NOT_FOUND) {
-			sprintf(hostname, "[%s]", inet_ntoa(client.sin_addr));
-		} else {
-			error("cannot get host name, errno = %d", h_errno);
-			exit(EXIT_FAILURE);
-		}
-	} else {
-		strcpy(hostname, host->h_name);
-		fix_domain(hostname);
-	}
-	strcpy(hostip, inet_ntoa(client.sin_addr));
-
 	/* Get main and alternate service ports */
 
 	smtpserv = getservbyname(SMTPSERVICE, TCP);
@@ -230,9 +303,46 @@ INT main(INT argc, PUCHAR argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* Set up network input buffering */
+
+	if(netio_setup(config.recvbuf_min, config.recvbuf_max) == FALSE) {
+		error("cannot initialise network I/O");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Start the resolver, for looking up client names */
+
+	if(resolve_init(config.dns_entries, config.dns_ttl,
+			config.dns_negttl) == FALSE) {
+		exit(EXIT_FAILURE);
+	}
+
+	/* Only the standalone daemon brings the spool index up to date
+	   when it starts; under INETD, this would mean searching the
+	   whole spool directory for every connection. */
+
+	recover_index = standalone;
+	standalone_mode = standalone;
+
+	/* Set up flushing of mail to disk. When run by INETD there is only
+	   one session, so there is nothing to group with; each message is
+	   flushed on its own. */
+
+	if(standalone == FALSE && config.sync_mode == SYNC_GROUP)
+		config.sync_mode = SYNC_MESSAGE;
+
+	/* Segments are added to by one process only; under INETD, each
+	   message has a mail file of its own. */
+
+	if(standalone == FALSE) config.spool_segments = 0;
+	if(sync_init(config.sync_mode, config.sync_window) == FALSE) {
+		exit(EXIT_FAILURE);
+	}
+
 	/* Start logging */
 
-	rc = open_log(config.log_type, LOGENV, LOGFILE, myname, progname);
+	rc = open_log(config.log_type, LOGENV, LOGFILE, myname, progname,
+			config.syslog_socket, config.syslog_format);
 	if(rc != LOGERR_OK) {
 		error(
 		"logging initialisation failed - %s",
@@ -242,91 +352,289 @@ INT main(INT argc, PUCHAR argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* Limit the records logged for floods of calls from untrusted
+	   hosts. When run by INETD, each call has a process of its own,
+	   so there is nothing to limit. */
+
+	if(standalone == FALSE) config.limit_rate = 0;
+	if(limit_init(config.limit_rate, config.limit_burst,
+			config.limit_interval) == FALSE) {
+		exit(EXIT_FAILURE);
+	}
+
+	/* Start the session event log, if wanted */
+
+	if(config.event_log == TRUE && ev_init(ETC, EV_FILE) == FALSE) {
+		error("cannot open event log");
+		exit(EXIT_FAILURE);
+	}
+
 #ifdef	DEBUG
 	trace(
-		"config: number of trusted hosts = %d", config.nthosts);
-	phost = config.thost_list;
-	i = 1;
-	while(phost != (PINADDRENT) NULL) {
-		UCHAR ms[MAXADDR];
-
-		strcpy(ms, inet_ntoa(phost->interface_mask));
-		trace(
-			"config: trusted host %d is %s; mask %s",
-			i,
-			inet_ntoa(phost->interface_address),
-			ms);
-		i++;
-		phost = phost->next;
-	}
+		"config: number of trusted networks = %d",
+		config.thosts.nentries);
 	trace(
 		"config: logging type = %s", config.log_type == LOGGING_FILE ?
 						"FILE" : "SYSLOG");
+	trace(
+		"config: reactors = %d, affinity = %s", config.reactors,
+		config.affinity == TRUE ? "ON" : "OFF");
+	trace(
+		"config: DNS cache = %d entries, TTL %d, negative TTL %d",
+		config.dns_entries, config.dns_ttl, config.dns_negttl);
+	trace(
+		"config: receive buffers %d to %d bytes",
+		config.recvbuf_min, config.recvbuf_max);
+	trace("config: message size limit %lu bytes", config.max_size);
+	trace("config: commit by %s",
+		config.commit_rename == TRUE ? "RENAME" : "PATCH");
+	trace("config: sync mode %d, window %d ms",
+		config.sync_mode, config.sync_window);
+	trace("config: security log directory \"%s\"", config.security_log);
+	trace("config: %d levels of spool subdirectories",
+		config.spool_shards);
+	trace("config: spool index %s",
+		config.spool_index == TRUE ? "ON" : "OFF");
+	trace("config: spool segment size %d KB", config.spool_segments);
+	trace("config: syslog format %s, socket \"%s\"",
+		config.syslog_format == LOGFMT_RFC5424 ? "RFC5424" : "BSD",
+		config.syslog_socket);
+	trace("config: event log %s",
+		config.event_log == TRUE ? "ON" : "OFF");
+	trace("config: log limit %d per sec, burst %d, interval %d secs",
+		config.limit_rate, config.limit_burst, config.limit_interval);
+	trace("main service port is %d, alt service port is %d",
+		main_serv_port, alt_serv_port);
 #endif
+}
+
+
+/*
+ * Set up a new session for an incoming call on socket 'sockno'; identify
+ * the client, check that it is trusted, and select the spool directory
+ * according to the port on which the call arrived. If the call is
+ * refused, the socket is closed.
+ *
+ * Returns:
+ *	pointer to new session, ready for server_open()
+ *	NULL if call refused or failed
+ *
+ */
 
-	log_connection();
+PSESSION connection(INT sockno)
+{	INT namelen, rc, which;
+	USHORT myport;
+	SOCK serv, client;
+	BOOL trusted;
+	PUCHAR smtpdir;
+	PSESSION sess;
+	UCHAR key[TRUST_KEYSIZE];
 
-	smtpdir = (myport == main_serv_port) ? SMTPDIR : SMTPHDIR;
+	/* Get IP address of the client */
+
+	client.sin_family = AF_INET;
+	namelen = sizeof(client);
+	rc = getpeername(sockno, (PSOCKG) &client, &namelen);
+	if(rc != 0) {
+		error("cannot get peer name, errno = %d", sock_errno());
+		(VOID) soclose(sockno);
+		return((PSESSION) NULL);
+	}
+
+	/* Get the IP address and port to which the socket passed to us was
+	   bound. */
+
+	serv.sin_family = AF_INET;
+	namelen = sizeof(serv);
+	rc = getsockname(sockno, (PSOCKG) &serv, &namelen);
+	if(rc != 0) {
+		error("cannot get local name, errno = %d", sock_errno());
+		(VOID) soclose(sockno);
+		return((PSESSION) NULL);
+	}
+	myport = ntohs(serv.sin_port);
+
+	sess = (PSESSION) malloc(sizeof(SESSION));
+	if(sess == (PSESSION) NULL) {
+		error("cannot allocate memory for session");
+		(VOID) soclose(sockno);
+		return((PSESSION) NULL);
+	}
+	memset(sess, 0, sizeof(SESSION));
+	sess->sockno = sockno;
+	sess->servername = myname;
+
+	/* Store the dotted address of the client, as it's needed for
+	   the Received: line. inet_ntoa returns its result in static
+	   storage, so only one reactor may use it at a time. The host
+	   name is looked up later (see below). The session is given a
+	   number at the same time, to identify its log records. */
+
+	sess->clientaddr = client.sin_addr.s_addr;
+	(VOID) DosRequestMutexSem(connsem, SEM_INDEFINITE_WAIT);
+	strcpy(sess->clientip, inet_ntoa(client.sin_addr));
+	sess->id = ++sessions;
+	(VOID) DosReleaseMutexSem(connsem);
+
+	which = (myport == main_serv_port) ? 0 : 1;
+	smtpdir = (which == 0) ? SMTPDIR : SMTPHDIR;
 #ifdef	DEBUG
 	trace("socket is bound to port %d", myport);
-	trace("main service port is %d, alt service port is %d",
-		main_serv_port, alt_serv_port);
 	trace("SMTP directory is '%s'", smtpdir);
-	trace("hostname = '%s', host IP = %s", hostname, hostip);
+	trace("host IP = %s", sess->clientip);
 #endif
 
 	/* Check that the client is a trusted host */
 
-	trusted = FALSE;
-	phost = config.thost_list;
-	while(phost != (PINADDRENT) NULL) {
-#ifdef	DEBUG
-		UCHAR as[MAXADDR];
-		UCHAR ms[MAXADDR];
-
-		strcpy(as, inet_ntoa(phost->interface_address));
-		strcpy(ms, inet_ntoa(phost->interface_mask));
-		trace(
-			"checking client %s against: %s mask %s",
-			inet_ntoa(client.sin_addr),
-			as,
-			ms);
-#endif
-		if((phost->interface_address.s_addr &
-		    phost->interface_mask.s_addr) ==
-		   (client.sin_addr.s_addr & phost->interface_mask.s_addr)) {
-			trusted = TRUE;
-#ifdef	DEBUG
-			trace("trusted check succeeded");
-#endif
-			break;
-		}
+	trust_key4(client.sin_addr.s_addr, key);
+	rc = trust_match(&config.thosts, key);
+	trusted = rc >= 0 ? TRUE : FALSE;
 #ifdef	DEBUG
+	if(trusted == TRUE)
+		trace("trusted check succeeded, prefix length %d",
+			rc - TRUST_V4PREFIX);
+	else
 		trace("trusted check failed");
 #endif
-		phost = phost->next;
-	}
 
 	if(trusted == FALSE) {
 		UCHAR mes[MAXLOG+1];
 
-		sprintf(
-			mes,
-			"attempted connection from non-trusted host: %s",
-			inet_ntoa(client.sin_addr));
-		dolog(LOG_ERR, mes);
-		rc = 1;			/* Force failure */
-	} else {			/* Run the server */
-		rc = server(sockno, hostname, hostip, myname, smtpdir);
+		/* A flood of such calls is not allowed to flood the log */
+
+		if(limit_check(LIMIT_UNTRUSTED, sess->clientaddr) == TRUE) {
+			log_connection(sess);
+			sprintf(
+				mes,
+				"attempted connection from non-trusted "
+				"host: %s",
+				sess->clientip);
+			session_log(sess, LOG_ERR, mes);
+		}
+		(VOID) soclose(sockno);
+		free(sess);
+		return((PSESSION) NULL);
 	}
+	log_connection(sess);
 
-	/* Shut down */
+	/* Start looking up the host name of the client. It isn't needed
+	   until the Received: line is written, so the session carries on
+	   meanwhile; if the name is already cached, it is available at
+	   once. */
 
-	(VOID) soclose(sockno);
-	mail_reset();			/* Tidy any partial file */
-	close_log();
+	(VOID) resolve_name(sess->clientaddr, sess->clientname, FALSE);
 
-	return(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	/* Set up the spool directory on first use */
+
+	(VOID) DosRequestMutexSem(connsem, SEM_INDEFINITE_WAIT);
+	if(spool_ready[which] == FALSE) {
+		if(open_spool(smtpdir, &spool[which]) == FALSE) {
+			(VOID) DosReleaseMutexSem(connsem);
+			(VOID) soclose(sockno);
+			free(sess);
+			return((PSESSION) NULL);
+		}
+		spool_ready[which] = TRUE;
+	}
+	(VOID) DosReleaseMutexSem(connsem);
+	mail_setup(&sess->mail, &spool[which]);
+	ev_start(&sess->events, sess->id, sess->clientaddr, myport);
+
+	return(sess);
+}
+
+
+/*
+ * Close down a session; tidy any partial mail file, close the socket,
+ * write out the session's events and release the session storage.
+ *
+ */
+
+VOID connection_close(PSESSION sess)
+{	netio_close(&sess->net);
+	(VOID) soclose(sess->sockno);
+	mail_end(&sess->mail);		/* Tidy any partial file */
+	ev_close(&sess->events);	/* Write out its events */
+	free(sess);
+}
+
+
+/*
+ * Initialise the spool directory named by the environment variable
+ * 'direnv', and apply the configured message size limit, commit
+ * method, security log directory and subdirectory levels to it. If
+ * the spool directory is sharded, any mail files left at its top
+ * level are moved into their subdirectories. If configured, the spool
+ * segments are opened, and the spool index is opened and brought up to
+ * date if need be.
+ *
+ * Returns:
+ *	TRUE		spool directory ready for use
+ *	FALSE		spool directory unusable; error already reported
+ *
+ */
+
+static BOOL open_spool(PUCHAR direnv, PSPOOL sp)
+{	INT moved, added;
+	UCHAR mes[MAXLOG+1];
+
+	switch(mail_init(direnv, sp)) {
+		case MAILINIT_OK:
+			sp->maxsize = config.max_size;
+			sp->rename = config.commit_rename;
+			sp->auditdir = config.security_log;
+			sp->shards = config.spool_shards;
+			sp->segsize = (ULONG) config.spool_segments*1024;
+			moved = mail_migrate(sp);
+			if(moved != 0) {
+				sprintf(
+					mes,
+					"moved %d mail files into spool "
+					"subdirectories",
+					moved);
+				dolog(LOG_INFO, mes);
+			}
+			if(sp->segsize != 0 && mail_segments(sp) == FALSE) {
+				error("cannot open spool segments");
+				break;
+			}
+			if(config.spool_index == FALSE) return(TRUE);
+
+			/* Moving files makes their index records wrong */
+
+			added = mail_index(sp, recover_index == TRUE ||
+					moved != 0 ? TRUE : FALSE);
+			if(added == -1) {
+				error("cannot open spool index");
+				break;
+			}
+			if(added != 0) {
+				sprintf(
+					mes,
+					"added %d mail files to spool index",
+					added);
+				dolog(LOG_INFO, mes);
+			}
+			return(TRUE);
+
+		case MAILINIT_NOENV:
+			error("environment variable %s not set", direnv);
+			break;
+
+		case MAILINIT_BADDIR:
+			error("cannot access mail storage directory");
+			break;
+
+		case MAILINIT_NOIDS:
+			error("cannot set up mail IDs");
+			break;
+
+		default:
+			error("mail storage initialisation failed");
+			break;
+	}
+
+	return(FALSE);
 }
 
 
@@ -354,7 +662,7 @@ VOID error(PUCHAR mes, ...)
  *
  */
 
-static VOID fix_domain(PUCHAR name)
+VOID fix_domain(PUCHAR name)
 {	if(strchr(name, '.') == (PUCHAR) NULL && _res.defdname[0] != '\0') {
 		strcat(name, ".");
 		strcat(name, _res.defdname);
@@ -363,24 +671,30 @@ static VOID fix_domain(PUCHAR name)
 
 
 /*
- * Log details of the connection to standard output and to the logfile.
+ * Log details of the connection to the logfile and, when run by INETD,
+ * to standard output. The standalone daemon does not write to standard
+ * output for each call, as that would hold up the reactor thread; the
+ * log record (already timestamped) says all the same. The host name of
+ * the client is not yet known, so the address is used.
  *
  */
 
-static VOID log_connection(VOID)
+static VOID log_connection(PSESSION sess)
 {	time_t tod;
 	UCHAR timeinfo[35];
 	UCHAR buf[100];
 
-	(VOID) time(&tod);
-	(VOID) strftime(timeinfo, sizeof(timeinfo),
-		"on %a %d %b %Y at %X %Z", localtime(&tod));
-	sprintf(buf, "%s: connection from %s, %s",
-		progname, hostname, timeinfo);
-	fprintf(stdout, "%s\n", buf);
+	if(standalone_mode == FALSE) {
+		(VOID) time(&tod);
+		(VOID) strftime(timeinfo, sizeof(timeinfo),
+			"on %a %d %b %Y at %X %Z", localtime(&tod));
+		sprintf(buf, "%s: connection from %s, %s",
+			progname, sess->clientip, timeinfo);
+		fprintf(stdout, "%s\n", buf);
+	}
 
-	sprintf(buf, "connection from %s", hostname);
-	dolog(LOG_INFO, buf);
+	sprintf(buf, "connection from %s", sess->clientip);
+	session_log(sess, LOG_INFO, buf);
 }
 
 /*
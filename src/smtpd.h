@@ -1,8 +1,8 @@
 /*
  * File: smtpd.h
  *
- * SMTP daemon for receiving mail on Tavi network; to be invoked only
- * by INETD.
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
  *
  * Header file
  *
@@ -11,6 +11,9 @@
  */
 
 #define INCL_DOSFILEMGR
+#define INCL_DOSMISC
+#define INCL_DOSPROCESS
+#define INCL_DOSSEMAPHORES
 #include <os2.h>
 
 #include <stdarg.h>
@@ -21,6 +24,7 @@
 #include <types.h>
 #include <sys\ioctl.h>
 #include <sys\socket.h>
+#include <sys\uio.h>
 #include <netdb.h>
 #include <net\if.h>
 #include <netinet\in.h>
@@ -28,9 +32,10 @@
 #include <resolv.h>
 
 #include "log.h"
+#include "trust.h"
 
-#define VERSION                 4       /* Major version number */
-#define EDIT                    1       /* Edit number within major version */
+#define VERSION                 5       /* Major version number */
+#define EDIT                    0       /* Edit number within major version */
 
 #define FALSE                   0
 #define TRUE                    1
@@ -38,6 +43,7 @@
 /* Configuration constants */
 
 #define MAXADDR                 16      /* Size of buffer to hold dotted IP address */
+#define MAXREACTORS             64      /* Maximum number of reactor threads */
 
 /* Type definitions */
 
@@ -50,23 +56,40 @@ typedef struct sockaddr_in      SOCK, *PSOCK;           /* Internet structure */
 
 /* Structure definitions */
 
-typedef struct _INADDRENT {             /* Interface address list entry */
-struct _INADDRENT       *next;
-INADDR                  interface_address;
-INADDR                  interface_mask;
-} INADDRENT, *PINADDRENT;
-
 typedef struct _CONFIG {                /* Configuration information */
-INT             nthosts;                /* Number of trusted hosts */
-PINADDRENT      thost_list;             /* Trusted host list */
+TRUST           thosts;                 /* Trusted networks */
 LOGTYPE		log_type;		/* Type of logging */
+INT		reactors;		/* Reactor threads (0 = one per CPU) */
+BOOL		affinity;		/* Pin each reactor to its own CPU */
+INT		dns_entries;		/* Size of host name cache */
+INT		dns_ttl;		/* Maximum lifetime of cached names */
+INT		dns_negttl;		/* Lifetime of failed lookups */
+INT		recvbuf_min;		/* Initial size of input buffers */
+INT		recvbuf_max;		/* Largest size of input buffers */
+ULONG		max_size;		/* Largest message (0 = no limit) */
+BOOL		commit_rename;		/* Commit mail by renaming, not patching */
+INT		sync_mode;		/* How mail is made safe on disk */
+INT		sync_window;		/* Group commit window (ms) */
+UCHAR		security_log[CCHMAXPATH+1];
+					/* Security log directory, or empty */
+INT		spool_shards;		/* Levels of spool subdirectories */
+BOOL		spool_index;		/* Keep index journal of spool */
+INT		spool_segments;		/* Segment size (KB), or 0 if none */
+INT		syslog_format;		/* Format of syslog records */
+UCHAR		syslog_socket[CCHMAXPATH+1];
+					/* Local syslog socket, or empty */
+BOOL		event_log;		/* Keep session event log */
+INT		limit_rate;		/* Limited records per sec (0 = off) */
+INT		limit_burst;		/* Largest burst of limited records */
+INT		limit_interval;		/* Interval per source (secs) */
 } CONFIG, *PCONFIG;
 
 /* External references */
 
 extern  VOID    error(PUCHAR, ...);
+extern  VOID    fix_domain(PUCHAR);
+extern  BOOL    listener(PCONFIG, USHORT, USHORT);
 extern  INT     read_config(PUCHAR, PUCHAR, PCONFIG);
-extern  BOOL    server(INT, PUCHAR, PUCHAR, PUCHAR, PUCHAR);
 
 /*
  * End of file: smtpd.h
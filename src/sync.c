@@ -0,0 +1,257 @@
+/*
+ * File: sync.c
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Making committed mail files safe on disk before the client is told
+ * that they have been accepted. Without this, a message acknowledged
+ * just before a power failure may never have reached the disk.
+ *
+ * Each message may be flushed to disk on its own, which costs at least
+ * one disk write (and on spinning disks, a wait for the platter) per
+ * message. Alternatively, messages may be flushed in groups: sessions
+ * ask for a flush and carry on with other work, and a single sync
+ * thread waits briefly for more requests to arrive, then flushes all
+ * of the process's files in one go and tells every session whose
+ * message it covered.
+ *
+ * A failed group flush is counted, and a message is treated as not
+ * safe if any flush has failed since it asked for one. This is
+ * cautious, since a failure may have hit a later group instead, but a
+ * record of just the last failure would be overwritten by the next
+ * one before every session it concerned had looked; and a message
+ * refused wrongly is only sent again by the client.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, sync_init)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smtpd.h"
+#include "clock.h"
+#include "sync.h"
+
+#define	ALLFILES	0xFFFF		/* Handle meaning all files */
+#define	SYNCSTACK	16384		/* Stack size for sync thread */
+
+/* Forward references */
+
+static	VOID	record(PSYNCREQ, INT);
+static	VOID	_Optlink syncer(PVOID);
+
+/* Local storage */
+
+static	ULONG	done;			/* Last ticket covered by a flush */
+static	ULONG	failed;			/* Group flushes that have failed */
+static	ULONG	issued;			/* Last ticket given out */
+static	HMTX	lock;			/* Serialises access to all the above */
+static	INT	mode = SYNC_NONE;	/* Durability mode */
+static	SYNCSTATS totals;		/* Statistics since last collected */
+static	INT	window;			/* Group commit window (ms) */
+static	HEV	worksem;		/* Posted when a flush is wanted */
+
+
+/*
+ * Initialise the durability mode to 'how' (SYNC_NONE, SYNC_MESSAGE or
+ * SYNC_GROUP). For group commit, a flush is held back for 'delay'
+ * milliseconds after the first request, so that other messages can
+ * share it, and the sync thread is started.
+ *
+ * Returns:
+ *	TRUE		ready
+ *	FALSE		initialisation failed; error already reported
+ *
+ */
+
+BOOL sync_init(INT how, INT delay)
+{	INT rc;
+
+	mode = how;
+	window = delay;
+
+	rc = DosCreateMutexSem((PSZ) NULL, &lock, 0, FALSE);
+	if(rc == 0 && mode == SYNC_GROUP)
+		rc = DosCreateEventSem((PSZ) NULL, &worksem, 0, FALSE);
+	if(rc != 0) {
+		error("cannot create sync semaphore, rc = %d", rc);
+		return(FALSE);
+	}
+
+	if(mode == SYNC_GROUP &&
+	   _beginthread(syncer, NULL, SYNCSTACK, NULL) == -1) {
+		error("cannot start sync thread");
+		return(FALSE);
+	}
+
+#ifdef	DEBUG
+	trace("sync: mode %s, window %d ms",
+		mode == SYNC_NONE    ? "NONE" :
+		mode == SYNC_MESSAGE ? "MESSAGE" :
+				       "GROUP", window);
+#endif
+
+	return(TRUE);
+}
+
+
+/*
+ * Start making the complete mail file open on handle 'fd' safe on
+ * disk; 'rp' is filled in to identify the request. The file must stay
+ * open until the flush is over. Unless the message is being flushed
+ * as part of a group, this waits for the flush to finish.
+ *
+ * Returns:
+ *	SYNC_OK		message is on disk
+ *	SYNC_PENDING	group flush in progress; call sync_wait() later
+ *	SYNC_FAILED	flush failed
+ *
+ */
+
+INT sync_start(INT fd, PSYNCREQ rp)
+{	INT rc = SYNC_OK;
+
+	rp->start = clock_msecs();
+
+	if(mode == SYNC_GROUP) {
+		(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+		rp->ticket = ++issued;
+		rp->failed = failed;
+		(VOID) DosReleaseMutexSem(lock);
+		(VOID) DosPostEventSem(worksem);
+		return(SYNC_PENDING);
+	}
+
+	/* The C library file handle is the system file handle */
+
+	if(mode == SYNC_MESSAGE && DosResetBuffer((HFILE) fd) != 0)
+		rc = SYNC_FAILED;
+
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	if(mode == SYNC_MESSAGE) {
+		totals.flushes++;
+		if(rc != SYNC_OK) totals.failures++;
+	}
+	record(rp, rc);
+	(VOID) DosReleaseMutexSem(lock);
+
+	return(rc);
+}
+
+
+/*
+ * See if the group flush for the message identified by 'rp' is over.
+ * If any group flush has failed since the message asked for one, it is
+ * treated as having failed too. This never waits.
+ *
+ * Returns:
+ *	SYNC_OK		message is on disk
+ *	SYNC_PENDING	flush still in progress
+ *	SYNC_FAILED	flush failed
+ *
+ */
+
+INT sync_wait(PSYNCREQ rp)
+{	INT rc;
+
+	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	if(rp->ticket > done) {
+		rc = SYNC_PENDING;
+	} else {
+		rc = failed != rp->failed ? SYNC_FAILED : SYNC_OK;
+		record(rp, rc);
+	}
+	(VOID) DosReleaseMutexSem(lock);
+
+	return(rc);
+}
+
+
+/*
+ * Collect the commit statistics for the period since the last call,
+ * into the structure pointed to by 'sp'.
+ *
+ */
+
+VOID sync_stats(PSYNCSTATS sp)
+{	(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+	*sp = totals;
+	memset(&totals, 0, sizeof(SYNCSTATS));
+	(VOID) DosReleaseMutexSem(lock);
+}
+
+
+/*
+ * Add a finished commit, for the message identified by 'rp' and with
+ * result 'rc', to the statistics. The lock must be held.
+ *
+ */
+
+static VOID record(PSYNCREQ rp, INT rc)
+{	ULONG ms;
+
+	if(rc != SYNC_OK) return;
+
+	ms = clock_msecs() - rp->start;
+	totals.messages++;
+	totals.totalms += ms;
+	if(ms > totals.maxms) totals.maxms = ms;
+}
+
+
+/*
+ * Main loop of the sync thread. When the first request arrives, the
+ * thread waits for the group commit window, so that others can join
+ * it, then flushes every file the process has open. Every message that
+ * had asked for a flush by the time it started is then on disk.
+ * Requests arriving during a flush are dealt with by the next one.
+ *
+ */
+
+static VOID _Optlink syncer(PVOID arg)
+{	APIRET rc;
+	ULONG posts, upto;
+	UCHAR mes[MAXLOG+1];
+
+	for(;;) {
+		(VOID) DosWaitEventSem(worksem, SEM_INDEFINITE_WAIT);
+		(VOID) DosResetEventSem(worksem, &posts);
+
+		if(window > 0) (VOID) DosSleep(window);
+
+		(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+		upto = issued;
+		(VOID) DosReleaseMutexSem(lock);
+		if(upto == done) continue;	/* Covered by last flush */
+
+		rc = DosResetBuffer(ALLFILES);
+
+		(VOID) DosRequestMutexSem(lock, SEM_INDEFINITE_WAIT);
+		if(rc != 0) {
+			failed++;
+			totals.failures++;
+		}
+		totals.flushes++;
+		done = upto;
+		(VOID) DosReleaseMutexSem(lock);
+
+		if(rc != 0) {
+			sprintf(mes, "sync: cannot flush mail files, rc = %d",
+				rc);
+			dolog(LOG_ERR, mes);
+		}
+	}
+}
+
+/*
+ * End of file: sync.c
+ *
+ */
+
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+ * File: sync.h
+ *
+ * Making committed mail files safe on disk, singly or in groups;
+ * header file.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Tunable constants */
+
+#define	SYNC_WINDOW		0	/* Default group commit window (ms) */
+#define	SYNC_MAXWINDOW		1000	/* Maximum group commit window (ms) */
+
+/* Durability modes */
+
+#define	SYNC_NONE		0	/* Leave it to the file system */
+#define	SYNC_MESSAGE		1	/* Flush each message on its own */
+#define	SYNC_GROUP		2	/* Flush messages together */
+
+/* Results from sync_start() and sync_wait() */
+
+#define	SYNC_OK			0	/* Message is safe on disk */
+#define	SYNC_PENDING		1	/* Flush still in progress */
+#define	SYNC_FAILED		2	/* Flush failed */
+
+/* Structure definitions */
+
+typedef	struct	_SYNCREQ {		/* One message awaiting a flush */
+ULONG		ticket;			/* Flush that will cover it */
+ULONG		start;			/* Time at which requested (ms) */
+ULONG		failed;			/* Failed flushes before then */
+} SYNCREQ, *PSYNCREQ;
+
+typedef	struct	_SYNCSTATS {		/* Commit statistics */
+ULONG		messages;		/* Messages committed */
+ULONG		flushes;		/* Flushes done */
+ULONG		failures;		/* Flushes that failed */
+ULONG		totalms;		/* Total commit latency (ms) */
+ULONG		maxms;			/* Longest commit latency (ms) */
+} SYNCSTATS, *PSYNCSTATS;
+
+/* External references */
+
+extern	BOOL	sync_init(INT, INT);
+extern	INT	sync_start(INT, PSYNCREQ);
+extern	VOID	sync_stats(PSYNCSTATS);
+extern	INT	sync_wait(PSYNCREQ);
+
+/*
+ * End of file: sync.h
+ *
+ */
+
+
\ No newline at end of file
@@ -0,0 +1,350 @@
+/*
+ * File: trust.c
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Table of trusted networks. The networks are held as a compressed
+ * radix (Patricia) trie, so that checking an address takes time
+ * proportional to the length of the prefix, rather than to the number
+ * of networks. Keys are IPv6 addresses; IPv4 addresses are held in
+ * IPv4-mapped form (::ffff:a.b.c.d).
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+#pragma	strings(readonly)
+
+#pragma	alloc_text(a_init_seg, trust_add)
+#pragma	alloc_text(a_init_seg, trust_parse)
+#pragma	alloc_text(a_init_seg, new_node)
+#pragma	alloc_text(a_init_seg, parse_v4)
+#pragma	alloc_text(a_init_seg, parse_v6)
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "smtpd.h"
+
+/* Forward references */
+
+static	INT	common_bits(PUCHAR, PUCHAR, INT);
+static	PTNODE	new_node(PUCHAR, INT, BOOL);
+static	BOOL	parse_v4(PUCHAR, PUCHAR);
+static	BOOL	parse_v6(PUCHAR, PUCHAR);
+
+/* Macros */
+
+#define	KEYBIT(k, n)	(((k)[(n) >> 3] >> (7 - ((n) & 7))) & 1)
+
+
+/*
+ * Add the network with prefix 'key', of length 'bits', to the table
+ * 'tp'. Any bits of the key beyond the prefix are ignored.
+ *
+ * Returns:
+ *	TRUE		network added (or already present)
+ *	FALSE		out of memory
+ *
+ */
+
+BOOL trust_add(PTRUST tp, PUCHAR key, INT bits)
+{	INT n;
+	PTNODE node, leaf, glue;
+	PTNODE *pp = &tp->root;
+	UCHAR k[TRUST_KEYSIZE];
+
+	/* Clear the bits beyond the prefix */
+
+	memset(k, 0, sizeof(k));
+	memcpy(k, key, bits >> 3);
+	if(bits & 7)
+		k[bits >> 3] = key[bits >> 3] & (0xff << (8 - (bits & 7)));
+
+	while((node = *pp) != (PTNODE) NULL) {
+		n = common_bits(node->key, k,
+				node->bits < bits ? node->bits : bits);
+		if(n < node->bits) {	/* Diverges within this node */
+			if(n == bits) {	/* New prefix goes above it */
+				leaf = new_node(k, bits, TRUE);
+				if(leaf == (PTNODE) NULL) return(FALSE);
+				leaf->child[KEYBIT(node->key, bits)] = node;
+				*pp = leaf;
+			} else {	/* Split, with new prefix alongside */
+				leaf = new_node(k, bits, TRUE);
+				glue = new_node(k, n, FALSE);
+				if(leaf == (PTNODE) NULL ||
+				   glue == (PTNODE) NULL) {
+					free(leaf);
+					free(glue);
+					return(FALSE);
+				}
+				glue->child[KEYBIT(node->key, n)] = node;
+				glue->child[KEYBIT(k, n)] = leaf;
+				*pp = glue;
+			}
+			tp->nentries++;
+			return(TRUE);
+		}
+		if(node->bits == bits) {/* Same prefix */
+			if(node->entry == FALSE) {
+				node->entry = TRUE;
+				tp->nentries++;
+			}
+			return(TRUE);
+		}
+		pp = &node->child[KEYBIT(k, node->bits)];
+	}
+
+	*pp = new_node(k, bits, TRUE);
+	if(*pp == (PTNODE) NULL) return(FALSE);
+	tp->nentries++;
+
+	return(TRUE);
+}
+
+
+/*
+ * Find the longest prefix in table 'tp' that matches address 'key'.
+ *
+ * Returns:
+ *	length of the longest matching prefix
+ *	-1 if the address is not in any network in the table
+ *
+ */
+
+INT trust_match(PTRUST tp, PUCHAR key)
+{	INT best = -1;
+	PTNODE node = tp->root;
+
+	while(node != (PTNODE) NULL) {
+		if(common_bits(node->key, key, node->bits) < node->bits) break;
+		if(node->entry == TRUE) best = node->bits;
+		if(node->bits == TRUST_KEYBITS) break;
+		node = node->child[KEYBIT(key, node->bits)];
+	}
+
+	return(best);
+}
+
+
+/*
+ * Make a key from the IPv4 address 'addr' (network order).
+ *
+ */
+
+VOID trust_key4(ULONG addr, PUCHAR key)
+{	memset(key, 0, TRUST_KEYSIZE);
+	key[10] = 0xff;
+	key[11] = 0xff;
+	memcpy(&key[12], &addr, 4);
+}
+
+
+/*
+ * Parse a network in the form 'address' or 'address/length', where the
+ * address is either a dotted IPv4 address or an IPv6 address. The key
+ * is returned in 'key', and the prefix length (in key bits) in 'bits';
+ * with no length, the network is the single host.
+ *
+ * Returns:
+ *	TRUE		network parsed OK
+ *	FALSE		syntax error
+ *
+ */
+
+BOOL trust_parse(PUCHAR s, PUCHAR key, PINT bits)
+{	INT len, max;
+	BOOL v6;
+	PUCHAR p;
+	UCHAR addr[50];
+
+	p = strchr(s, '/');
+	len = p == (PUCHAR) NULL ? strlen(s) : p - s;
+	if(len == 0 || len >= sizeof(addr)) return(FALSE);
+	memcpy(addr, s, len);
+	addr[len] = '\0';
+
+	v6 = strchr(addr, ':') != (PUCHAR) NULL;
+	if(v6 == TRUE) {
+		if(parse_v6(addr, key) == FALSE) return(FALSE);
+		max = TRUST_KEYBITS;
+	} else {
+		memset(key, 0, TRUST_KEYSIZE);
+		key[10] = 0xff;
+		key[11] = 0xff;
+		if(parse_v4(addr, &key[12]) == FALSE) return(FALSE);
+		max = 32;
+	}
+
+	if(p == (PUCHAR) NULL) {
+		len = max;
+	} else {
+		p++;
+		if(*p == '\0') return(FALSE);
+		for(len = 0; *p != '\0'; p++) {
+			if(!isdigit(*p)) return(FALSE);
+			len = len*10 + (*p - '0');
+			if(len > max) return(FALSE);
+		}
+	}
+
+	*bits = v6 == TRUE ? len : TRUST_V4PREFIX + len;
+
+	return(TRUE);
+}
+
+
+/*
+ * Parse a dotted IPv4 address (exactly four decimal parts) into the
+ * four bytes at 'out'.
+ *
+ * Returns:
+ *	TRUE		address parsed OK
+ *	FALSE		syntax error
+ *
+ */
+
+static BOOL parse_v4(PUCHAR s, PUCHAR out)
+{	INT i, n;
+
+	for(i = 0; i < 4; i++) {
+		if(!isdigit(*s)) return(FALSE);
+		for(n = 0; isdigit(*s); s++) {
+			n = n*10 + (*s - '0');
+			if(n > 255) return(FALSE);
+		}
+		out[i] = n;
+		if(i < 3 && *s++ != '.') return(FALSE);
+	}
+
+	return(*s == '\0');
+}
+
+
+/*
+ * Parse an IPv6 address, in any of the usual textual forms (including
+ * '::' and a trailing dotted IPv4 part), into the 16 bytes at 'out'.
+ *
+ * Returns:
+ *	TRUE		address parsed OK
+ *	FALSE		syntax error
+ *
+ */
+
+static BOOL parse_v6(PUCHAR s, PUCHAR out)
+{	INT i, n, digits;
+	INT nbytes = 0;
+	INT gap = -1;			/* Where '::' was, if anywhere */
+	PUCHAR p;
+
+	memset(out, 0, TRUST_KEYSIZE);
+
+	if(s[0] == ':' && s[1] != ':') return(FALSE);
+
+	while(*s != '\0') {
+		if(*s == ':') {
+			if(s[1] != ':') return(FALSE);
+			if(gap >= 0) return(FALSE);
+			gap = nbytes;
+			s += 2;
+			if(*s == '\0') break;
+			continue;
+		}
+
+		/* A dotted IPv4 part may come last */
+
+		for(p = s; isxdigit(*p); p++)
+			;
+		if(*p == '.') {
+			if(nbytes > TRUST_KEYSIZE - 4) return(FALSE);
+			if(parse_v4(s, &out[nbytes]) == FALSE) return(FALSE);
+			nbytes += 4;
+			break;
+		}
+
+		if(nbytes > TRUST_KEYSIZE - 2) return(FALSE);
+		for(n = 0, digits = 0; isxdigit(*s); s++, digits++) {
+			if(digits == 4) return(FALSE);
+			n = n*16 + (isdigit(*s) ? *s - '0' :
+					toupper(*s) - 'A' + 10);
+		}
+		if(digits == 0) return(FALSE);
+		out[nbytes++] = n >> 8;
+		out[nbytes++] = n & 0xff;
+
+		if(*s == ':' && s[1] != ':') {
+			s++;
+			if(*s == '\0') return(FALSE);
+		}
+	}
+
+	if(gap < 0) return(nbytes == TRUST_KEYSIZE);
+	if(nbytes == TRUST_KEYSIZE) return(FALSE);
+
+	/* Move the part after '::' to the end */
+
+	n = nbytes - gap;
+	for(i = 1; i <= n; i++) {
+		out[TRUST_KEYSIZE - i] = out[nbytes - i];
+		out[nbytes - i] = 0;
+	}
+
+	return(TRUE);
+}
+
+
+/*
+ * Count the leading bits (up to 'max') that keys 'a' and 'b' have in
+ * common.
+ *
+ */
+
+static INT common_bits(PUCHAR a, PUCHAR b, INT max)
+{	INT n = 0;
+	UCHAR x;
+
+	while(n + 8 <= max && a[n >> 3] == b[n >> 3]) n += 8;
+	if(n >= max) return(max);
+
+	x = a[n >> 3] ^ b[n >> 3];
+	while(n < max && (x & 0x80) == 0) {
+		x <<= 1;
+		n++;
+	}
+
+	return(n);
+}
+
+
+/*
+ * Allocate a trie node for prefix 'key' of length 'bits'; 'entry' says
+ * whether the prefix itself is in the table.
+ *
+ * Returns:
+ *	pointer to new node, or NULL if out of memory
+ *
+ */
+
+static PTNODE new_node(PUCHAR key, INT bits, BOOL entry)
+{	PTNODE node;
+
+	node = (PTNODE) malloc(sizeof(TNODE));
+	if(node == (PTNODE) NULL) return((PTNODE) NULL);
+
+	node->child[0] = (PTNODE) NULL;
+	node->child[1] = (PTNODE) NULL;
+	node->bits = bits;
+	node->entry = entry;
+	memcpy(node->key, key, TRUST_KEYSIZE);
+
+	return(node);
+}
+
+/*
+ * End of file: trust.c
+ *
+ */
+
\ No newline at end of file
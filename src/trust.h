@@ -0,0 +1,46 @@
+/*
+ * File: trust.h
+ *
+ * SMTP daemon for receiving mail on Tavi network; to be invoked
+ * by INETD, or run standalone.
+ *
+ * Table of trusted networks, held as a compressed radix (Patricia)
+ * trie; header file.
+ *
+ * Bob Eager   October 2026
+ *
+ */
+
+/* Constants */
+
+#define	TRUST_KEYSIZE		16	/* Bytes in a key (IPv6 address) */
+#define	TRUST_KEYBITS		(TRUST_KEYSIZE*8)
+#define	TRUST_V4PREFIX		96	/* Bits before an IPv4 address */
+
+/* Structure definitions */
+
+typedef	struct	_TNODE {		/* Trie node */
+struct	_TNODE	*child[2];		/* Subtrees for next bit 0 and 1 */
+INT		bits;			/* Length of prefix at this node */
+BOOL		entry;			/* TRUE if prefix is in table */
+UCHAR		key[TRUST_KEYSIZE];	/* Prefix; unused bits are zero */
+} TNODE, *PTNODE;
+
+typedef	struct	_TRUST {		/* Table of trusted networks */
+PTNODE		root;			/* Root of trie */
+INT		nentries;		/* Number of networks in table */
+} TRUST, *PTRUST;
+
+/* External references */
+
+extern	BOOL	trust_add(PTRUST, PUCHAR, INT);
+extern	VOID	trust_key4(ULONG, PUCHAR);
+extern	INT	trust_match(PTRUST, PUCHAR);
+extern	BOOL	trust_parse(PUCHAR, PUCHAR, PINT);
+
+/*
+ * End of file: trust.h
+ *
+ */
+
+
\ No newline at end of file